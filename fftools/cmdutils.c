@@ -868,6 +868,12 @@ int opt_cpuflags(void *optctx, const char *opt, const char *arg)
     return 0;
 }
 
+int opt_shared_threads(void *optctx, const char *opt, const char *arg)
+{
+    av_cpu_set_shared_pool_size(parse_number_or_die(opt, arg, OPT_INT, 0, INT_MAX));
+    return 0;
+}
+
 int opt_loglevel(void *optctx, const char *opt, const char *arg)
 {
     const struct { const char *name; int level; } log_levels[] = {
@@ -88,6 +88,11 @@ void log_callback_help(void* ptr, int level, const char* fmt, va_list vl);
  */
 int opt_cpuflags(void *optctx, const char *opt, const char *arg);
 
+/**
+ * Set the size of the worker pool shared by slice threading contexts.
+ */
+int opt_shared_threads(void *optctx, const char *opt, const char *arg);
+
 /**
  * Fallback for options that are not explicitly handled, these will be
  * parsed through AVOptions.
@@ -239,6 +244,7 @@ void show_help_options(const OptionDef *options, const char *msg, int req_flags,
     { "report",      0,                    { .func_arg = opt_report },       "generate a report" },                     \
     { "max_alloc",   HAS_ARG,              { .func_arg = opt_max_alloc },    "set maximum size of a single allocated block", "bytes" }, \
     { "cpuflags",    HAS_ARG | OPT_EXPERT, { .func_arg = opt_cpuflags },     "force specific cpu flags", "flags" },     \
+    { "shared_threads", HAS_ARG | OPT_EXPERT, { .func_arg = opt_shared_threads }, "share a pool of worker threads between slice threading contexts", "count" }, \
     { "hide_banner", OPT_BOOL | OPT_EXPERT, {&hide_banner},     "do not show program banner", "hide_banner" },          \
     CMDUTILS_COMMON_OPTIONS_AVDEVICE                                                                                    \
 
@@ -127,14 +127,17 @@ typedef struct BenchmarkTimeStamps {
 } BenchmarkTimeStamps;
 
 static void do_video_stats(OutputStream *ost, int frame_size);
+#if HAVE_THREADS
+static int free_encoder_threads(int abort);
+#endif
 static BenchmarkTimeStamps get_benchmark_time_stamps(void);
 static int64_t getmaxrss(void);
 static int ifilter_has_all_input_formats(FilterGraph *fg);
 
 static int run_as_daemon  = 0;
-static int nb_frames_dup = 0;
+static atomic_int nb_frames_dup = ATOMIC_VAR_INIT(0);
 static unsigned dup_warning = 1000;
-static int nb_frames_drop = 0;
+static atomic_int nb_frames_drop = ATOMIC_VAR_INIT(0);
 static int64_t decode_error_stat[2];
 
 static int want_sdp = 1;
@@ -166,7 +169,26 @@ static int restore_tty;
 
 #if HAVE_THREADS
 static void free_input_threads(void);
+
+/* serializes muxer access between the main thread and the encoder threads */
+static pthread_mutex_t mux_mutex;
+#endif
+
+static void lock_muxers(void)
+{
+#if HAVE_THREADS
+    if (enc_thread_queue_size > 0)
+        pthread_mutex_lock(&mux_mutex);
 #endif
+}
+
+static void unlock_muxers(void)
+{
+#if HAVE_THREADS
+    if (enc_thread_queue_size > 0)
+        pthread_mutex_unlock(&mux_mutex);
+#endif
+}
 
 /* sub2video hack:
    Convert subtitles to video with alpha to insert them in filter graphs.
@@ -489,6 +511,14 @@ static void ffmpeg_cleanup(int ret)
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%ikB\n", maxrss);
     }
 
+#if HAVE_THREADS
+    /* The encoder threads never call exit_program(), so after a fatal error
+     * on the main thread they are still running and must be stopped before
+     * the state they use is freed. On regular exits they have already been
+     * joined by transcode(). */
+    free_encoder_threads(1);
+#endif
+
     for (i = 0; i < nb_filtergraphs; i++) {
         FilterGraph *fg = filtergraphs[i];
         avfilter_graph_free(&fg->graph);
@@ -613,6 +643,7 @@ static void ffmpeg_cleanup(int ret)
                    av_err2str(AVERROR(errno)));
     }
     av_freep(&vstats_filename);
+    perf_uninit();
 
     av_freep(&input_streams);
     av_freep(&input_files);
@@ -686,10 +717,15 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     }
 }
 
-static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
+/*
+ * Errors that must abort the transcoding are returned rather than acted upon
+ * with exit_program(), since this may run on an encoder thread.
+ */
+static int write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
 {
     AVFormatContext *s = of->ctx;
     AVStream *st = ost->st;
+    PerfTimer timer;
     int ret;
 
     /*
@@ -703,7 +739,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
     if (!(st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ost->encoding_needed) && !unqueue) {
         if (ost->frame_number >= ost->max_frames) {
             av_packet_unref(pkt);
-            return;
+            return 0;
         }
         ost->frame_number++;
     }
@@ -718,18 +754,19 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
                 av_log(NULL, AV_LOG_ERROR,
                        "Too many packets buffered for output stream %d:%d.\n",
                        ost->file_index, ost->st->index);
-                exit_program(1);
+                ret = AVERROR(ENOSPC);
+                goto fail;
             }
             ret = av_fifo_realloc2(ost->muxing_queue, new_size);
             if (ret < 0)
-                exit_program(1);
+                goto fail;
         }
         ret = av_packet_make_refcounted(pkt);
         if (ret < 0)
-            exit_program(1);
+            goto fail;
         av_packet_move_ref(&tmp_pkt, pkt);
         av_fifo_generic_write(ost->muxing_queue, &tmp_pkt, sizeof(tmp_pkt), NULL);
-        return;
+        return 0;
     }
 
     if ((st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && video_sync_method == VSYNC_DROP) ||
@@ -784,7 +821,8 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
                        ost->file_index, ost->st->index, ost->last_mux_dts, pkt->dts);
                 if (exit_on_error) {
                     av_log(NULL, AV_LOG_FATAL, "aborting.\n");
-                    exit_program(1);
+                    ret = AVERROR(EINVAL);
+                    goto fail;
                 }
                 av_log(s, loglevel, "changing to %"PRId64". This may result "
                        "in incorrect timestamps in the output file.\n",
@@ -812,24 +850,33 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
               );
     }
 
+    perf_start(&timer);
     ret = av_interleaved_write_frame(s, pkt);
+    perf_stop(&ost->perf_mux, &timer);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
         main_return_code = 1;
         close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
     }
     av_packet_unref(pkt);
+    return 0;
+
+fail:
+    av_packet_unref(pkt);
+    return ret;
 }
 
 static void close_output_stream(OutputStream *ost)
 {
     OutputFile *of = output_files[ost->file_index];
 
+    lock_muxers();
     ost->finished |= ENCODER_FINISHED;
     if (of->shortest) {
         int64_t end = av_rescale_q(ost->sync_opts - ost->first_pts, ost->enc_ctx->time_base, AV_TIME_BASE_Q);
         of->recording_time = FFMIN(of->recording_time, end);
     }
+    unlock_muxers();
 }
 
 /*
@@ -842,12 +889,16 @@ static void close_output_stream(OutputStream *ost)
  * If eof is set, instead indicate EOF to all bitstream filters and
  * therefore flush any delayed packets to the output.  A blank packet
  * must be supplied in this case.
+ *
+ * Returns a negative error code if the transcoding must be aborted.
  */
-static void output_packet(OutputFile *of, AVPacket *pkt,
-                          OutputStream *ost, int eof)
+static int output_packet(OutputFile *of, AVPacket *pkt,
+                         OutputStream *ost, int eof)
 {
     int ret = 0;
 
+    lock_muxers();
+
     /* apply the output bitstream filters, if any */
     if (ost->nb_bitstream_filters) {
         int idx;
@@ -879,19 +930,25 @@ static void output_packet(OutputFile *of, AVPacket *pkt,
                 eof = 0;
             } else if (eof)
                 goto finish;
-            else
-                write_packet(of, pkt, ost, 0);
+            else if ((ret = write_packet(of, pkt, ost, 0)) < 0)
+                goto fail;
         }
-    } else if (!eof)
-        write_packet(of, pkt, ost, 0);
+    } else if (!eof && (ret = write_packet(of, pkt, ost, 0)) < 0)
+        goto fail;
 
 finish:
+    unlock_muxers();
     if (ret < 0 && ret != AVERROR_EOF) {
         av_log(NULL, AV_LOG_ERROR, "Error applying bitstream filters to an output "
                "packet for stream #%d:%d.\n", ost->file_index, ost->index);
         if(exit_on_error)
-            exit_program(1);
+            return ret;
     }
+    return 0;
+
+fail:
+    unlock_muxers();
+    return ret;
 }
 
 static int check_recording_time(OutputStream *ost)
@@ -907,11 +964,13 @@ static int check_recording_time(OutputStream *ost)
     return 1;
 }
 
-static void do_audio_out(OutputFile *of, OutputStream *ost,
-                         AVFrame *frame)
+static int do_audio_out(OutputFile *of, OutputStream *ost,
+                        AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket pkt;
+    PerfTimer timer;
+    int64_t origin;
     int ret;
 
     av_init_packet(&pkt);
@@ -919,7 +978,7 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
     pkt.size = 0;
 
     if (!check_recording_time(ost))
-        return;
+        return 0;
 
     if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
         frame->pts = ost->sync_opts;
@@ -936,18 +995,22 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
                enc->time_base.num, enc->time_base.den);
     }
 
+    perf_frame_in(&ost->perf_latency, frame->pts, frame->reordered_opaque);
+    perf_start(&timer);
     ret = avcodec_send_frame(enc, frame);
     if (ret < 0)
         goto error;
 
     while (1) {
         ret = avcodec_receive_packet(enc, &pkt);
+        perf_stop(&ost->perf_encode, &timer);
         if (ret == AVERROR(EAGAIN))
             break;
         if (ret < 0)
             goto error;
 
         update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
+        origin = perf_frame_origin(&ost->perf_latency, pkt.pts);
 
         av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
 
@@ -958,13 +1021,16 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
         }
 
-        output_packet(of, &pkt, ost, 0);
+        if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+            return ret;
+        perf_frame_out(&ost->perf_latency, origin);
+        perf_start(&timer);
     }
 
-    return;
+    return 0;
 error:
     av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
-    exit_program(1);
+    return ret;
 }
 
 static void do_subtitle_out(OutputFile *of,
@@ -1046,31 +1112,32 @@ static void do_subtitle_out(OutputFile *of,
                 pkt.pts += av_rescale_q(sub->end_display_time, (AVRational){ 1, 1000 }, ost->mux_timebase);
         }
         pkt.dts = pkt.pts;
-        output_packet(of, &pkt, ost, 0);
+        if (output_packet(of, &pkt, ost, 0) < 0)
+            exit_program(1);
     }
 }
 
-static void do_video_out(OutputFile *of,
-                         OutputStream *ost,
-                         AVFrame *next_picture,
-                         double sync_ipts)
+static int do_video_out(OutputFile *of,
+                        OutputStream *ost,
+                        AVFrame *next_picture,
+                        double sync_ipts,
+                        AVRational frame_rate)
 {
     int ret, format_video_sync;
     AVPacket pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVCodecParameters *mux_par = ost->st->codecpar;
-    AVRational frame_rate;
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
     int frame_size = 0;
     InputStream *ist = NULL;
-    AVFilterContext *filter = ost->filter->filter;
+    PerfTimer timer;
+    int64_t origin;
 
     if (ost->source_index >= 0)
         ist = input_streams[ost->source_index];
 
-    frame_rate = av_buffersink_get_frame_rate(filter);
     if (frame_rate.num > 0 && frame_rate.den > 0)
         duration = 1/(av_q2d(frame_rate) * av_q2d(enc->time_base));
 
@@ -1174,7 +1241,7 @@ static void do_video_out(OutputFile *of,
     ost->last_nb0_frames[0] = nb0_frames;
 
     if (nb0_frames == 0 && ost->last_dropped) {
-        nb_frames_drop++;
+        atomic_fetch_add(&nb_frames_drop, 1);
         av_log(NULL, AV_LOG_VERBOSE,
                "*** dropping frame %d from stream %d at ts %"PRId64"\n",
                ost->frame_number, ost->st->index, ost->last_frame->pts);
@@ -1182,12 +1249,12 @@ static void do_video_out(OutputFile *of,
     if (nb_frames > (nb0_frames && ost->last_dropped) + (nb_frames > nb0_frames)) {
         if (nb_frames > dts_error_threshold * 30) {
             av_log(NULL, AV_LOG_ERROR, "%d frame duplication too large, skipping\n", nb_frames - 1);
-            nb_frames_drop++;
-            return;
+            atomic_fetch_add(&nb_frames_drop, 1);
+            return 0;
         }
-        nb_frames_dup += nb_frames - (nb0_frames && ost->last_dropped) - (nb_frames > nb0_frames);
+        atomic_fetch_add(&nb_frames_dup, nb_frames - (nb0_frames && ost->last_dropped) - (nb_frames > nb0_frames));
         av_log(NULL, AV_LOG_VERBOSE, "*** %d dup!\n", nb_frames - 1);
-        if (nb_frames_dup > dup_warning) {
+        if (atomic_load(&nb_frames_dup) > dup_warning) {
             av_log(NULL, AV_LOG_WARNING, "More than %d frames duplicated\n", dup_warning);
             dup_warning *= 10;
         }
@@ -1209,12 +1276,12 @@ static void do_video_out(OutputFile *of,
             in_picture = next_picture;
 
         if (!in_picture)
-            return;
+            return 0;
 
         in_picture->pts = ost->sync_opts;
 
         if (!check_recording_time(ost))
-            return;
+            return 0;
 
         if (enc->flags & (AV_CODEC_FLAG_INTERLACED_DCT | AV_CODEC_FLAG_INTERLACED_ME) &&
             ost->top_field_first >= 0)
@@ -1284,6 +1351,8 @@ static void do_video_out(OutputFile *of,
 
         ost->frames_encoded++;
 
+        perf_frame_in(&ost->perf_latency, in_picture->pts, in_picture->reordered_opaque);
+        perf_start(&timer);
         ret = avcodec_send_frame(enc, in_picture);
         if (ret < 0)
             goto error;
@@ -1293,11 +1362,14 @@ static void do_video_out(OutputFile *of,
         while (1) {
             ret = avcodec_receive_packet(enc, &pkt);
             update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
+            perf_stop(&ost->perf_encode, &timer);
             if (ret == AVERROR(EAGAIN))
                 break;
             if (ret < 0)
                 goto error;
 
+            origin = perf_frame_origin(&ost->perf_latency, pkt.pts);
+
             if (debug_ts) {
                 av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
                        "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
@@ -1318,12 +1390,15 @@ static void do_video_out(OutputFile *of,
             }
 
             frame_size = pkt.size;
-            output_packet(of, &pkt, ost, 0);
+            if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+                return ret;
+            perf_frame_out(&ost->perf_latency, origin);
 
             /* if two pass, output log */
             if (ost->logfile && enc->stats_out) {
                 fprintf(ost->logfile, "%s", enc->stats_out);
             }
+            perf_start(&timer);
         }
         ost->sync_opts++;
         /*
@@ -1345,10 +1420,10 @@ static void do_video_out(OutputFile *of,
     else
         av_frame_free(&ost->last_frame);
 
-    return;
+    return 0;
 error:
     av_log(NULL, AV_LOG_FATAL, "Video encoding failed\n");
-    exit_program(1);
+    return ret;
 }
 
 static double psnr(double d)
@@ -1356,36 +1431,35 @@ static double psnr(double d)
     return -10.0 * log10(d);
 }
 
+/*
+ * The line is built in a buffer and written in one call under the muxer lock,
+ * which also protects the stream statistics read here, so that the lines of
+ * the encoder threads do not interleave.
+ */
 static void do_video_stats(OutputStream *ost, int frame_size)
 {
     AVCodecContext *enc;
+    AVBPrint buf;
     int frame_number;
     double ti1, bitrate, avg_bitrate;
 
-    /* this is executed just the first time do_video_stats is called */
-    if (!vstats_file) {
-        vstats_file = fopen(vstats_filename, "w");
-        if (!vstats_file) {
-            perror("fopen");
-            exit_program(1);
-        }
-    }
-
     enc = ost->enc_ctx;
     if (enc->codec_type == AVMEDIA_TYPE_VIDEO) {
+        av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+        lock_muxers();
         frame_number = ost->st->nb_frames;
         if (vstats_version <= 1) {
-            fprintf(vstats_file, "frame= %5d q= %2.1f ", frame_number,
-                    ost->quality / (float)FF_QP2LAMBDA);
+            av_bprintf(&buf, "frame= %5d q= %2.1f ", frame_number,
+                       ost->quality / (float)FF_QP2LAMBDA);
         } else  {
-            fprintf(vstats_file, "out= %2d st= %2d frame= %5d q= %2.1f ", ost->file_index, ost->index, frame_number,
-                    ost->quality / (float)FF_QP2LAMBDA);
+            av_bprintf(&buf, "out= %2d st= %2d frame= %5d q= %2.1f ", ost->file_index, ost->index, frame_number,
+                       ost->quality / (float)FF_QP2LAMBDA);
         }
 
         if (ost->error[0]>=0 && (enc->flags & AV_CODEC_FLAG_PSNR))
-            fprintf(vstats_file, "PSNR= %6.2f ", psnr(ost->error[0] / (enc->width * enc->height * 255.0 * 255.0)));
+            av_bprintf(&buf, "PSNR= %6.2f ", psnr(ost->error[0] / (enc->width * enc->height * 255.0 * 255.0)));
 
-        fprintf(vstats_file,"f_size= %6d ", frame_size);
+        av_bprintf(&buf,"f_size= %6d ", frame_size);
         /* compute pts value */
         ti1 = av_stream_get_end_pts(ost->st) * av_q2d(ost->st->time_base);
         if (ti1 < 0.01)
@@ -1393,9 +1467,12 @@ static void do_video_stats(OutputStream *ost, int frame_size)
 
         bitrate     = (frame_size * 8) / av_q2d(enc->time_base) / 1000.0;
         avg_bitrate = (double)(ost->data_size * 8) / ti1 / 1000.0;
-        fprintf(vstats_file, "s_size= %8.0fkB time= %0.3f br= %7.1fkbits/s avg_br= %7.1fkbits/s ",
-               (double)ost->data_size / 1024, ti1, bitrate, avg_bitrate);
-        fprintf(vstats_file, "type= %c\n", av_get_picture_type_char(ost->pict_type));
+        av_bprintf(&buf, "s_size= %8.0fkB time= %0.3f br= %7.1fkbits/s avg_br= %7.1fkbits/s ",
+                   (double)ost->data_size / 1024, ti1, bitrate, avg_bitrate);
+        av_bprintf(&buf, "type= %c\n", av_get_picture_type_char(ost->pict_type));
+        fputs(buf.str, vstats_file);
+        unlock_muxers();
+        av_bprint_finalize(&buf, NULL);
     }
 }
 
@@ -1414,6 +1491,179 @@ static void finish_output_stream(OutputStream *ost)
     }
 }
 
+/*
+ * Encode a frame returned by the buffersink of the output stream and send the
+ * resulting packets to the muxer. A NULL frame flushes the video sync code.
+ * frame_rate is the frame rate of the buffersink when the frame was returned,
+ * as the filtergraph may be reconfigured in the meantime.
+ * Returns a negative error code if the transcoding must be aborted.
+ */
+static int do_filtered_frame_out(OutputFile *of, OutputStream *ost,
+                                 AVFrame *filtered_frame, double float_pts,
+                                 AVRational frame_rate)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+
+    if (!filtered_frame)
+        return do_video_out(of, ost, NULL, AV_NOPTS_VALUE, frame_rate);
+
+    switch (enc->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        if (!ost->frame_aspect_ratio.num)
+            enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
+                    av_ts2str(filtered_frame->pts), av_ts2timestr(filtered_frame->pts, &enc->time_base),
+                    float_pts,
+                    enc->time_base.num, enc->time_base.den);
+        }
+
+        return do_video_out(of, ost, filtered_frame, float_pts, frame_rate);
+    case AVMEDIA_TYPE_AUDIO:
+        if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
+            enc->channels != filtered_frame->channels) {
+            av_log(NULL, AV_LOG_ERROR,
+                   "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
+            return 0;
+        }
+        return do_audio_out(of, ost, filtered_frame);
+    default:
+        // TODO support subtitle filters
+        av_assert0(0);
+    }
+    return 0;
+}
+
+#if HAVE_THREADS
+typedef struct EncoderThreadMessage {
+    AVFrame *frame;     /* NULL to flush the video sync code */
+    double float_pts;
+    AVRational frame_rate; /* of the buffersink, the thread must not access the filtergraph */
+} EncoderThreadMessage;
+
+static void encoder_thread_message_free(void *arg)
+{
+    EncoderThreadMessage *msg = arg;
+    av_frame_free(&msg->frame);
+}
+
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile    *of = output_files[ost->file_index];
+    EncoderThreadMessage msg;
+    int ret;
+
+    while (av_thread_message_queue_recv(ost->enc_thread_queue, &msg, 0) >= 0) {
+        ret = do_filtered_frame_out(of, ost, msg.frame, msg.float_pts, msg.frame_rate);
+        av_frame_free(&msg.frame);
+        if (ret < 0) {
+            /* exit_program() must not run here, the main thread picks the
+             * error up on its next send or when joining the thread */
+            ost->enc_thread_ret = ret;
+            av_thread_message_queue_set_err_send(ost->enc_thread_queue, ret);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int init_encoder_thread(OutputStream *ost)
+{
+    int ret;
+
+    ret = av_thread_message_queue_alloc(&ost->enc_thread_queue,
+                                        enc_thread_queue_size,
+                                        sizeof(EncoderThreadMessage));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(ost->enc_thread_queue,
+                                          encoder_thread_message_free);
+
+    if ((ret = pthread_create(&ost->enc_thread, NULL, encoder_thread, ost))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        av_thread_message_queue_free(&ost->enc_thread_queue);
+        return AVERROR(ret);
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the encoder threads. Unless abort is set, all the queued frames are
+ * encoded before the threads exit. Returns the first error that made one of
+ * the threads stop.
+ */
+static int free_encoder_threads(int abort)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+
+        if (!ost || !ost->enc_thread_queue)
+            continue;
+        if (abort)
+            av_thread_message_flush(ost->enc_thread_queue);
+        av_thread_message_queue_set_err_recv(ost->enc_thread_queue, AVERROR_EOF);
+        pthread_join(ost->enc_thread, NULL);
+        av_thread_message_queue_free(&ost->enc_thread_queue);
+        if (!ret)
+            ret = ost->enc_thread_ret;
+    }
+
+    return ret;
+}
+#endif
+
+/*
+ * Hand a filtered frame over to the encoder of the output stream, either
+ * directly or through the encoder thread of the stream when threaded encoding
+ * is enabled. The frame is consumed.
+ */
+static void send_filtered_frame(OutputFile *of, OutputStream *ost,
+                                AVFrame *filtered_frame, double float_pts)
+{
+    AVRational frame_rate = { 0, 1 };
+
+    if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        frame_rate = av_buffersink_get_frame_rate(ost->filter->filter);
+
+#if HAVE_THREADS
+    if (enc_thread_queue_size > 0) {
+        EncoderThreadMessage msg = { NULL, float_pts, frame_rate };
+        int ret;
+
+        if (!ost->enc_thread_queue && (ret = init_encoder_thread(ost)) < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Could not start encoder thread for output stream %d:%d: %s\n",
+                   ost->file_index, ost->index, av_err2str(ret));
+            exit_program(1);
+        }
+        if (filtered_frame) {
+            if (!(msg.frame = av_frame_alloc()))
+                exit_program(1);
+            av_frame_move_ref(msg.frame, filtered_frame);
+        }
+        perf_sample_queue(&ost->perf_enc_queue,
+                          av_thread_message_queue_nb_elems(ost->enc_thread_queue));
+        /* blocks while the queue is full, throttling the producing graph */
+        ret = av_thread_message_queue_send(ost->enc_thread_queue, &msg, 0);
+        if (ret < 0) {
+            /* the encoder thread stopped on a fatal error */
+            av_frame_free(&msg.frame);
+            exit_program(1);
+        }
+        return;
+    }
+#endif
+    if (do_filtered_frame_out(of, ost, filtered_frame, float_pts, frame_rate) < 0)
+        exit_program(1);
+    if (filtered_frame)
+        av_frame_unref(filtered_frame);
+}
+
 /**
  * Get and encode new output from any of the filtergraphs, without causing
  * activity.
@@ -1462,7 +1712,7 @@ static int reap_filters(int flush)
                            "Error in av_buffersink_get_frame_flags(): %s\n", av_err2str(ret));
                 } else if (flush && ret == AVERROR_EOF) {
                     if (av_buffersink_get_type(filter) == AVMEDIA_TYPE_VIDEO)
-                        do_video_out(of, ost, NULL, AV_NOPTS_VALUE);
+                        send_filtered_frame(of, ost, NULL, AV_NOPTS_VALUE);
                 }
                 break;
             }
@@ -1489,35 +1739,7 @@ static int reap_filters(int flush)
                     av_rescale_q(start_time, AV_TIME_BASE_Q, enc->time_base);
             }
 
-            switch (av_buffersink_get_type(filter)) {
-            case AVMEDIA_TYPE_VIDEO:
-                if (!ost->frame_aspect_ratio.num)
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
-
-                if (debug_ts) {
-                    av_log(NULL, AV_LOG_INFO, "filter -> pts:%s pts_time:%s exact:%f time_base:%d/%d\n",
-                            av_ts2str(filtered_frame->pts), av_ts2timestr(filtered_frame->pts, &enc->time_base),
-                            float_pts,
-                            enc->time_base.num, enc->time_base.den);
-                }
-
-                do_video_out(of, ost, filtered_frame, float_pts);
-                break;
-            case AVMEDIA_TYPE_AUDIO:
-                if (!(enc->codec->capabilities & AV_CODEC_CAP_PARAM_CHANGE) &&
-                    enc->channels != filtered_frame->channels) {
-                    av_log(NULL, AV_LOG_ERROR,
-                           "Audio filter graph output is not normalized and encoder does not support parameter changes\n");
-                    break;
-                }
-                do_audio_out(of, ost, filtered_frame);
-                break;
-            default:
-                // TODO support subtitle filters
-                av_assert0(0);
-            }
-
-            av_frame_unref(filtered_frame);
+            send_filtered_frame(of, ost, filtered_frame, float_pts);
         }
     }
 
@@ -1649,6 +1871,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     int64_t total_size;
     AVCodecContext *enc;
     int frame_number, vid, i;
+    int nb_dup, nb_drop;
     double bitrate;
     double speed;
     int64_t pts = INT64_MIN + 1;
@@ -1677,6 +1900,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
 
     oc = output_files[0]->ctx;
 
+    lock_muxers();
     total_size = avio_size(oc->pb);
     if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
         total_size = avio_tell(oc->pb);
@@ -1754,8 +1978,9 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             pts = FFMAX(pts, av_rescale_q(av_stream_get_end_pts(ost->st),
                                           ost->st->time_base, AV_TIME_BASE_Q));
         if (is_last_report)
-            nb_frames_drop += ost->last_dropped;
+            atomic_fetch_add(&nb_frames_drop, ost->last_dropped);
     }
+    unlock_muxers();
 
     secs = FFABS(pts) / AV_TIME_BASE;
     us = FFABS(pts) % AV_TIME_BASE;
@@ -1798,10 +2023,12 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
                    hours_sign, hours, mins, secs, us);
     }
 
-    if (nb_frames_dup || nb_frames_drop)
-        av_bprintf(&buf, " dup=%d drop=%d", nb_frames_dup, nb_frames_drop);
-    av_bprintf(&buf_script, "dup_frames=%d\n", nb_frames_dup);
-    av_bprintf(&buf_script, "drop_frames=%d\n", nb_frames_drop);
+    nb_dup  = atomic_load(&nb_frames_dup);
+    nb_drop = atomic_load(&nb_frames_drop);
+    if (nb_dup || nb_drop)
+        av_bprintf(&buf, " dup=%d drop=%d", nb_dup, nb_drop);
+    av_bprintf(&buf_script, "dup_frames=%d\n", nb_dup);
+    av_bprintf(&buf_script, "drop_frames=%d\n", nb_drop);
 
     if (speed < 0) {
         av_bprintf(&buf, " speed=N/A");
@@ -1912,6 +2139,8 @@ static void flush_encoders(void)
         for (;;) {
             const char *desc = NULL;
             AVPacket pkt;
+            PerfTimer timer;
+            int64_t origin;
             int pkt_size;
 
             switch (enc->codec_type) {
@@ -1930,6 +2159,7 @@ static void flush_encoders(void)
             pkt.size = 0;
 
             update_benchmark(NULL);
+            perf_start(&timer);
 
             while ((ret = avcodec_receive_packet(enc, &pkt)) == AVERROR(EAGAIN)) {
                 ret = avcodec_send_frame(enc, NULL);
@@ -1942,6 +2172,7 @@ static void flush_encoders(void)
             }
 
             update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+            perf_stop(&ost->perf_encode, &timer);
             if (ret < 0 && ret != AVERROR_EOF) {
                 av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
                        desc,
@@ -1952,16 +2183,20 @@ static void flush_encoders(void)
                 fprintf(ost->logfile, "%s", enc->stats_out);
             }
             if (ret == AVERROR_EOF) {
-                output_packet(of, &pkt, ost, 1);
+                if (output_packet(of, &pkt, ost, 1) < 0)
+                    exit_program(1);
                 break;
             }
             if (ost->finished & MUXER_FINISHED) {
                 av_packet_unref(&pkt);
                 continue;
             }
+            origin = perf_frame_origin(&ost->perf_latency, pkt.pts);
             av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
             pkt_size = pkt.size;
-            output_packet(of, &pkt, ost, 0);
+            if (output_packet(of, &pkt, ost, 0) < 0)
+                exit_program(1);
+            perf_frame_out(&ost->perf_latency, origin);
             if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
                 do_video_stats(ost, pkt_size);
             }
@@ -2001,7 +2236,8 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
 
     // EOF: flush output bitstream filters.
     if (!pkt) {
-        output_packet(of, &opkt, ost, 1);
+        if (output_packet(of, &opkt, ost, 1) < 0)
+            exit_program(1);
         return;
     }
 
@@ -2073,7 +2309,9 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
 
     av_copy_packet_side_data(&opkt, pkt);
 
-    output_packet(of, &opkt, ost, 0);
+    if (output_packet(of, &opkt, ost, 0) < 0)
+        exit_program(1);
+    perf_frame_out(&ost->perf_latency, ist->perf_pkt_time);
 }
 
 int guess_input_channel_layout(InputStream *ist)
@@ -2129,6 +2367,7 @@ static int ifilter_has_all_input_formats(FilterGraph *fg)
 static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
 {
     FilterGraph *fg = ifilter->graph;
+    PerfTimer timer;
     int need_reinit, ret, i;
 
     /* determine if the parameters for this input changed */
@@ -2193,7 +2432,9 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         }
     }
 
+    perf_start(&timer);
     ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
+    perf_stop(&fg->perf_filter, &timer);
     if (ret < 0) {
         if (ret != AVERROR_EOF)
             av_log(NULL, AV_LOG_ERROR, "Error while filtering: %s\n", av_err2str(ret));
@@ -2205,12 +2446,15 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
 
 static int ifilter_send_eof(InputFilter *ifilter, int64_t pts)
 {
+    PerfTimer timer;
     int ret;
 
     ifilter->eof = 1;
 
     if (ifilter->filter) {
+        perf_start(&timer);
         ret = av_buffersrc_close(ifilter->filter, pts, AV_BUFFERSRC_FLAG_PUSH);
+        perf_stop(&ifilter->graph->perf_filter, &timer);
         if (ret < 0)
             return ret;
     } else {
@@ -2284,6 +2528,7 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
 {
     AVFrame *decoded_frame;
     AVCodecContext *avctx = ist->dec_ctx;
+    PerfTimer timer;
     int ret, err = 0;
     AVRational decoded_frame_tb;
 
@@ -2293,8 +2538,12 @@ static int decode_audio(InputStream *ist, AVPacket *pkt, int *got_output,
         return AVERROR(ENOMEM);
     decoded_frame = ist->decoded_frame;
 
+    if (do_perf)
+        avctx->reordered_opaque = ist->perf_pkt_time;
     update_benchmark(NULL);
+    perf_start(&timer);
     ret = decode(avctx, decoded_frame, got_output, pkt);
+    perf_stop(&ist->perf_decode, &timer);
     update_benchmark("decode_audio %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2349,6 +2598,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     int64_t best_effort_timestamp;
     int64_t dts = AV_NOPTS_VALUE;
     AVPacket avpkt;
+    PerfTimer timer;
 
     // With fate-indeo3-2, we're getting 0-sized packets before EOF for some
     // reason. This seems like a semi-critical bug. Don't trigger EOF, and
@@ -2378,8 +2628,12 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
         ist->dts_buffer[ist->nb_dts_buffer++] = dts;
     }
 
+    if (do_perf)
+        ist->dec_ctx->reordered_opaque = ist->perf_pkt_time;
     update_benchmark(NULL);
+    perf_start(&timer);
     ret = decode(ist->dec_ctx, decoded_frame, got_output, pkt ? &avpkt : NULL);
+    perf_stop(&ist->perf_decode, &timer);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -2478,9 +2732,13 @@ static int transcode_subtitles(InputStream *ist, AVPacket *pkt, int *got_output,
                                int *decode_failed)
 {
     AVSubtitle subtitle;
+    PerfTimer timer;
     int free_sub = 1;
-    int i, ret = avcodec_decode_subtitle2(ist->dec_ctx,
-                                          &subtitle, got_output, pkt);
+    int i, ret;
+
+    perf_start(&timer);
+    ret = avcodec_decode_subtitle2(ist->dec_ctx, &subtitle, got_output, pkt);
+    perf_stop(&ist->perf_decode, &timer);
 
     check_decode_result(NULL, got_output, ret);
 
@@ -3000,14 +3258,20 @@ static int check_init_output_file(OutputFile *of, int file_index)
     for (i = 0; i < of->ctx->nb_streams; i++) {
         OutputStream *ost = output_streams[of->ost_index + i];
 
-        /* try to improve muxing time_base (only possible if nothing has been written yet) */
-        if (!av_fifo_size(ost->muxing_queue))
+        /* try to improve muxing time_base (only possible if nothing has been written yet);
+         * an encoder thread may already be producing packets in the old one */
+        if (!av_fifo_size(ost->muxing_queue)
+#if HAVE_THREADS
+            && !ost->enc_thread_queue
+#endif
+            )
             ost->mux_timebase = ost->st->time_base;
 
         while (av_fifo_size(ost->muxing_queue)) {
             AVPacket pkt;
             av_fifo_generic_read(ost->muxing_queue, &pkt, sizeof(pkt), NULL);
-            write_packet(of, &pkt, ost, 1);
+            if ((ret = write_packet(of, &pkt, ost, 1)) < 0)
+                return ret;
         }
     }
 
@@ -3638,7 +3902,9 @@ static int init_output_stream(OutputStream *ost, char *error, int error_len)
 
     ost->initialized = 1;
 
+    lock_muxers();
     ret = check_init_output_file(output_files[ost->file_index], ost->file_index);
+    unlock_muxers();
     if (ret < 0)
         return ret;
 
@@ -3683,6 +3949,18 @@ static int transcode_init(void)
         }
     }
 
+    /* opened here rather than on the first frame, as the encoder threads
+     * write to it concurrently */
+    if (vstats_filename && !vstats_file) {
+        vstats_file = fopen(vstats_filename, "w");
+        if (!vstats_file) {
+            ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_ERROR, "Could not open vstats file %s: %s\n",
+                   vstats_filename, av_err2str(ret));
+            return ret;
+        }
+    }
+
     /* init framerate emulation */
     for (i = 0; i < nb_input_files; i++) {
         InputFile *ifile = input_files[i];
@@ -3841,9 +4119,14 @@ static int need_output(void)
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
+        int64_t size;
 
-        if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+        if (ost->finished)
+            continue;
+        lock_muxers();
+        size = os->pb ? avio_tell(os->pb) : -1;
+        unlock_muxers();
+        if (size >= 0 && size >= of->limit_filesize)
             continue;
         if (ost->frame_number >= ost->max_frames) {
             int j;
@@ -4028,7 +4311,11 @@ static void *input_thread(void *arg)
 
     while (1) {
         AVPacket pkt;
+        PerfTimer timer;
+
+        perf_start(&timer);
         ret = av_read_frame(f->ctx, &pkt);
+        perf_stop(&f->perf_demux, &timer);
 
         if (ret == AVERROR(EAGAIN)) {
             av_usleep(10000);
@@ -4069,6 +4356,9 @@ static void free_input_thread(int i)
     if (!f || !f->in_thread_queue)
         return;
     av_thread_message_queue_set_err_send(f->in_thread_queue, AVERROR_EOF);
+    while (f->in_pkts_pos < f->nb_in_pkts)
+        av_packet_unref(&f->in_pkts[f->in_pkts_pos++]);
+    f->in_pkts_pos = f->nb_in_pkts = 0;
     while (av_thread_message_queue_recv(f->in_thread_queue, &pkt, 0) >= 0)
         av_packet_unref(&pkt);
 
@@ -4124,14 +4414,31 @@ static int init_input_threads(void)
 
 static int get_input_packet_mt(InputFile *f, AVPacket *pkt)
 {
-    return av_thread_message_queue_recv(f->in_thread_queue, pkt,
-                                        f->non_blocking ?
-                                        AV_THREAD_MESSAGE_NONBLOCK : 0);
+    /* take all the queued packets at once, so that the queue is locked and
+     * the input thread woken up once per batch rather than once per packet */
+    if (f->in_pkts_pos == f->nb_in_pkts) {
+        int ret;
+
+        perf_sample_queue(&f->perf_queue, av_thread_message_queue_nb_elems(f->in_thread_queue));
+        ret = av_thread_message_queue_recv_multiple(f->in_thread_queue, f->in_pkts,
+                                                    FF_ARRAY_ELEMS(f->in_pkts),
+                                                    f->non_blocking ?
+                                                    AV_THREAD_MESSAGE_NONBLOCK : 0);
+        if (ret < 0)
+            return ret;
+        f->nb_in_pkts  = ret;
+        f->in_pkts_pos = 0;
+    }
+    *pkt = f->in_pkts[f->in_pkts_pos++];
+    return 0;
 }
 #endif
 
 static int get_input_packet(InputFile *f, AVPacket *pkt)
 {
+    PerfTimer timer;
+    int ret;
+
     if (f->rate_emu) {
         int i;
         for (i = 0; i < f->nb_streams; i++) {
@@ -4147,7 +4454,10 @@ static int get_input_packet(InputFile *f, AVPacket *pkt)
     if (nb_input_files > 1)
         return get_input_packet_mt(f, pkt);
 #endif
-    return av_read_frame(f->ctx, pkt);
+    perf_start(&timer);
+    ret = av_read_frame(f->ctx, pkt);
+    perf_stop(&f->perf_demux, &timer);
+    return ret;
 }
 
 static int got_eagain(void)
@@ -4515,6 +4825,8 @@ static int process_input(int file_index)
 
     sub2video_heartbeat(ist, pkt.pts);
 
+    if (do_perf)
+        ist->perf_pkt_time = av_gettime_relative();
     process_input_packet(ist, &pkt, 0);
 
 discard_packet:
@@ -4536,9 +4848,12 @@ static int transcode_from_filter(FilterGraph *graph, InputStream **best_ist)
     int nb_requests, nb_requests_max = 0;
     InputFilter *ifilter;
     InputStream *ist;
+    PerfTimer timer;
 
     *best_ist = NULL;
+    perf_start(&timer);
     ret = avfilter_graph_request_oldest(graph->graph);
+    perf_stop(&graph->perf_filter, &timer);
     if (ret >= 0)
         return reap_filters(0);
 
@@ -4660,6 +4975,15 @@ static int transcode(void)
     int64_t timer_start;
     int64_t total_packets_written = 0;
 
+#if HAVE_THREADS
+    if (enc_thread_queue_size > 0 && (ret = pthread_mutex_init(&mux_mutex, NULL)))
+        return AVERROR(ret);
+#endif
+
+    ret = perf_init();
+    if (ret < 0)
+        goto fail;
+
     ret = transcode_init();
     if (ret < 0)
         goto fail;
@@ -4709,6 +5033,10 @@ static int transcode(void)
             process_input_packet(ist, NULL, 0);
         }
     }
+#if HAVE_THREADS
+    if ((ret = free_encoder_threads(0)) < 0)
+        goto fail;
+#endif
     flush_encoders();
 
     term_exit();
@@ -4732,6 +5060,7 @@ static int transcode(void)
 
     /* dump report by using the first video and audio streams */
     print_report(1, timer_start, av_gettime_relative());
+    perf_write_report();
 
     /* close each encoder */
     for (i = 0; i < nb_output_streams; i++) {
@@ -4766,6 +5095,9 @@ static int transcode(void)
  fail:
 #if HAVE_THREADS
     free_input_threads();
+    free_encoder_threads(1);
+    if (enc_thread_queue_size > 0)
+        pthread_mutex_destroy(&mux_mutex);
 #endif
 
     if (output_streams) {
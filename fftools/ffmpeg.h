@@ -232,6 +232,40 @@ typedef struct OptionsContext {
     int        nb_enc_time_bases;
 } OptionsContext;
 
+/* per-stage profiling, see ffmpeg_perf.c */
+typedef struct PerfStage {
+    const char *kind;   /* "demux", "decode", "filter", "encode" or "mux" */
+    char name[64];
+    int lane;           /* trace event thread id the calls are drawn on */
+    int64_t nb_calls;
+    int64_t wall;       /* cumulative wall clock time in microseconds */
+    int64_t max_wall;   /* longest single call in microseconds */
+    int64_t cpu;        /* cumulative CPU time of the calling thread, -1 if unknown */
+} PerfStage;
+
+typedef struct PerfTimer {
+    int64_t wall;
+    int64_t cpu;
+} PerfTimer;
+
+typedef struct PerfQueue {
+    int64_t nb_samples;
+    int64_t sum;
+    int max;
+} PerfQueue;
+
+typedef struct PerfLatency {
+    /* time the source packets of the frames in the encoder were demuxed */
+    struct {
+        int64_t pts;
+        int64_t origin;
+    } pending[64];
+    int pending_pos;
+
+    int64_t nb_frames;
+    int64_t sum, min, max;  /* demux to mux latency in microseconds */
+} PerfLatency;
+
 typedef struct InputFilter {
     AVFilterContext    *filter;
     struct InputStream *ist;
@@ -290,6 +324,8 @@ typedef struct FilterGraph {
     int          nb_inputs;
     OutputFilter **outputs;
     int         nb_outputs;
+
+    PerfStage perf_filter;
 } FilterGraph;
 
 typedef struct InputStream {
@@ -388,6 +424,9 @@ typedef struct InputStream {
     int nb_dts_buffer;
 
     int got_output;
+
+    PerfStage perf_decode;
+    int64_t perf_pkt_time;  /* time the packet being processed was demuxed */
 } InputStream;
 
 typedef struct InputFile {
@@ -418,7 +457,13 @@ typedef struct InputFile {
     int non_blocking;           /* reading packets from the thread should not block */
     int joined;                 /* the thread has been joined */
     int thread_queue_size;      /* maximum number of queued packets */
+    AVPacket in_pkts[16];       /* packets received from the thread at once */
+    int nb_in_pkts;             /* number of packets in in_pkts */
+    int in_pkts_pos;            /* index of the next packet to return */
 #endif
+
+    PerfStage perf_demux;
+    PerfQueue perf_queue;       /* packets queued by the input thread */
 } InputFile;
 
 enum forced_keyframes_const {
@@ -549,6 +594,17 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+#if HAVE_THREADS
+    AVThreadMessageQueue *enc_thread_queue;
+    pthread_t enc_thread;       /* thread encoding and muxing this stream */
+    int enc_thread_ret;         /* error that made the encoder thread stop */
+#endif
+
+    PerfStage perf_encode;
+    PerfStage perf_mux;
+    PerfQueue perf_enc_queue;   /* frames queued for the encoder thread */
+    PerfLatency perf_latency;
 } OutputStream;
 
 typedef struct OutputFile {
@@ -579,6 +635,8 @@ extern int        nb_filtergraphs;
 
 extern char *vstats_filename;
 extern char *sdp_filename;
+extern char *perf_report_filename;
+extern char *perf_trace_filename;
 
 extern float audio_drift_threshold;
 extern float dts_delta_threshold;
@@ -609,7 +667,9 @@ extern char *videotoolbox_pixfmt;
 
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int enc_thread_queue_size;
 extern int vstats_version;
+extern int do_perf;
 
 extern const AVIOInterruptCB int_cb;
 
@@ -665,4 +725,14 @@ int hw_device_setup_for_encode(OutputStream *ost);
 
 int hwaccel_decode_init(AVCodecContext *avctx);
 
+int  perf_init(void);
+void perf_start(PerfTimer *t);
+void perf_stop(PerfStage *s, const PerfTimer *t);
+void perf_sample_queue(PerfQueue *q, int depth);
+void perf_frame_in(PerfLatency *l, int64_t pts, int64_t origin);
+int64_t perf_frame_origin(PerfLatency *l, int64_t pts);
+void perf_frame_out(PerfLatency *l, int64_t origin);
+int  perf_write_report(void);
+void perf_uninit(void);
+
 #endif /* FFTOOLS_FFMPEG_H */
@@ -110,6 +110,7 @@ int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
+int enc_thread_queue_size = 0;
 int vstats_version = 2;
 
 
@@ -3438,6 +3439,10 @@ const OptionDef options[] = {
         "add timings for benchmarking" },
     { "benchmark_all",  OPT_BOOL | OPT_EXPERT,                       { &do_benchmark_all },
       "add timings for each task" },
+    { "perf_report",    HAS_ARG | OPT_STRING | OPT_EXPERT,           { &perf_report_filename },
+      "write the time spent in each processing stage to a JSON file", "filename" },
+    { "perf_trace",     HAS_ARG | OPT_STRING | OPT_EXPERT,           { &perf_trace_filename },
+      "write the processing stages as Chrome trace events to a file", "filename" },
     { "progress",       HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_progress },
       "write program-readable progress information", "url" },
     { "stdin",          OPT_BOOL | OPT_EXPERT,                       { &stdin_interaction },
@@ -3515,6 +3520,8 @@ const OptionDef options[] = {
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_threads", HAS_ARG | OPT_INT,                   { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
+    { "enc_thread_queue_size", HAS_ARG | OPT_INT | OPT_EXPERT,        { &enc_thread_queue_size },
+        "encode each output stream in its own thread, queueing at most this many frames (0 to disable)", "size" },
     { "lavfi",          HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_script", HAS_ARG | OPT_EXPERT,                 { .func_arg = opt_filter_complex_script },
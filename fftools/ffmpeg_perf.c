@@ -0,0 +1,387 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Per-stage profiling of the transcoding pipeline.
+ *
+ * Every stage (demuxing an input file, decoding an input stream, running a
+ * filtergraph, encoding and muxing an output stream) accumulates its wall
+ * clock and thread CPU time. At the end of the run a JSON report is written
+ * and/or every timed call is recorded as a Chrome trace event. The report
+ * breaks the filtergraphs down per filter using the libavfilter statistics.
+ */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ffmpeg.h"
+
+#include "libavutil/time.h"
+
+char *perf_report_filename;
+char *perf_trace_filename;
+int   do_perf;
+
+static FILE   *trace_file;
+static int     trace_nb_events;
+static int     perf_nb_lanes;
+static int64_t perf_start_time;
+
+#if HAVE_THREADS
+static pthread_mutex_t trace_mutex;
+#endif
+
+static int64_t thread_cpu_time(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return -1;
+}
+
+/* write a JSON string literal, escaping what needs to be escaped */
+static void print_json_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; s && *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void trace_begin_event(void)
+{
+    fputs(trace_nb_events++ ? ",\n" : "[\n", trace_file);
+}
+
+static void perf_init_stage(PerfStage *s, const char *kind, const char *fmt, ...)
+{
+    char id[32];
+    va_list va;
+
+    memset(s, 0, sizeof(*s));
+    va_start(va, fmt);
+    vsnprintf(id, sizeof(id), fmt, va);
+    va_end(va);
+    snprintf(s->name, sizeof(s->name), "%s %s", kind, id);
+    s->kind = kind;
+    s->lane = perf_nb_lanes++;
+    s->cpu  = thread_cpu_time() < 0 ? -1 : 0;
+
+    if (trace_file) {
+        trace_begin_event();
+        fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"name\":", s->lane);
+        print_json_str(trace_file, s->name);
+        fputs("}}", trace_file);
+        trace_begin_event();
+        fprintf(trace_file, "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                "\"args\":{\"sort_index\":%d}}", s->lane, s->lane);
+    }
+}
+
+int perf_init(void)
+{
+    int i, j;
+
+    if (!perf_report_filename && !perf_trace_filename)
+        return 0;
+
+    if (perf_trace_filename) {
+        trace_file = fopen(perf_trace_filename, "w");
+        if (!trace_file) {
+            int ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_ERROR, "Could not open trace file %s: %s\n",
+                   perf_trace_filename, av_err2str(ret));
+            return ret;
+        }
+#if HAVE_THREADS
+        pthread_mutex_init(&trace_mutex, NULL);
+#endif
+    }
+
+    perf_start_time = av_gettime_relative();
+
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+        perf_init_stage(&f->perf_demux, "demux", "#%d", i);
+        for (j = 0; j < f->nb_streams; j++) {
+            InputStream *ist = input_streams[f->ist_index + j];
+            perf_init_stage(&ist->perf_decode, "decode", "#%d:%d", i, ist->st->index);
+        }
+    }
+    for (i = 0; i < nb_filtergraphs; i++)
+        perf_init_stage(&filtergraphs[i]->perf_filter, "filter", "#%d", i);
+    for (i = 0; i < nb_output_streams; i++) {
+        OutputStream *ost = output_streams[i];
+        perf_init_stage(&ost->perf_encode, "encode", "#%d:%d", ost->file_index, ost->index);
+        perf_init_stage(&ost->perf_mux,    "mux",    "#%d:%d", ost->file_index, ost->index);
+    }
+
+    do_perf = 1;
+    return 0;
+}
+
+void perf_start(PerfTimer *t)
+{
+    if (!do_perf)
+        return;
+    t->wall = av_gettime_relative();
+    t->cpu  = thread_cpu_time();
+}
+
+void perf_stop(PerfStage *s, const PerfTimer *t)
+{
+    int64_t wall, cpu;
+
+    if (!do_perf)
+        return;
+
+    wall = av_gettime_relative() - t->wall;
+    cpu  = thread_cpu_time() - t->cpu;
+
+    s->nb_calls++;
+    s->wall    += wall;
+    s->max_wall = FFMAX(s->max_wall, wall);
+    if (s->cpu >= 0)
+        s->cpu += cpu;
+
+    if (trace_file) {
+#if HAVE_THREADS
+        pthread_mutex_lock(&trace_mutex);
+#endif
+        trace_begin_event();
+        fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                "\"ts\":%"PRId64",\"dur\":%"PRId64"}",
+                s->kind, s->lane, t->wall - perf_start_time, wall);
+#if HAVE_THREADS
+        pthread_mutex_unlock(&trace_mutex);
+#endif
+    }
+}
+
+void perf_sample_queue(PerfQueue *q, int depth)
+{
+    if (!do_perf)
+        return;
+    q->nb_samples++;
+    q->sum += depth;
+    q->max  = FFMAX(q->max, depth);
+}
+
+void perf_frame_in(PerfLatency *l, int64_t pts, int64_t origin)
+{
+    if (!do_perf || !origin || pts == AV_NOPTS_VALUE)
+        return;
+    l->pending[l->pending_pos].pts    = pts;
+    l->pending[l->pending_pos].origin = origin;
+    l->pending_pos = (l->pending_pos + 1) % FF_ARRAY_ELEMS(l->pending);
+}
+
+int64_t perf_frame_origin(PerfLatency *l, int64_t pts)
+{
+    int64_t best_pts = INT64_MIN, origin = 0;
+    int i;
+
+    if (!do_perf || pts == AV_NOPTS_VALUE)
+        return 0;
+
+    /* an encoder may shift the timestamps a little (e.g. by its initial
+     * padding), so fall back to the closest earlier frame */
+    for (i = 0; i < FF_ARRAY_ELEMS(l->pending); i++) {
+        if (!l->pending[i].origin || l->pending[i].pts > pts ||
+            l->pending[i].pts <= best_pts)
+            continue;
+        best_pts = l->pending[i].pts;
+        origin   = l->pending[i].origin;
+    }
+    return origin;
+}
+
+void perf_frame_out(PerfLatency *l, int64_t origin)
+{
+    int64_t latency;
+
+    if (!do_perf || !origin)
+        return;
+
+    latency = av_gettime_relative() - origin;
+    l->min = l->nb_frames ? FFMIN(l->min, latency) : latency;
+    l->max = FFMAX(l->max, latency);
+    l->sum += latency;
+    l->nb_frames++;
+}
+
+static void print_stage(FILE *f, const char *key, const PerfStage *s)
+{
+    fprintf(f, "\"%s\": { \"calls\": %"PRId64", \"wall_us\": %"PRId64", "
+            "\"max_wall_us\": %"PRId64, key, s->nb_calls, s->wall, s->max_wall);
+    if (s->cpu >= 0)
+        fprintf(f, ", \"cpu_us\": %"PRId64, s->cpu);
+    fputs(" }", f);
+}
+
+static void print_queue(FILE *f, const char *key, const PerfQueue *q)
+{
+    fprintf(f, "\"%s\": { \"samples\": %"PRId64", \"avg\": %.2f, \"max\": %d }",
+            key, q->nb_samples, q->nb_samples ? (double)q->sum / q->nb_samples : 0.0, q->max);
+}
+
+static void print_codec(FILE *f, AVCodecParameters *par)
+{
+    fputs("\"type\": ", f);
+    print_json_str(f, av_get_media_type_string(par->codec_type));
+    fputs(", \"codec\": ", f);
+    print_json_str(f, avcodec_get_name(par->codec_id));
+}
+
+int perf_write_report(void)
+{
+    FILE *f;
+    int i, j;
+
+    if (!do_perf || !perf_report_filename)
+        return 0;
+
+    f = fopen(perf_report_filename, "w");
+    if (!f) {
+        int ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not open report file %s: %s\n",
+               perf_report_filename, av_err2str(ret));
+        return ret;
+    }
+
+    fprintf(f, "{\n  \"duration_us\": %"PRId64",\n  \"inputs\": [",
+            av_gettime_relative() - perf_start_time);
+    for (i = 0; i < nb_input_files; i++) {
+        InputFile *ifile = input_files[i];
+
+        fprintf(f, "%s\n    { \"index\": %d, \"url\": ", i ? "," : "", i);
+        print_json_str(f, ifile->ctx->url);
+        fputs(",\n      ", f);
+        print_stage(f, "demux", &ifile->perf_demux);
+        fputs(",\n      ", f);
+        print_queue(f, "queue", &ifile->perf_queue);
+        fputs(",\n      \"streams\": [", f);
+        for (j = 0; j < ifile->nb_streams; j++) {
+            InputStream *ist = input_streams[ifile->ist_index + j];
+
+            fprintf(f, "%s\n        { \"index\": %d, ", j ? "," : "", ist->st->index);
+            print_codec(f, ist->st->codecpar);
+            fprintf(f, ", \"packets\": %"PRIu64", \"bytes\": %"PRIu64", \"frames_decoded\": %"PRIu64",\n          ",
+                    ist->nb_packets, ist->data_size, ist->frames_decoded);
+            print_stage(f, "decode", &ist->perf_decode);
+            fputs(" }", f);
+        }
+        fputs("\n      ]\n    }", f);
+    }
+
+    fputs("\n  ],\n  \"filtergraphs\": [", f);
+    for (i = 0; i < nb_filtergraphs; i++) {
+        FilterGraph *fg = filtergraphs[i];
+
+        fprintf(f, "%s\n    { \"index\": %d, \"simple\": %s,\n      ", i ? "," : "", i,
+                filtergraph_is_simple(fg) ? "true" : "false");
+        print_stage(f, "filter", &fg->perf_filter);
+        fputs(",\n      \"filters\": [", f);
+        for (j = 0; fg->graph && j < fg->graph->nb_filters; j++) {
+            AVFilterContext *filter = fg->graph->filters[j];
+            AVFilterStats stats;
+
+            avfilter_get_stats(filter, &stats);
+            fprintf(f, "%s\n        { \"name\": ", j ? "," : "");
+            print_json_str(f, filter->name);
+            fputs(", \"filter\": ", f);
+            print_json_str(f, filter->filter->name);
+            fprintf(f, ", \"activations\": %"PRId64", \"wall_us\": %"PRId64", \"max_wall_us\": %"PRId64",\n"
+                    "          \"frames_in\": %"PRId64", \"frames_out\": %"PRId64", "
+                    "\"queued_frames\": %"PRId64", \"max_queued_frames\": %"PRId64" }",
+                    stats.nb_activations, stats.time, stats.max_time,
+                    stats.frames_in, stats.frames_out,
+                    stats.queued_frames, stats.max_queued_frames);
+        }
+        fputs("\n      ] }", f);
+    }
+
+    fputs("\n  ],\n  \"outputs\": [", f);
+    for (i = 0; i < nb_output_files; i++) {
+        OutputFile *of = output_files[i];
+
+        fprintf(f, "%s\n    { \"index\": %d, \"url\": ", i ? "," : "", i);
+        print_json_str(f, of->ctx->url);
+        fputs(",\n      \"streams\": [", f);
+        for (j = 0; j < of->ctx->nb_streams; j++) {
+            OutputStream *ost = output_streams[of->ost_index + j];
+            const PerfLatency *l = &ost->perf_latency;
+
+            fprintf(f, "%s\n        { \"index\": %d, ", j ? "," : "", ost->index);
+            print_codec(f, ost->st->codecpar);
+            fprintf(f, ", \"frames_encoded\": %"PRIu64", \"packets\": %"PRIu64", \"bytes\": %"PRIu64",\n          ",
+                    ost->frames_encoded, ost->packets_written, ost->data_size);
+            print_stage(f, "encode", &ost->perf_encode);
+            fputs(",\n          ", f);
+            print_stage(f, "mux", &ost->perf_mux);
+            fputs(",\n          ", f);
+            print_queue(f, "encoder_queue", &ost->perf_enc_queue);
+            fprintf(f, ",\n          \"latency\": { \"frames\": %"PRId64", \"avg_us\": %"PRId64", "
+                    "\"min_us\": %"PRId64", \"max_us\": %"PRId64" } }",
+                    l->nb_frames, l->nb_frames ? l->sum / l->nb_frames : 0, l->min, l->max);
+        }
+        fputs("\n      ]\n    }", f);
+    }
+    fputs("\n  ]\n}\n", f);
+
+    if (fclose(f)) {
+        int ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Error closing report file %s: %s\n",
+               perf_report_filename, av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+void perf_uninit(void)
+{
+    do_perf = 0;
+    if (trace_file) {
+        fputs(trace_nb_events ? "\n]\n" : "[]\n", trace_file);
+        if (fclose(trace_file))
+            av_log(NULL, AV_LOG_ERROR,
+                   "Error closing trace file, loss of information possible: %s\n",
+                   av_err2str(AVERROR(errno)));
+        trace_file = NULL;
+#if HAVE_THREADS
+        pthread_mutex_destroy(&trace_mutex);
+#endif
+    }
+    av_freep(&perf_report_filename);
+    av_freep(&perf_trace_filename);
+}
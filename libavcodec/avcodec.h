@@ -1407,6 +1407,14 @@ enum AVPacketSideDataType {
      */
     AV_PKT_DATA_AFD,
 
+    /**
+     * Wallclock time at which the data completing the packet was received,
+     * as a 64-bit little-endian integer in microseconds since the Unix epoch.
+     * Exported by demuxers reading from network protocols providing it, e.g.
+     * for jitter analysis.
+     */
+    AV_PKT_DATA_ARRIVAL_TIME,
+
     /**
      * The number of side data types.
      * This is not part of the public API/ABI in the sense that it may
@@ -2837,6 +2845,12 @@ typedef struct AVCodecContext {
     int thread_type;
 #define FF_THREAD_FRAME   1 ///< Decode more than one frame at once
 #define FF_THREAD_SLICE   2 ///< Decode more than one part of a single frame at once
+/**
+ * Encode more than one closed GOP at once, each on its own encoder instance.
+ * Only used by encoders that are not intra-only, and only when
+ * AV_CODEC_FLAG_CLOSED_GOP is set and gop_size is larger than 1.
+ */
+#define FF_THREAD_GOP     4
 
     /**
      * Which multithreading methods are in use by the codec.
@@ -27,6 +27,7 @@
 #include "libavutil/imgutils.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
+#include "libavutil/timecode.h"
 #include "avcodec.h"
 #include "internal.h"
 #include "thread.h"
@@ -41,6 +42,20 @@ typedef struct{
     unsigned index;
 } Task;
 
+/**
+ * A closed GOP encoded by its own encoder instance in FF_THREAD_GOP mode.
+ */
+typedef struct GOPTask {
+    AVFrame **frames;
+    int nb_frames;
+    int64_t first_frame;    ///< index of the first frame in the stream
+    AVFifoBuffer *packets;  ///< AVPacket pointers, filled by the worker
+    int nb_returned;
+    int done;
+    int return_code;
+    struct GOPTask *next;
+} GOPTask;
+
 typedef struct{
     AVCodecContext *parent_avctx;
     pthread_mutex_t buffer_mutex;
@@ -58,6 +73,18 @@ typedef struct{
 
     pthread_t worker[MAX_THREADS];
     atomic_int exit;
+
+    /* FF_THREAD_GOP mode */
+    int gop_mode;
+    AVCodecContext *template_avctx; ///< unopened copy of the parent the GOP contexts are made from
+    AVDictionary *options;
+    GOPTask *gop_filling;           ///< GOP being filled by the caller
+    GOPTask *gop_head, *gop_tail;   ///< submitted GOPs, in output order
+    int nb_gops;                    ///< number of submitted GOPs
+    int64_t nb_frames_in;
+    int64_t dts_delta;              ///< pts - dts of the first packet of a GOP
+    AVTimecode tc;
+    int has_tc;
 } ThreadContext;
 
 static void * attribute_align_arg worker(void *v){
@@ -114,13 +141,295 @@ end:
     return NULL;
 }
 
+/**
+ * Free a context made by copy_thread_context() that was never opened.
+ */
+static void free_thread_context(AVCodecContext **pavctx)
+{
+    AVCodecContext *avctx = *pavctx;
+
+    if (!avctx)
+        return;
+
+    if (avctx->codec->priv_class)
+        av_opt_free(avctx->priv_data);
+    av_freep(&avctx->priv_data);
+    av_buffer_unref(&avctx->hw_frames_ctx);
+    av_buffer_unref(&avctx->hw_device_ctx);
+    av_opt_free(avctx);
+    av_freep(pavctx);
+}
+
+/**
+ * Allocate an unopened single threaded copy of avctx.
+ */
+static int copy_thread_context(const AVCodecContext *avctx,
+                               AVCodecContext **pthread_avctx)
+{
+    int ret;
+    void *tmpv;
+    AVCodecContext *thread_avctx = avcodec_alloc_context3(avctx->codec);
+    if(!thread_avctx)
+        return AVERROR(ENOMEM);
+    tmpv = thread_avctx->priv_data;
+    *thread_avctx = *avctx;
+    thread_avctx->priv_data = tmpv;
+    thread_avctx->internal = NULL;
+    /* the parent may already be open, do not share what the encoder
+     * allocates and avcodec_close() frees */
+    thread_avctx->extradata           = NULL;
+    thread_avctx->extradata_size      = 0;
+    thread_avctx->coded_side_data     = NULL;
+    thread_avctx->nb_coded_side_data  = 0;
+    thread_avctx->stats_out           = NULL;
+#if FF_API_CODED_FRAME
+FF_DISABLE_DEPRECATION_WARNINGS
+    thread_avctx->coded_frame         = NULL;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+    thread_avctx->hw_frames_ctx       = NULL;
+    thread_avctx->hw_device_ctx       = NULL;
+
+    /* av_opt_copy() duplicates or clears every option even on failure, so
+     * from here on the context can be released with free_thread_context() */
+    ret = av_opt_copy(thread_avctx, avctx);
+    if (ret < 0)
+        goto fail;
+    if (avctx->hw_frames_ctx &&
+        !(thread_avctx->hw_frames_ctx = av_buffer_ref(avctx->hw_frames_ctx))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (avctx->hw_device_ctx &&
+        !(thread_avctx->hw_device_ctx = av_buffer_ref(avctx->hw_device_ctx))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (avctx->codec->priv_class) {
+        ret = av_opt_copy(thread_avctx->priv_data, avctx->priv_data);
+        if (ret < 0)
+            goto fail;
+    } else if (avctx->codec->priv_data_size) {
+        memcpy(thread_avctx->priv_data, avctx->priv_data, avctx->codec->priv_data_size);
+    }
+    thread_avctx->thread_count = 1;
+    thread_avctx->active_thread_type &= ~FF_THREAD_FRAME;
+
+    *pthread_avctx = thread_avctx;
+    return 0;
+fail:
+    free_thread_context(&thread_avctx);
+    return ret;
+}
+
+/**
+ * Allocate and open a single threaded copy of avctx.
+ */
+static int open_thread_context(const AVCodecContext *avctx, AVDictionary *options,
+                               AVCodecContext **pthread_avctx)
+{
+    AVCodecContext *thread_avctx;
+    AVDictionary *tmp = NULL;
+    int ret;
+
+    ret = copy_thread_context(avctx, &thread_avctx);
+    if (ret < 0)
+        return ret;
+
+    av_dict_copy(&tmp, options, 0);
+    av_dict_set(&tmp, "threads", "1", 0);
+    ret = avcodec_open2(thread_avctx, avctx->codec, &tmp);
+    av_dict_free(&tmp);
+    if (ret < 0) {
+        /* avcodec_open2() freed the options and the private context */
+        av_freep(&thread_avctx->extradata);
+        av_buffer_unref(&thread_avctx->hw_frames_ctx);
+        av_buffer_unref(&thread_avctx->hw_device_ctx);
+        av_freep(&thread_avctx);
+        return ret;
+    }
+
+    *pthread_avctx = thread_avctx;
+    return 0;
+}
+
+/**
+ * Close a context opened by open_thread_context() for a single GOP.
+ */
+static void close_gop_context(ThreadContext *c, AVCodecContext **pavctx)
+{
+    if (!*pavctx)
+        return;
+
+    pthread_mutex_lock(&c->buffer_mutex);
+    avcodec_close(*pavctx);
+    pthread_mutex_unlock(&c->buffer_mutex);
+    av_buffer_unref(&(*pavctx)->hw_device_ctx);
+    av_freep(pavctx);
+}
+
+/**
+ * The GOP time code of the encoders, if any, would restart from its
+ * initial value for every GOP; remember it so that each encoder instance
+ * can be started at the time code of its first frame.
+ */
+static void init_gop_timecode(ThreadContext *c, AVCodecContext *avctx)
+{
+    AVRational rate = avctx->framerate.num ? avctx->framerate : av_inv_q(avctx->time_base);
+    uint8_t *str = NULL;
+    int64_t drop = 0;
+    int ret;
+
+    if (!avctx->priv_data ||
+        !av_opt_find(avctx->priv_data, "gop_timecode", NULL, 0, 0))
+        return;
+
+    av_opt_get(avctx->priv_data, "gop_timecode", AV_OPT_ALLOW_NULL, &str);
+    if (str) {
+        ret = av_timecode_init_from_string(&c->tc, rate, str, avctx);
+    } else {
+        av_opt_get_int(avctx->priv_data, "drop_frame_timecode", 0, &drop);
+        ret = av_timecode_init(&c->tc, rate, drop ? AV_TIMECODE_FLAG_DROPFRAME : 0, 0, avctx);
+    }
+    av_free(str);
+    c->has_tc = ret >= 0;
+}
+
+static void gop_task_free(GOPTask **pgop)
+{
+    GOPTask *gop = *pgop;
+    int i;
+
+    if (!gop)
+        return;
+
+    for (i = 0; i < gop->nb_frames; i++)
+        av_frame_free(&gop->frames[i]);
+    av_freep(&gop->frames);
+    if (gop->packets) {
+        while (av_fifo_size(gop->packets) > 0) {
+            AVPacket *pkt;
+            av_fifo_generic_read(gop->packets, &pkt, sizeof(pkt), NULL);
+            av_packet_free(&pkt);
+        }
+        av_fifo_freep(&gop->packets);
+    }
+    av_freep(pgop);
+}
+
+static int encode_gop(ThreadContext *c, GOPTask *gop)
+{
+    AVCodecContext *avctx = NULL;
+    AVDictionary *options = NULL;
+    AVPacket *pkt = NULL;
+    int ret, i, got_packet;
+
+    ret = av_dict_copy(&options, c->options, 0);
+    if (ret < 0)
+        goto end;
+    if (c->has_tc) {
+        char buf[AV_TIMECODE_STR_SIZE];
+        av_timecode_make_string(&c->tc, buf, gop->first_frame);
+        av_dict_set(&options, "gop_timecode", buf, 0);
+    }
+
+    /* the parent is in use by the caller, only the template is safe to
+     * copy from concurrently */
+    ret = open_thread_context(c->template_avctx, options, &avctx);
+    if (ret < 0)
+        goto end;
+
+    for (i = 0; i <= gop->nb_frames; i++) {
+        AVFrame *frame = i < gop->nb_frames ? gop->frames[i] : NULL;
+
+        // a NULL frame flushes the delayed pictures, one per call
+        do {
+            if (!pkt && !(pkt = av_packet_alloc())) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            ret = avcodec_encode_video2(avctx, pkt, frame, &got_packet);
+            if (ret < 0)
+                goto end;
+            if (!got_packet)
+                break;
+            if ((ret = av_packet_make_refcounted(pkt)) < 0)
+                goto end;
+            if (av_fifo_space(gop->packets) < sizeof(pkt) &&
+                (ret = av_fifo_grow(gop->packets, av_fifo_size(gop->packets))) < 0)
+                goto end;
+            av_fifo_generic_write(gop->packets, &pkt, sizeof(pkt), NULL);
+            pkt = NULL;
+        } while (!frame);
+
+        if (frame) {
+            pthread_mutex_lock(&c->buffer_mutex);
+            av_frame_unref(frame);
+            pthread_mutex_unlock(&c->buffer_mutex);
+        }
+    }
+    ret = 0;
+
+end:
+    av_packet_free(&pkt);
+    av_dict_free(&options);
+    close_gop_context(c, &avctx);
+    return ret;
+}
+
+static void * attribute_align_arg gop_worker(void *v){
+    ThreadContext *c = v;
+
+    while (1) {
+        GOPTask *gop;
+        Task task;
+        int ret;
+
+        pthread_mutex_lock(&c->task_fifo_mutex);
+        while (av_fifo_size(c->task_fifo) <= 0 || atomic_load(&c->exit)) {
+            if (atomic_load(&c->exit)) {
+                pthread_mutex_unlock(&c->task_fifo_mutex);
+                return NULL;
+            }
+            pthread_cond_wait(&c->task_fifo_cond, &c->task_fifo_mutex);
+        }
+        av_fifo_generic_read(c->task_fifo, &task, sizeof(task), NULL);
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+        gop = task.indata;
+
+        ret = encode_gop(c, gop);
+
+        pthread_mutex_lock(&c->finished_task_mutex);
+        gop->return_code = ret;
+        gop->done        = 1;
+        pthread_cond_broadcast(&c->finished_task_cond);
+        pthread_mutex_unlock(&c->finished_task_mutex);
+    }
+}
+
 int ff_frame_thread_encoder_init(AVCodecContext *avctx, AVDictionary *options){
     int i=0;
     ThreadContext *c;
-
-
-    if(   !(avctx->thread_type & FF_THREAD_FRAME)
-       || !(avctx->codec->capabilities & AV_CODEC_CAP_INTRA_ONLY))
+    int gop_mode = 0;
+
+    if (   (avctx->thread_type & FF_THREAD_GOP)
+        && avctx->codec_type == AVMEDIA_TYPE_VIDEO
+        && avctx->codec->encode2
+        && !(avctx->codec->capabilities & AV_CODEC_CAP_INTRA_ONLY)
+        && (avctx->flags & AV_CODEC_FLAG_CLOSED_GOP)
+        && avctx->gop_size > 1) {
+        if (avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2)) {
+            av_log(avctx, AV_LOG_WARNING,
+                   "GOP multi-threading does not support two pass encoding\n");
+            return 0;
+        }
+        if (!(avctx->flags & AV_CODEC_FLAG_QSCALE))
+            av_log(avctx, AV_LOG_WARNING,
+                   "Rate control is done independently for every GOP with GOP "
+                   "multi-threading, consider using a constant quantizer.\n");
+        gop_mode = 1;
+    } else if(   !(avctx->thread_type & FF_THREAD_FRAME)
+              || !(avctx->codec->capabilities & AV_CODEC_CAP_INTRA_ONLY))
         return 0;
 
     if(   !avctx->thread_count
@@ -179,6 +488,7 @@ int ff_frame_thread_encoder_init(AVCodecContext *avctx, AVDictionary *options){
         return AVERROR(ENOMEM);
 
     c->parent_avctx = avctx;
+    c->gop_mode     = gop_mode;
 
     c->task_fifo = av_fifo_alloc_array(BUFFER_SIZE, sizeof(Task));
     if(!c->task_fifo)
@@ -191,37 +501,26 @@ int ff_frame_thread_encoder_init(AVCodecContext *avctx, AVDictionary *options){
     pthread_cond_init(&c->finished_task_cond, NULL);
     atomic_init(&c->exit, 0);
 
-    for(i=0; i<avctx->thread_count ; i++){
-        AVDictionary *tmp = NULL;
-        int ret;
-        void *tmpv;
-        AVCodecContext *thread_avctx = avcodec_alloc_context3(avctx->codec);
-        if(!thread_avctx)
+    if (c->gop_mode) {
+        if (av_dict_copy(&c->options, options, 0) < 0)
             goto fail;
-        tmpv = thread_avctx->priv_data;
-        *thread_avctx = *avctx;
-        ret = av_opt_copy(thread_avctx, avctx);
-        if (ret < 0)
+        // the parent is not initialized yet, its private data only holds options
+        if (copy_thread_context(avctx, &c->template_avctx) < 0)
             goto fail;
-        thread_avctx->priv_data = tmpv;
-        thread_avctx->internal = NULL;
-        if (avctx->codec->priv_class) {
-            int ret = av_opt_copy(thread_avctx->priv_data, avctx->priv_data);
-            if (ret < 0)
+        init_gop_timecode(c, avctx);
+    }
+
+    for(i=0; i<avctx->thread_count ; i++){
+        AVCodecContext *thread_avctx;
+
+        if (c->gop_mode) {
+            if (pthread_create(&c->worker[i], NULL, gop_worker, c))
                 goto fail;
-        } else if (avctx->codec->priv_data_size) {
-            memcpy(thread_avctx->priv_data, avctx->priv_data, avctx->codec->priv_data_size);
+            continue;
         }
-        thread_avctx->thread_count = 1;
-        thread_avctx->active_thread_type &= ~FF_THREAD_FRAME;
 
-        av_dict_copy(&tmp, options, 0);
-        av_dict_set(&tmp, "threads", "1", 0);
-        if(avcodec_open2(thread_avctx, avctx->codec, &tmp) < 0) {
-            av_dict_free(&tmp);
+        if (open_thread_context(avctx, options, &thread_avctx) < 0)
             goto fail;
-        }
-        av_dict_free(&tmp);
         av_assert0(!thread_avctx->internal->frame_thread_encoder);
         thread_avctx->internal->frame_thread_encoder = c;
         if(pthread_create(&c->worker[i], NULL, worker, thread_avctx)) {
@@ -256,11 +555,23 @@ void ff_frame_thread_encoder_free(AVCodecContext *avctx){
         Task task;
         AVFrame *frame;
         av_fifo_generic_read(c->task_fifo, &task, sizeof(task), NULL);
-        frame = task.indata;
-        av_frame_free(&frame);
+        // GOP tasks are owned by the gop_head list
+        if (!c->gop_mode) {
+            frame = task.indata;
+            av_frame_free(&frame);
+        }
         task.indata = NULL;
     }
 
+    while (c->gop_head) {
+        GOPTask *next = c->gop_head->next;
+        gop_task_free(&c->gop_head);
+        c->gop_head = next;
+    }
+    gop_task_free(&c->gop_filling);
+    free_thread_context(&c->template_avctx);
+    av_dict_free(&c->options);
+
     for (i=0; i<BUFFER_SIZE; i++) {
         if (c->finished_tasks[i].outdata != NULL) {
             AVPacket *pkt = c->finished_tasks[i].outdata;
@@ -278,6 +589,120 @@ void ff_frame_thread_encoder_free(AVCodecContext *avctx){
     av_freep(&avctx->internal->frame_thread_encoder);
 }
 
+static int submit_gop(ThreadContext *c)
+{
+    GOPTask *gop = c->gop_filling;
+    Task task = { .indata = gop };
+
+    c->gop_filling = NULL;
+
+    pthread_mutex_lock(&c->finished_task_mutex);
+    if (c->gop_tail)
+        c->gop_tail->next = gop;
+    else
+        c->gop_head = gop;
+    c->gop_tail = gop;
+    c->nb_gops++;
+    pthread_mutex_unlock(&c->finished_task_mutex);
+
+    pthread_mutex_lock(&c->task_fifo_mutex);
+    av_fifo_generic_write(c->task_fifo, &task, sizeof(task), NULL);
+    pthread_cond_signal(&c->task_fifo_cond);
+    pthread_mutex_unlock(&c->task_fifo_mutex);
+
+    return 0;
+}
+
+static int gop_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *frame, int *got_packet_ptr)
+{
+    ThreadContext *c = avctx->internal->frame_thread_encoder;
+    GOPTask *gop;
+    int ret;
+
+    if (frame) {
+        AVFrame *new;
+
+        // start a new GOP at forced key frames and every gop_size frames
+        if (c->gop_filling && frame->pict_type == AV_PICTURE_TYPE_I)
+            submit_gop(c);
+
+        if (!c->gop_filling) {
+            gop = av_mallocz(sizeof(*gop));
+            if (!gop)
+                return AVERROR(ENOMEM);
+            gop->frames  = av_malloc_array(avctx->gop_size, sizeof(*gop->frames));
+            gop->packets = av_fifo_alloc(avctx->gop_size * sizeof(AVPacket*));
+            if (!gop->frames || !gop->packets) {
+                gop_task_free(&gop);
+                return AVERROR(ENOMEM);
+            }
+            gop->first_frame = c->nb_frames_in;
+            c->gop_filling   = gop;
+        }
+
+        new = av_frame_alloc();
+        if(!new)
+            return AVERROR(ENOMEM);
+        ret = av_frame_ref(new, frame);
+        if(ret < 0) {
+            av_frame_free(&new);
+            return ret;
+        }
+        c->gop_filling->frames[c->gop_filling->nb_frames++] = new;
+        c->nb_frames_in++;
+
+        if (c->gop_filling->nb_frames == avctx->gop_size)
+            submit_gop(c);
+    } else if (c->gop_filling) {
+        submit_gop(c);
+    }
+
+    pthread_mutex_lock(&c->finished_task_mutex);
+    while ((gop = c->gop_head)) {
+        if (!gop->done) {
+            // keep up to thread_count GOPs in flight while input is coming
+            if (frame && c->nb_gops <= avctx->thread_count)
+                break;
+            pthread_cond_wait(&c->finished_task_cond, &c->finished_task_mutex);
+            continue;
+        }
+        if (gop->return_code < 0 || av_fifo_size(gop->packets) <= 0) {
+            ret = gop->return_code;
+            c->gop_head = gop->next;
+            if (!c->gop_head)
+                c->gop_tail = NULL;
+            c->nb_gops--;
+            gop_task_free(&gop);
+            if (ret < 0) {
+                pthread_mutex_unlock(&c->finished_task_mutex);
+                return ret;
+            }
+            continue;
+        }
+        {
+            AVPacket *out;
+            av_fifo_generic_read(gop->packets, &out, sizeof(out), NULL);
+            av_packet_move_ref(pkt, out);
+            av_packet_free(&out);
+            *got_packet_ptr = 1;
+
+            if (!gop->nb_returned++ &&
+                pkt->pts != AV_NOPTS_VALUE && pkt->dts != AV_NOPTS_VALUE) {
+                // an encoder fed with a single frame cannot know the
+                // reordering delay, use the one of the previous GOPs
+                if (pkt->pts > pkt->dts)
+                    c->dts_delta = pkt->pts - pkt->dts;
+                else if (gop->nb_frames == 1)
+                    pkt->dts = pkt->pts - c->dts_delta;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&c->finished_task_mutex);
+
+    return 0;
+}
+
 int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVFrame *frame, int *got_packet_ptr){
     ThreadContext *c = avctx->internal->frame_thread_encoder;
     Task task;
@@ -285,6 +710,9 @@ int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt, const AVF
 
     av_assert1(!*got_packet_ptr);
 
+    if (c->gop_mode)
+        return gop_encode_frame(avctx, pkt, frame, got_packet_ptr);
+
     if(frame){
         AVFrame *new = av_frame_alloc();
         if(!new)
@@ -3490,9 +3490,15 @@ static av_cold int hevc_decode_init(AVCodecContext *avctx)
 
     atomic_init(&s->wpp_err, 0);
 
-    if(avctx->active_thread_type & FF_THREAD_SLICE)
+    if(avctx->active_thread_type & FF_THREAD_SLICE) {
         s->threads_number = avctx->thread_count;
-    else
+        if (s->threads_number > MAX_NB_THREADS) {
+            av_log(avctx, AV_LOG_WARNING,
+                   "%d slice threads requested, WPP is limited to %d, disabling it\n",
+                   s->threads_number, MAX_NB_THREADS);
+            s->threads_number = 1;
+        }
+    } else
         s->threads_number = 1;
 
     if (avctx->extradata_size > 0 && avctx->extradata) {
@@ -61,10 +61,30 @@ static void validate_thread_parameters(AVCodecContext *avctx)
         avctx->active_thread_type = 0;
     }
 
-    if (avctx->thread_count > MAX_AUTO_THREADS)
+    if (avctx->thread_count > MAX_AUTO_THREADS_LARGE)
         av_log(avctx, AV_LOG_WARNING,
                "Application has requested %d threads. Using a thread count greater than %d is not recommended.\n",
-               avctx->thread_count, MAX_AUTO_THREADS);
+               avctx->thread_count, MAX_AUTO_THREADS_LARGE);
+}
+
+int ff_thread_auto_count(AVCodecContext *avctx, int nb_cpus, int type)
+{
+    int64_t pixels   = (int64_t)avctx->width * avctx->height;
+    int max_threads  = MAX_AUTO_THREADS;
+
+    /* H.264 slice threading misbehaves above MAX_AUTO_THREADS, and HEVC
+     * WPP keeps MAX_NB_THREADS (16) per-thread contexts */
+    if (pixels > 1920 * 1088 &&
+        !(type == FF_THREAD_SLICE && (avctx->codec_id == AV_CODEC_ID_H264 ||
+                                      avctx->codec_id == AV_CODEC_ID_HEVC))) {
+        int64_t batches = (pixels + 1920 * 1088 - 1) / (1920 * 1088);
+        max_threads = FFMIN(MAX_AUTO_THREADS * batches, MAX_AUTO_THREADS_LARGE);
+    }
+
+    // use number of cores + 1 as thread count if there is more than one
+    if (nb_cpus > 1)
+        return FFMIN(nb_cpus + 1, max_threads);
+    return 1;
 }
 
 int ff_thread_init(AVCodecContext *avctx)
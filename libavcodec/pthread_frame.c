@@ -734,11 +734,8 @@ int ff_frame_thread_init(AVCodecContext *avctx)
         if ((avctx->debug & (FF_DEBUG_VIS_QP | FF_DEBUG_VIS_MB_TYPE)) || avctx->debug_mv)
             nb_cpus = 1;
 #endif
-        // use number of cores + 1 as thread count if there is more than one
-        if (nb_cpus > 1)
-            thread_count = avctx->thread_count = FFMIN(nb_cpus + 1, MAX_AUTO_THREADS);
-        else
-            thread_count = avctx->thread_count = 1;
+        thread_count = avctx->thread_count =
+            ff_thread_auto_count(avctx, nb_cpus, FF_THREAD_FRAME);
     }
 
     if (thread_count <= 1) {
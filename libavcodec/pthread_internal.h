@@ -25,6 +25,24 @@
  * limit the number of threads to 16 for automatic detection */
 #define MAX_AUTO_THREADS 16
 
+/* Upper bound for automatic detection when the picture is large enough
+ * to keep more threads busy, see ff_thread_auto_count() */
+#define MAX_AUTO_THREADS_LARGE 64
+
+/**
+ * Compute the number of threads to use when the caller requested
+ * automatic detection (thread_count == 0).
+ *
+ * The limit grows with the picture size, one batch of MAX_AUTO_THREADS
+ * for each 1080p worth of pixels, up to MAX_AUTO_THREADS_LARGE. H.264 and
+ * HEVC slice threading stay limited to MAX_AUTO_THREADS.
+ *
+ * @param nb_cpus number of usable CPUs
+ * @param type    FF_THREAD_FRAME or FF_THREAD_SLICE
+ * @return the thread count, 1 if threading should not be used
+ */
+int ff_thread_auto_count(AVCodecContext *avctx, int nb_cpus, int type);
+
 int ff_slice_thread_init(AVCodecContext *avctx);
 void ff_slice_thread_free(AVCodecContext *avctx);
 
@@ -142,11 +142,8 @@ int ff_slice_thread_init(AVCodecContext *avctx)
         int nb_cpus = av_cpu_count();
         if  (avctx->height)
             nb_cpus = FFMIN(nb_cpus, (avctx->height+15)/16);
-        // use number of cores + 1 as thread count if there is more than one
-        if (nb_cpus > 1)
-            thread_count = avctx->thread_count = FFMIN(nb_cpus + 1, MAX_AUTO_THREADS);
-        else
-            thread_count = avctx->thread_count = 1;
+        thread_count = avctx->thread_count =
+            ff_thread_auto_count(avctx, nb_cpus, FF_THREAD_SLICE);
     }
 
     if (thread_count <= 1) {
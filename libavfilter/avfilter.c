@@ -33,6 +33,7 @@
 #include "libavutil/rational.h"
 #include "libavutil/samplefmt.h"
 #include "libavutil/thread.h"
+#include "libavutil/time.h"
 
 #define FF_INTERNAL_FIELDS 1
 #include "framequeue.h"
@@ -1120,6 +1121,7 @@ int ff_filter_frame(AVFilterLink *link, AVFrame *frame)
         av_frame_free(&frame);
         return ret;
     }
+    link->max_queued = FFMAX(link->max_queued, ff_framequeue_queued_frames(&link->fifo));
     ff_filter_set_ready(link->dst, 300);
     return 0;
 
@@ -1420,19 +1422,47 @@ static int ff_filter_activate_default(AVFilterContext *filter)
 
 int ff_filter_activate(AVFilterContext *filter)
 {
+    AVFilterInternal *internal = filter->internal;
+    int64_t start = 0;
     int ret;
 
     /* Generic timeline support is not yet implemented but should be easy */
     av_assert1(!(filter->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC &&
                  filter->filter->activate));
     filter->ready = 0;
+    if (filter->graph->collect_stats)
+        start = av_gettime_relative();
     ret = filter->filter->activate ? filter->filter->activate(filter) :
           ff_filter_activate_default(filter);
+    internal->nb_activations++;
+    if (start) {
+        int64_t time = av_gettime_relative() - start;
+        internal->time    += time;
+        internal->max_time = FFMAX(internal->max_time, time);
+    }
     if (ret == FFERROR_NOT_READY)
         ret = 0;
     return ret;
 }
 
+void avfilter_get_stats(AVFilterContext *filter, AVFilterStats *stats)
+{
+    unsigned i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->nb_activations = filter->internal->nb_activations;
+    stats->time           = filter->internal->time;
+    stats->max_time       = filter->internal->max_time;
+    for (i = 0; i < filter->nb_inputs; i++) {
+        AVFilterLink *link = filter->inputs[i];
+        stats->frames_in        += link->frame_count_out;
+        stats->queued_frames    += ff_framequeue_queued_frames(&link->fifo);
+        stats->max_queued_frames = FFMAX(stats->max_queued_frames, link->max_queued);
+    }
+    for (i = 0; i < filter->nb_outputs; i++)
+        stats->frames_out += filter->outputs[i]->frame_count_in;
+}
+
 int ff_inlink_acknowledge_status(AVFilterLink *link, int *rstatus, int64_t *rpts)
 {
     *rpts = link->current_pts;
@@ -642,6 +642,11 @@ struct AVFilterLink {
      */
     int status_out;
 
+    /**
+     * Largest number of frames that were queued in fifo at the same time.
+     */
+    size_t max_queued;
+
 #endif /* FF_INTERNAL_FIELDS */
 
 };
@@ -680,6 +685,55 @@ int avfilter_link_get_channels(AVFilterLink *link);
 attribute_deprecated
 void avfilter_link_set_closed(AVFilterLink *link, int closed);
 
+/**
+ * Processing statistics of a filter instance, as returned by
+ * avfilter_get_stats().
+ *
+ * sizeof(AVFilterStats) is not a part of the public ABI, new fields may be
+ * added to the end with a minor version bump.
+ */
+typedef struct AVFilterStats {
+    /**
+     * Number of times the filter was activated by the graph scheduler.
+     */
+    int64_t nb_activations;
+    /**
+     * Cumulative wall clock time spent in the filter, in microseconds,
+     * including the time spent in its slice threads.
+     * Only collected while AVFilterGraph.collect_stats is set.
+     */
+    int64_t time;
+    /**
+     * Longest single activation of the filter, in microseconds.
+     */
+    int64_t max_time;
+    /**
+     * Number of frames consumed from all the inputs.
+     */
+    int64_t frames_in;
+    /**
+     * Number of frames sent to all the outputs.
+     */
+    int64_t frames_out;
+    /**
+     * Number of frames currently waiting on all the inputs.
+     */
+    int64_t queued_frames;
+    /**
+     * Largest number of frames that were waiting on a single input at the
+     * same time.
+     */
+    int64_t max_queued_frames;
+} AVFilterStats;
+
+/**
+ * Retrieve processing statistics of a filter, e.g. to find out which filter
+ * of a graph is the bottleneck.
+ *
+ * @param stats structure to be filled with the current statistics
+ */
+void avfilter_get_stats(AVFilterContext *filter, AVFilterStats *stats);
+
 /**
  * Negotiate the media format, dimensions, etc of all inputs to a filter.
  *
@@ -896,6 +950,12 @@ typedef struct AVFilterGraph {
 
     char *aresample_swr_opts; ///< swr options to use for the auto-inserted aresample filters, Access ONLY through AVOptions
 
+    /**
+     * Measure the time spent in each filter, see avfilter_get_stats().
+     * May be set by the caller at any point.
+     */
+    int collect_stats;
+
     /**
      * Private fields
      *
@@ -1135,7 +1195,9 @@ int avfilter_graph_queue_command(AVFilterGraph *graph, const char *target, const
  * Dump a graph into a human-readable string representation.
  *
  * @param graph    the graph to dump
- * @param options  formatting options; currently ignored
+ * @param options  formatting options; if "stats", the processing statistics
+ *                 of every filter and the frames queued on its inputs are
+ *                 printed instead of the graph layout
  * @return  a string, or NULL in case of memory allocation failure;
  *          the string must be freed using av_free
  */
@@ -24,7 +24,12 @@
 #include "libavutil/channel_layout.h"
 #include "libavutil/bprint.h"
 #include "libavutil/pixdesc.h"
+
+#define FF_INTERNAL_FIELDS 1
+#include "framequeue.h"
+
 #include "avfilter.h"
+#include "filters.h"
 #include "internal.h"
 
 static int print_link_prop(AVBPrint *buf, AVFilterLink *link)
@@ -151,15 +156,43 @@ static void avfilter_graph_dump_to_buf(AVBPrint *buf, AVFilterGraph *graph)
     }
 }
 
+static void avfilter_graph_dump_stats_to_buf(AVBPrint *buf, AVFilterGraph *graph)
+{
+    unsigned i, j;
+
+    for (i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *filter = graph->filters[i];
+        AVFilterStats stats;
+
+        avfilter_get_stats(filter, &stats);
+        av_bprintf(buf, "%s (%s): activations:%"PRId64, filter->name,
+                   filter->filter->name, stats.nb_activations);
+        if (graph->collect_stats || stats.time)
+            av_bprintf(buf, " time:%"PRId64"us max:%"PRId64"us",
+                       stats.time, stats.max_time);
+        av_bprintf(buf, " frames_in:%"PRId64" frames_out:%"PRId64"\n",
+                   stats.frames_in, stats.frames_out);
+        for (j = 0; j < filter->nb_inputs; j++) {
+            AVFilterLink *l = filter->inputs[j];
+            av_bprintf(buf, "    %s:%s -> %s: queued:%"SIZE_SPECIFIER" max_queued:%"SIZE_SPECIFIER"\n",
+                       l->src->name, l->srcpad->name, l->dstpad->name,
+                       ff_inlink_queued_frames(l), l->max_queued);
+        }
+    }
+}
+
 char *avfilter_graph_dump(AVFilterGraph *graph, const char *options)
 {
+    void (*dump_to_buf)(AVBPrint *buf, AVFilterGraph *graph) =
+        options && !strcmp(options, "stats") ? avfilter_graph_dump_stats_to_buf :
+                                               avfilter_graph_dump_to_buf;
     AVBPrint buf;
     char *dump;
 
     av_bprint_init(&buf, 0, AV_BPRINT_SIZE_COUNT_ONLY);
-    avfilter_graph_dump_to_buf(&buf, graph);
+    dump_to_buf(&buf, graph);
     av_bprint_init(&buf, buf.len + 1, buf.len + 1);
-    avfilter_graph_dump_to_buf(&buf, graph);
+    dump_to_buf(&buf, graph);
     av_bprint_finalize(&buf, &dump);
     return dump;
 }
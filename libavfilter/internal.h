@@ -153,6 +153,11 @@ struct AVFilterGraphInternal {
 
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+
+    /* see AVFilterStats */
+    int64_t nb_activations;
+    int64_t time;
+    int64_t max_time;
 };
 
 /**
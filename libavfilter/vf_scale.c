@@ -317,6 +317,10 @@ static int config_props(AVFilterLink *outlink)
             if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
                 av_opt_set_int(*s, "dst_range",
                                scale->out_range == AVCOL_RANGE_JPEG, 0);
+            /* the field scalers are only used for interlaced material,
+             * keep them single-threaded */
+            if (!i)
+                av_opt_set_int(*s, "threads", ff_filter_get_nb_threads(ctx), 0);
 
             if (scale->opts) {
                 AVDictionaryEntry *e = NULL;
@@ -1618,6 +1618,9 @@ typedef struct AVFormatContext {
      * (mainly useful for AVFMT_NOFILE formats). The callback
      * should also be passed to avio_open2() if it's used to
      * open the file.
+     *
+     * Some (de)muxers, like hls with prefetching enabled, call it from their
+     * own threads too, so it should be thread-safe.
      */
     AVIOInterruptCB interrupt_callback;
 
@@ -1922,6 +1925,9 @@ typedef struct AVFormatContext {
      * additional internal format contexts. Thus the AVFormatContext pointer
      * passed to this callback may be different from the one facing the caller.
      * It will, however, have the same 'opaque' field.
+     *
+     * @note This callback is not used for the I/O done in background threads,
+     * like the segment prefetching of the hls demuxer.
      */
     int (*io_open)(struct AVFormatContext *s, AVIOContext **pb, const char *url,
                    int flags, AVDictionary **options);
@@ -1951,6 +1957,24 @@ typedef struct AVFormatContext {
      * - decoding: set by user
      */
     int skip_estimate_duration_from_pts;
+
+    /**
+     * Directory of the persistent cache of the stream parameters found by
+     * avformat_find_stream_info(). When set, the analysis of an input that
+     * was already analyzed is skipped.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    char *probe_cache;
+
+    /**
+     * Number of threads used by avformat_find_stream_info() to decode the
+     * streams while the input is being read. 1 decodes on the calling
+     * thread, 0 picks a number automatically.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    int probe_threads;
 } AVFormatContext;
 
 #if FF_API_FORMAT_GET_SET
@@ -67,6 +67,13 @@ typedef struct Segment {
     int n;
 } Segment;
 
+/* A SegmentTimeline S element: repeat + 1 contiguous segments of equal duration */
+typedef struct SegmentRun {
+    int64_t time;
+    int64_t duration;
+    int repeat;
+} SegmentRun;
+
 typedef struct AdaptationSet {
     char id[10];
     char *descriptor;
@@ -74,6 +81,12 @@ typedef struct AdaptationSet {
     AVDictionary *metadata;
     AVRational min_frame_rate, max_frame_rate;
     int ambiguous_frame_rate;
+
+    /* serialized AdaptationSet, reused while none of its representations change */
+    uint8_t *manifest_cache;
+    int manifest_cache_size;
+    int manifest_cache_final;
+    int64_t manifest_cache_duration;
 } AdaptationSet;
 
 typedef struct OutputStream {
@@ -86,6 +99,9 @@ typedef struct OutputStream {
     int init_range_length;
     int nb_segments, segments_size, segment_index;
     Segment **segments;
+    SegmentRun *runs; /* timeline of the segments listed in the manifest */
+    int nb_runs, runs_size, nb_run_segments;
+    int manifest_updated;
     int64_t first_pts, start_pts, max_pts;
     int64_t last_dts, last_pts;
     int bit_rate;
@@ -572,6 +588,7 @@ static void dash_free(AVFormatContext *s)
         for (i = 0; i < c->nb_as; i++) {
             av_dict_free(&c->as[i].metadata);
             av_freep(&c->as[i].descriptor);
+            av_freep(&c->as[i].manifest_cache);
         }
         av_freep(&c->as);
         c->nb_as = 0;
@@ -593,6 +610,7 @@ static void dash_free(AVFormatContext *s)
         for (j = 0; j < os->nb_segments; j++)
             av_free(os->segments[j]);
         av_free(os->segments);
+        av_freep(&os->runs);
         av_freep(&os->single_file_name);
         av_freep(&os->init_seg_name);
         av_freep(&os->media_seg_name);
@@ -623,24 +641,16 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         if (c->use_timeline) {
             int64_t cur_time = 0;
             avio_printf(out, "\t\t\t\t\t<SegmentTimeline>\n");
-            for (i = start_index; i < os->nb_segments; ) {
-                Segment *seg = os->segments[i];
-                int repeat = 0;
+            for (i = 0; i < os->nb_runs; i++) {
+                SegmentRun *run = &os->runs[i];
                 avio_printf(out, "\t\t\t\t\t\t<S ");
-                if (i == start_index || seg->time != cur_time) {
-                    cur_time = seg->time;
-                    avio_printf(out, "t=\"%"PRId64"\" ", seg->time);
-                }
-                avio_printf(out, "d=\"%"PRId64"\" ", seg->duration);
-                while (i + repeat + 1 < os->nb_segments &&
-                       os->segments[i + repeat + 1]->duration == seg->duration &&
-                       os->segments[i + repeat + 1]->time == os->segments[i + repeat]->time + os->segments[i + repeat]->duration)
-                    repeat++;
-                if (repeat > 0)
-                    avio_printf(out, "r=\"%d\" ", repeat);
+                if (i == 0 || run->time != cur_time)
+                    avio_printf(out, "t=\"%"PRId64"\" ", run->time);
+                avio_printf(out, "d=\"%"PRId64"\" ", run->duration);
+                if (run->repeat > 0)
+                    avio_printf(out, "r=\"%d\" ", run->repeat);
                 avio_printf(out, "/>\n");
-                i += 1 + repeat;
-                cur_time += (1 + repeat) * seg->duration;
+                cur_time = run->time + (1 + run->repeat) * run->duration;
             }
             avio_printf(out, "\t\t\t\t\t</SegmentTimeline>\n");
         }
@@ -747,13 +757,27 @@ static void format_date_now(char *buf, int size)
     }
 }
 
-static int write_adaptation_set(AVFormatContext *s, AVIOContext *out, int as_index,
+static int write_adaptation_set(AVFormatContext *s, AVIOContext *mpd, int as_index,
                                 int final)
 {
     DASHContext *c = s->priv_data;
     AdaptationSet *as = &c->as[as_index];
     AVDictionaryEntry *lang, *role;
-    int i;
+    AVIOContext *out;
+    int i, ret, updated = 0;
+
+    for (i = 0; i < s->nb_streams; i++)
+        if (c->streams[i].as_idx - 1 == as_index && c->streams[i].manifest_updated)
+            updated = 1;
+
+    if (as->manifest_cache && !updated && as->manifest_cache_final == final &&
+        as->manifest_cache_duration == c->last_duration) {
+        avio_write(mpd, as->manifest_cache, as->manifest_cache_size);
+        return 0;
+    }
+
+    if ((ret = avio_open_dyn_buf(&out)) < 0)
+        return ret;
 
     avio_printf(out, "\t\t<AdaptationSet id=\"%s\" contentType=\"%s\" segmentAlignment=\"true\" bitstreamSwitching=\"true\"",
                 as->id, as->media_type == AVMEDIA_TYPE_VIDEO ? "video" : "audio");
@@ -795,9 +819,18 @@ static int write_adaptation_set(AVFormatContext *s, AVIOContext *out, int as_ind
         }
         output_segment_list(os, out, s, i, final);
         avio_printf(out, "\t\t\t</Representation>\n");
+        os->manifest_updated = 0;
     }
     avio_printf(out, "\t\t</AdaptationSet>\n");
 
+    av_freep(&as->manifest_cache);
+    as->manifest_cache_size     = avio_close_dyn_buf(out, &as->manifest_cache);
+    as->manifest_cache_final    = final;
+    as->manifest_cache_duration = c->last_duration;
+    if (!as->manifest_cache)
+        return AVERROR(ENOMEM);
+    avio_write(mpd, as->manifest_cache, as->manifest_cache_size);
+
     return 0;
 }
 
@@ -1396,7 +1429,53 @@ static int dash_write_header(AVFormatContext *s)
     return ret;
 }
 
-static int add_segment(OutputStream *os, const char *file,
+/*
+ * Keep the SegmentTimeline up to date incrementally, so that writing it
+ * costs one element per run of equal segments instead of one per segment.
+ */
+static int add_segment_run(DASHContext *c, OutputStream *os,
+                           int64_t time, int64_t duration)
+{
+    SegmentRun *run = os->nb_runs ? &os->runs[os->nb_runs - 1] : NULL;
+    int err;
+
+    if (run && run->duration == duration &&
+        run->time + (run->repeat + 1) * run->duration == time) {
+        run->repeat++;
+    } else {
+        if (os->nb_runs >= os->runs_size) {
+            os->runs_size = (os->runs_size + 1) * 2;
+            if ((err = av_reallocp_array(&os->runs, os->runs_size,
+                                         sizeof(*os->runs))) < 0) {
+                os->runs_size = 0;
+                os->nb_runs = os->nb_run_segments = 0;
+                return err;
+            }
+        }
+        run = &os->runs[os->nb_runs++];
+        run->time     = time;
+        run->duration = duration;
+        run->repeat   = 0;
+    }
+    os->nb_run_segments++;
+
+    /* drop the segments which left the manifest window */
+    while (c->window_size && os->nb_run_segments > c->window_size) {
+        run = &os->runs[0];
+        if (run->repeat) {
+            run->time += run->duration;
+            run->repeat--;
+        } else {
+            os->nb_runs--;
+            memmove(os->runs, os->runs + 1, os->nb_runs * sizeof(*os->runs));
+        }
+        os->nb_run_segments--;
+    }
+
+    return 0;
+}
+
+static int add_segment(DASHContext *c, OutputStream *os, const char *file,
                        int64_t time, int64_t duration,
                        int64_t start_pos, int64_t range_length,
                        int64_t index_length, int next_exp_index)
@@ -1426,6 +1505,9 @@ static int add_segment(OutputStream *os, const char *file,
     seg->range_length = range_length;
     seg->index_length = index_length;
     os->segments[os->nb_segments++] = seg;
+    os->manifest_updated = 1;
+    if ((err = add_segment_run(c, os, seg->time, seg->duration)) < 0)
+        return err;
     os->segment_index++;
     //correcting the segment index if it has fallen behind the expected value
     if (os->segment_index < next_exp_index) {
@@ -1490,6 +1572,7 @@ static int update_stream_extradata(AVFormatContext *s, OutputStream *os,
     memcpy(par->extradata, extradata, extradata_size);
 
     set_codec_str(s, par, frame_rate, os->codec_str, sizeof(os->codec_str));
+    os->manifest_updated = 1;
 
     return 0;
 }
@@ -1645,7 +1728,7 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
             if (bitrate >= 0)
                 os->bit_rate = bitrate;
         }
-        add_segment(os, os->filename, os->start_pts, os->max_pts - os->start_pts, os->pos, range_length, index_length, next_exp_index);
+        add_segment(c, os, os->filename, os->start_pts, os->max_pts - os->start_pts, os->pos, range_length, index_length, next_exp_index);
         av_log(s, AV_LOG_VERBOSE, "Representation %d media segment %d written to: %s\n", i, os->segment_index, os->full_path);
 
         os->pos += range_length;
@@ -1742,6 +1825,7 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
                                               AV_TIME_BASE_Q);
          os->availability_time_offset = ((double) c->seg_duration -
                                          frame_duration) / AV_TIME_BASE;
+        os->manifest_updated = 1;
     }
 
     if (c->use_template && !c->use_timeline) {
@@ -35,6 +35,9 @@
 #endif
 #include <sys/stat.h>
 #include <stdlib.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "os_support.h"
 #include "url.h"
 
@@ -67,6 +70,10 @@
 
 /* standard file protocol */
 
+#define DIRECT_IO_ALIGN     4096
+#define DIRECT_IO_SIZE      (1 << 20)
+#define MMAP_READAHEAD_SIZE (8 << 20)
+
 typedef struct FileContext {
     const AVClass *class;
     int fd;
@@ -74,9 +81,25 @@ typedef struct FileContext {
     int blocksize;
     int follow;
     int seekable;
+    int use_mmap;
+    int read_size;
+    int direct;
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
+
+    int64_t pos;            /* read position when mmap or direct I/O is used */
+
+    uint8_t *map;           /* read-only mapping of the whole file */
+    int64_t map_size;
+    int64_t map_advised;    /* end of the range the kernel was told to read ahead */
+    long page_size;
+
+    uint8_t *dbuf_alloc;    /* aligned bounce buffer for O_DIRECT reads */
+    uint8_t *dbuf;
+    int dbuf_size;
+    int dbuf_len;
+    int64_t dbuf_pos;       /* file offset of dbuf[0] */
 } FileContext;
 
 static const AVOption file_options[] = {
@@ -84,6 +107,9 @@ static const AVOption file_options[] = {
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "seekable", "Sets if the file is seekable", offsetof(FileContext, seekable), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 0, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+    { "mmap", "read the file through a memory mapping", offsetof(FileContext, use_mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "read_size", "set the size of the reads and of the I/O buffer", offsetof(FileContext, read_size), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, AV_OPT_FLAG_DECODING_PARAM },
+    { "direct", "bypass the page cache when reading (O_DIRECT)", offsetof(FileContext, direct), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
@@ -106,11 +132,69 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+#if HAVE_MMAP
+static int map_read(FileContext *c, unsigned char *buf, int size)
+{
+    if (c->pos >= c->map_size)
+        return AVERROR_EOF;
+    size = FFMIN(size, c->map_size - c->pos);
+
+#ifdef MADV_WILLNEED
+    /* keep the kernel reading ahead of us, so that the page faults
+     * are served from the page cache */
+    if (c->pos + size > c->map_advised) {
+        int64_t start = c->pos & ~(int64_t)(c->page_size - 1);
+        madvise(c->map + start, FFMIN(MMAP_READAHEAD_SIZE, c->map_size - start),
+                MADV_WILLNEED);
+        c->map_advised = start + MMAP_READAHEAD_SIZE;
+    }
+#endif
+
+    memcpy(buf, c->map + c->pos, size);
+    c->pos += size;
+    return size;
+}
+#endif
+
+static int direct_read(FileContext *c, unsigned char *buf, int size)
+{
+    int64_t offset = c->pos - c->dbuf_pos;
+
+    if (offset < 0 || offset >= c->dbuf_len) {
+        /* O_DIRECT requires the file offset, the size and the address of
+         * the reads to be aligned */
+        int64_t start = c->pos & ~(int64_t)(DIRECT_IO_ALIGN - 1);
+        int ret;
+
+        if (lseek(c->fd, start, SEEK_SET) < 0)
+            return AVERROR(errno);
+        ret = read(c->fd, c->dbuf, c->dbuf_size);
+        if (ret < 0)
+            return AVERROR(errno);
+        c->dbuf_pos = start;
+        c->dbuf_len = ret;
+        offset      = c->pos - start;
+        if (offset >= ret)
+            return AVERROR_EOF;
+    }
+
+    size = FFMIN(size, c->dbuf_len - offset);
+    memcpy(buf, c->dbuf + offset, size);
+    c->pos += size;
+    return size;
+}
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+#if HAVE_MMAP
+    if (c->map)
+        return map_read(c, buf, size);
+#endif
+    if (c->dbuf)
+        return direct_read(c, buf, size);
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -209,7 +293,7 @@ static int file_open(URLContext *h, const char *filename, int flags)
 {
     FileContext *c = h->priv_data;
     int access;
-    int fd;
+    int fd, is_reg;
     struct stat st;
 
     av_strstart(filename, "file:", &filename);
@@ -224,25 +308,85 @@ static int file_open(URLContext *h, const char *filename, int flags)
             access |= O_TRUNC;
     } else {
         access = O_RDONLY;
+#ifdef O_DIRECT
+        if (c->direct && !c->use_mmap)
+            access |= O_DIRECT;
+#endif
     }
 #ifdef O_BINARY
     access |= O_BINARY;
 #endif
     fd = avpriv_open(filename, access, 0666);
+#ifdef O_DIRECT
+    if (fd == -1 && errno == EINVAL && access & O_DIRECT) {
+        av_log(h, AV_LOG_WARNING, "Direct I/O is not supported for %s, "
+               "using buffered reads\n", filename);
+        access &= ~O_DIRECT;
+        fd = avpriv_open(filename, access, 0666);
+    }
+#endif
     if (fd == -1)
         return AVERROR(errno);
     c->fd = fd;
 
-    h->is_streamed = !fstat(fd, &st) && S_ISFIFO(st.st_mode);
+    is_reg = h->is_streamed = 0;
+    if (!fstat(fd, &st)) {
+        is_reg         = S_ISREG(st.st_mode);
+        h->is_streamed = S_ISFIFO(st.st_mode);
+    }
 
     /* Buffer writes more than the default 32k to improve throughput especially
      * with networked file systems */
     if (!h->is_streamed && flags & AVIO_FLAG_WRITE)
         h->min_packet_size = h->max_packet_size = 262144;
+    else if (!(flags & AVIO_FLAG_WRITE) && c->read_size)
+        h->max_packet_size = c->read_size;
 
     if (c->seekable >= 0)
         h->is_streamed = !c->seekable;
 
+    if ((c->use_mmap || c->direct) && !(flags & AVIO_FLAG_WRITE) &&
+        (c->follow || !is_reg)) {
+        av_log(h, AV_LOG_WARNING, "Memory mapping and direct I/O are only "
+               "supported for regular files that are not followed\n");
+#ifdef O_DIRECT
+        if (access & O_DIRECT)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+        return 0;
+    }
+
+#if HAVE_MMAP
+    if (c->use_mmap && !(flags & AVIO_FLAG_WRITE) && st.st_size > 0) {
+        c->map = st.st_size == (size_t)st.st_size ?
+                 mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (c->map == MAP_FAILED) {
+            av_log(h, AV_LOG_WARNING, "Could not map %s, using buffered reads: %s\n",
+                   filename, av_err2str(AVERROR(errno)));
+            c->map = NULL;
+        } else {
+            c->map_size  = st.st_size;
+            c->page_size = sysconf(_SC_PAGESIZE);
+#ifdef MADV_SEQUENTIAL
+            madvise(c->map, c->map_size, MADV_SEQUENTIAL);
+#endif
+        }
+    }
+#endif
+
+#ifdef O_DIRECT
+    if (access & O_DIRECT) {
+        c->dbuf_size  = FFALIGN(c->read_size ? c->read_size : DIRECT_IO_SIZE,
+                                DIRECT_IO_ALIGN);
+        c->dbuf_alloc = av_malloc(c->dbuf_size + DIRECT_IO_ALIGN - 1);
+        if (!c->dbuf_alloc) {
+            close(fd);
+            return AVERROR(ENOMEM);
+        }
+        c->dbuf = (uint8_t *)FFALIGN((uintptr_t)c->dbuf_alloc, DIRECT_IO_ALIGN);
+    }
+#endif
+
     return 0;
 }
 
@@ -258,6 +402,25 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
+    if (c->map || c->dbuf) {
+        /* the reads do not use the file offset, only track the position */
+        if (whence == SEEK_CUR) {
+            pos += c->pos;
+        } else if (whence == SEEK_END) {
+            struct stat st;
+            if (fstat(c->fd, &st) < 0)
+                return AVERROR(errno);
+            pos += st.st_size;
+        } else if (whence != SEEK_SET) {
+            return AVERROR(EINVAL);
+        }
+        if (pos < 0)
+            return AVERROR(EINVAL);
+        c->pos         = pos;
+        c->map_advised = pos;
+        return pos;
+    }
+
     ret = lseek(c->fd, pos, whence);
 
     return ret < 0 ? AVERROR(errno) : ret;
@@ -266,6 +429,11 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if HAVE_MMAP
+    if (c->map)
+        munmap(c->map, c->map_size);
+#endif
+    av_freep(&c->dbuf_alloc);
     return close(c->fd);
 }
 
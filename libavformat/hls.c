@@ -33,6 +33,8 @@
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
+#include "libavutil/fifo.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "avformat.h"
 #include "internal.h"
@@ -47,6 +49,8 @@
 #define MPEG_TIME_BASE 90000
 #define MPEG_TIME_BASE_Q (AVRational){1, MPEG_TIME_BASE}
 
+#define PREFETCH_CHUNK_SIZE 32768
+
 /*
  * An apple http stream consists of a playlist with media segment files,
  * played sequentially. There may be several playlists with the same
@@ -77,6 +81,23 @@ struct segment {
     struct segment *init_section;
 };
 
+/*
+ * A segment queued for download by the prefetch thread of a playlist.
+ * The segment description is copied, so that the playlist can be reloaded
+ * while the download is in progress.
+ */
+struct prefetch_segment {
+    int seq_no;
+    char *url;
+    int64_t url_offset;
+    int64_t size;
+    int64_t received; /* downloaded so far, an interrupted download resumes there */
+    AVFifoBuffer *fifo;
+    int done;       /* download finished, ret holds its status */
+    int abandoned;  /* dropped from the queue while being downloaded */
+    int ret;
+};
+
 struct rendition;
 
 enum PlaylistType {
@@ -157,6 +178,24 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+    /* Segment prefetching: the current segment is read from the head
+     * of prefetch_queue instead of input if prefetch_active is set. */
+    int prefetch_active;
+#if HAVE_THREADS
+    pthread_t prefetch_thread;
+    pthread_mutex_t prefetch_mutex;
+    pthread_cond_t prefetch_cond;
+    int prefetch_thread_started;
+    int prefetch_abort;
+    struct prefetch_segment **prefetch_queue;
+    int prefetch_head;
+    int prefetch_count;
+    struct prefetch_segment *prefetch_busy; /* segment being downloaded */
+    int64_t prefetch_buffered; /* bytes waiting in the queue */
+    AVDictionary *prefetch_opts;
+    AVIOInterruptCB prefetch_int_cb;
+#endif
 };
 
 /*
@@ -208,6 +247,8 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     int http_seekable;
+    int prefetch;
+    int prefetch_size;
     AVIOContext *playlist_pb;
 } HLSContext;
 
@@ -593,8 +634,36 @@ static int ensure_playlist(HLSContext *c, struct playlist **pls, const char *url
     return 0;
 }
 
+/*
+ * Open url through the io_open callback of s or, if int_cb is set, directly
+ * with that interrupt callback and the protocol whitelist of s. The latter
+ * is for the prefetch threads, which must not call the user I/O callbacks.
+ */
+static int io_open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
+                       AVDictionary **opts, const AVIOInterruptCB *int_cb)
+{
+    if (int_cb)
+        return ffio_open_whitelist(pb, url, AVIO_FLAG_READ, int_cb, opts,
+                                   s->protocol_whitelist, s->protocol_blacklist);
+    return s->io_open(s, pb, url, AVIO_FLAG_READ, opts);
+}
+
+/*
+ * Close an AVIOContext opened by io_open_url(). int_cb must be the same as
+ * passed to io_open_url().
+ */
+static void close_url(AVFormatContext *s, AVIOContext **pb,
+                      const AVIOInterruptCB *int_cb)
+{
+    if (int_cb)
+        avio_closep(pb);
+    else
+        ff_format_io_close(s, pb);
+}
+
 static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
-                              const char *url, AVDictionary **options)
+                              const char *url, AVDictionary **options,
+                              const AVIOInterruptCB *int_cb)
 {
 #if !CONFIG_HTTP_PROTOCOL
     return AVERROR_PROTOCOL_NOT_FOUND;
@@ -605,14 +674,18 @@ static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
     (*pb)->eof_reached = 0;
     ret = ff_http_do_new_request2(uc, url, options);
     if (ret < 0) {
-        ff_format_io_close(s, pb);
+        close_url(s, pb, int_cb);
     }
     return ret;
 #endif
 }
 
+/*
+ * int_cb is passed to io_open_url() and close_url().
+ */
 static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
-                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out)
+                    AVDictionary *opts, AVDictionary *opts2, int *is_http_out,
+                    const AVIOInterruptCB *int_cb)
 {
     HLSContext *c = s->priv_data;
     AVDictionary *tmp = NULL;
@@ -656,7 +729,7 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
     av_dict_copy(&tmp, opts2, 0);
 
     if (is_http && c->http_persistent && *pb) {
-        ret = open_url_keepalive(c->ctx, pb, url, &tmp);
+        ret = open_url_keepalive(c->ctx, pb, url, &tmp, int_cb);
         if (ret == AVERROR_EXIT) {
             av_dict_free(&tmp);
             return ret;
@@ -665,10 +738,10 @@ static int open_url(AVFormatContext *s, AVIOContext **pb, const char *url,
                 av_log(s, AV_LOG_WARNING,
                     "keepalive request failed for '%s' with error: '%s' when opening url, retrying with new connection\n",
                     url, av_err2str(ret));
-            ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
+            ret = io_open_url(s, pb, url, &tmp, int_cb);
         }
     } else {
-        ret = s->io_open(s, pb, url, AVIO_FLAG_READ, &tmp);
+        ret = io_open_url(s, pb, url, &tmp, int_cb);
     }
     if (ret >= 0) {
         // update cookies on http response with setcookies.
@@ -714,7 +787,7 @@ static int parse_playlist(HLSContext *c, const char *url,
 
     if (is_http && !in && c->http_persistent && c->playlist_pb) {
         in = c->playlist_pb;
-        ret = open_url_keepalive(c->ctx, &c->playlist_pb, url, NULL);
+        ret = open_url_keepalive(c->ctx, &c->playlist_pb, url, NULL, NULL);
         if (ret == AVERROR_EXIT) {
             return ret;
         } else if (ret < 0) {
@@ -950,6 +1023,405 @@ fail:
     return ret;
 }
 
+#if HAVE_THREADS
+static void prefetch_segment_free(struct prefetch_segment **pseg)
+{
+    struct prefetch_segment *seg = *pseg;
+
+    if (!seg)
+        return;
+    av_freep(&seg->url);
+    av_fifo_freep(&seg->fifo);
+    av_freep(pseg);
+}
+
+static struct prefetch_segment *prefetch_segment_alloc(struct segment *seg, int seq_no)
+{
+    struct prefetch_segment *pseg = av_mallocz(sizeof(*pseg));
+
+    if (!pseg)
+        return NULL;
+    pseg->seq_no     = seq_no;
+    pseg->url_offset = seg->url_offset;
+    pseg->size       = seg->size;
+    pseg->url        = av_strdup(seg->url);
+    pseg->fifo       = av_fifo_alloc(PREFETCH_CHUNK_SIZE);
+    if (!pseg->url || !pseg->fifo)
+        prefetch_segment_free(&pseg);
+    return pseg;
+}
+
+static int prefetch_open(HLSContext *c, struct playlist *pls,
+                         struct prefetch_segment *seg, AVIOContext **in,
+                         int *is_http)
+{
+    AVDictionary *opts = NULL;
+    int64_t offset = seg->url_offset + seg->received;
+    int ret;
+
+    /* a connection is only kept open across segments for http */
+    if (*in && !av_strstart(seg->url, "http", NULL))
+        avio_closep(in);
+
+    if (c->http_persistent)
+        av_dict_set(&opts, "multiple_requests", "1", 0);
+
+    if (seg->size >= 0 || offset) {
+        av_dict_set_int(&opts, "offset", offset, 0);
+        if (seg->size >= 0)
+            av_dict_set_int(&opts, "end_offset", seg->url_offset + seg->size, 0);
+    }
+
+    av_log(pls->parent, AV_LOG_VERBOSE, "HLS prefetch for url '%s', offset %"PRId64", playlist %d\n",
+           seg->url, offset, pls->index);
+
+    ret = open_url(pls->parent, in, seg->url, pls->prefetch_opts, opts, is_http,
+                   &pls->prefetch_int_cb);
+
+    /* see open_input() for why this is not done for http */
+    if (ret >= 0 && !*is_http && offset) {
+        int64_t seekret = avio_seek(*in, offset, SEEK_SET);
+        if (seekret < 0) {
+            ret = seekret;
+            avio_closep(in);
+        }
+    }
+
+    av_dict_free(&opts);
+    return ret;
+}
+
+/*
+ * Interrupt the downloads of the prefetch thread when it is stopped or its
+ * segment dropped, so that a stalled connection does not block the caller.
+ */
+static int prefetch_interrupt_cb(void *opaque)
+{
+    struct playlist *pls = opaque;
+    int stop;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    stop = pls->prefetch_abort ||
+           (pls->prefetch_busy && pls->prefetch_busy->abandoned);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    return stop || ff_check_interrupt(&pls->parent->interrupt_callback);
+}
+
+/*
+ * Download the queued segments of a playlist one after another, keeping at
+ * most prefetch_size bytes buffered. The downloads use their own (persistent,
+ * if enabled) connection and their own copy of the AVIO options, so that
+ * nothing is shared with the demuxing thread apart from the queue. They are
+ * opened directly rather than through the io_open callback, which is not
+ * required to be thread-safe.
+ */
+static void *prefetch_thread(void *arg)
+{
+    struct playlist *pls = arg;
+    HLSContext *c = pls->parent->priv_data;
+    AVIOContext *in = NULL;
+    uint8_t buf[PREFETCH_CHUNK_SIZE];
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    while (!pls->prefetch_abort) {
+        struct prefetch_segment *seg = NULL;
+        int64_t received;
+        int i, ret, is_http = 0;
+
+        for (i = 0; i < pls->prefetch_count; i++) {
+            struct prefetch_segment *s = pls->prefetch_queue[(pls->prefetch_head + i) % c->prefetch];
+            if (!s->done) {
+                seg = s;
+                break;
+            }
+        }
+        if (!seg) {
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_mutex);
+            continue;
+        }
+        pls->prefetch_busy = seg;
+        received = seg->received;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+
+        ret = prefetch_open(c, pls, seg, &in, &is_http);
+        while (ret >= 0) {
+            int len = sizeof(buf);
+
+            if (seg->size >= 0) {
+                if (received >= seg->size) {
+                    ret = AVERROR_EOF;
+                    break;
+                }
+                len = FFMIN(len, seg->size - received);
+            }
+            ret = avio_read(in, buf, len);
+            if (ret <= 0) {
+                if (!ret)
+                    ret = AVERROR_EOF;
+                break;
+            }
+            received += ret;
+
+            pthread_mutex_lock(&pls->prefetch_mutex);
+            while (pls->prefetch_buffered >= c->prefetch_size &&
+                   !pls->prefetch_abort && !seg->abandoned)
+                pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_mutex);
+            if (pls->prefetch_abort || seg->abandoned) {
+                pthread_mutex_unlock(&pls->prefetch_mutex);
+                ret = AVERROR_EXIT;
+                break;
+            }
+            if (av_fifo_space(seg->fifo) < ret &&
+                av_fifo_grow(seg->fifo, ret - av_fifo_space(seg->fifo)) < 0) {
+                pthread_mutex_unlock(&pls->prefetch_mutex);
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            av_fifo_generic_write(seg->fifo, buf, ret, NULL);
+            pls->prefetch_buffered += ret;
+            pthread_cond_broadcast(&pls->prefetch_cond);
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+        }
+
+        /* only a completely read response leaves the connection reusable */
+        if (ret != AVERROR_EOF || !is_http || !c->http_persistent)
+            avio_closep(&in);
+        if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT)
+            av_log(pls->parent, AV_LOG_WARNING, "Failed to prefetch segment %d of playlist %d: %s\n",
+                   seg->seq_no, pls->index, av_err2str(ret));
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        seg->ret      = ret == AVERROR_EOF ? 0 : ret;
+        seg->received = received;
+        seg->done     = 1;
+        pls->prefetch_busy = NULL;
+        if (seg->abandoned)
+            prefetch_segment_free(&seg);
+        pthread_cond_broadcast(&pls->prefetch_cond);
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    avio_closep(&in);
+    return NULL;
+}
+
+/* Drop all queued segments. Must be called with prefetch_mutex held. */
+static void prefetch_clear(struct playlist *pls)
+{
+    HLSContext *c = pls->parent->priv_data;
+    int i;
+
+    for (i = 0; i < pls->prefetch_count; i++) {
+        struct prefetch_segment **seg = &pls->prefetch_queue[(pls->prefetch_head + i) % c->prefetch];
+        pls->prefetch_buffered -= av_fifo_size((*seg)->fifo);
+        if (*seg == pls->prefetch_busy) {
+            /* freed by the prefetch thread once it notices */
+            (*seg)->abandoned = 1;
+            *seg = NULL;
+        } else {
+            prefetch_segment_free(seg);
+        }
+    }
+    pls->prefetch_head  = 0;
+    pls->prefetch_count = 0;
+    pthread_cond_broadcast(&pls->prefetch_cond);
+}
+
+static int prefetch_init(HLSContext *c, struct playlist *pls)
+{
+    int ret;
+
+    pls->prefetch_queue = av_mallocz_array(c->prefetch, sizeof(*pls->prefetch_queue));
+    if (!pls->prefetch_queue)
+        return AVERROR(ENOMEM);
+    ret = av_dict_copy(&pls->prefetch_opts, c->avio_opts, 0);
+    if (ret < 0)
+        goto fail;
+
+    ret = AVERROR(pthread_mutex_init(&pls->prefetch_mutex, NULL));
+    if (ret < 0)
+        goto fail;
+    ret = AVERROR(pthread_cond_init(&pls->prefetch_cond, NULL));
+    if (ret < 0) {
+        pthread_mutex_destroy(&pls->prefetch_mutex);
+        goto fail;
+    }
+    pls->prefetch_int_cb.callback = prefetch_interrupt_cb;
+    pls->prefetch_int_cb.opaque   = pls;
+    ret = AVERROR(pthread_create(&pls->prefetch_thread, NULL, prefetch_thread, pls));
+    if (ret < 0) {
+        pthread_cond_destroy(&pls->prefetch_cond);
+        pthread_mutex_destroy(&pls->prefetch_mutex);
+        goto fail;
+    }
+    pls->prefetch_thread_started = 1;
+    return 0;
+
+fail:
+    av_log(pls->parent, AV_LOG_ERROR, "Failed to start the prefetch thread of playlist %d: %s\n",
+           pls->index, av_err2str(ret));
+    av_dict_free(&pls->prefetch_opts);
+    av_freep(&pls->prefetch_queue);
+    return ret;
+}
+
+static void prefetch_stop(struct playlist *pls)
+{
+    if (!pls->prefetch_thread_started)
+        return;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    pls->prefetch_abort = 1;
+    prefetch_clear(pls);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    pthread_join(pls->prefetch_thread, NULL);
+
+    pthread_cond_destroy(&pls->prefetch_cond);
+    pthread_mutex_destroy(&pls->prefetch_mutex);
+    av_dict_free(&pls->prefetch_opts);
+    av_freep(&pls->prefetch_queue);
+    pls->prefetch_thread_started = 0;
+    pls->prefetch_active = 0;
+}
+
+static void prefetch_flush(struct playlist *pls)
+{
+    pls->prefetch_active = 0;
+    if (!pls->prefetch_thread_started)
+        return;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    prefetch_clear(pls);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+}
+
+/*
+ * Make the current segment the head of the prefetch queue and top the queue
+ * up to the configured number of segments. Encrypted segments are not
+ * prefetched; the queue stops before them.
+ */
+static int prefetch_start_segment(HLSContext *c, struct playlist *pls)
+{
+    int ret = 0, last;
+
+    if (!pls->prefetch_thread_started && (ret = prefetch_init(c, pls)) < 0)
+        return ret;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    if (pls->prefetch_count &&
+        pls->prefetch_queue[pls->prefetch_head]->seq_no != pls->cur_seq_no)
+        prefetch_clear(pls);
+
+    last = pls->prefetch_count ? pls->cur_seq_no + pls->prefetch_count - 1
+                               : pls->cur_seq_no - 1;
+    while (pls->prefetch_count < c->prefetch) {
+        int n = last + 1 - pls->start_seq_no;
+        struct prefetch_segment *seg;
+
+        if (n < 0 || n >= pls->n_segments ||
+            pls->segments[n]->key_type != KEY_NONE)
+            break;
+        if (!(seg = prefetch_segment_alloc(pls->segments[n], last + 1))) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        pls->prefetch_queue[(pls->prefetch_head + pls->prefetch_count) % c->prefetch] = seg;
+        pls->prefetch_count++;
+        last++;
+    }
+    if (!pls->prefetch_count && ret >= 0)
+        ret = AVERROR(EINVAL);
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    return pls->prefetch_count ? 0 : ret;
+}
+
+/* Finish reading the current segment from the prefetch queue. */
+static void prefetch_end_segment(struct playlist *pls)
+{
+    HLSContext *c = pls->parent->priv_data;
+
+    pls->prefetch_active = 0;
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    if (pls->prefetch_count) {
+        struct prefetch_segment **seg = &pls->prefetch_queue[pls->prefetch_head];
+        pls->prefetch_buffered -= av_fifo_size((*seg)->fifo);
+        if (*seg == pls->prefetch_busy) {
+            (*seg)->abandoned = 1;
+            *seg = NULL;
+        } else {
+            prefetch_segment_free(seg);
+        }
+        pls->prefetch_head = (pls->prefetch_head + 1) % c->prefetch;
+        pls->prefetch_count--;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+}
+
+static int prefetch_read(struct playlist *pls, uint8_t *buf, int buf_size)
+{
+    HLSContext *c = pls->parent->priv_data;
+    struct prefetch_segment *seg;
+    int ret;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    seg = pls->prefetch_queue[pls->prefetch_head];
+    while (!av_fifo_size(seg->fifo) &&
+           (!seg->done || seg->ret == AVERROR_EXIT)) {
+        int64_t t = av_gettime() + 100000;
+        struct timespec tv = { .tv_sec  =  t / 1000000,
+                               .tv_nsec = (t % 1000000) * 1000 };
+        if (ff_check_interrupt(c->interrupt_callback)) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            return AVERROR_EXIT;
+        }
+        if (seg->done) {
+            /* the download was interrupted, resume it where it stopped */
+            seg->done = 0;
+            seg->ret  = 0;
+            pthread_cond_broadcast(&pls->prefetch_cond);
+        }
+        pthread_cond_timedwait(&pls->prefetch_cond, &pls->prefetch_mutex, &tv);
+    }
+    if (av_fifo_size(seg->fifo)) {
+        ret = FFMIN(buf_size, av_fifo_size(seg->fifo));
+        av_fifo_generic_read(seg->fifo, buf, ret, NULL);
+        pls->prefetch_buffered -= ret;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+    } else {
+        ret = seg->ret < 0 ? seg->ret : AVERROR_EOF;
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    return ret;
+}
+#else
+static void prefetch_stop(struct playlist *pls)
+{
+}
+
+static void prefetch_flush(struct playlist *pls)
+{
+}
+
+static int prefetch_start_segment(HLSContext *c, struct playlist *pls)
+{
+    return AVERROR(ENOSYS);
+}
+
+static void prefetch_end_segment(struct playlist *pls)
+{
+}
+
+static int prefetch_read(struct playlist *pls, uint8_t *buf, int buf_size)
+{
+    return AVERROR(ENOSYS);
+}
+#endif
+
 static struct segment *current_segment(struct playlist *pls)
 {
     return pls->segments[pls->cur_seq_no - pls->start_seq_no];
@@ -972,7 +1444,10 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->prefetch_active)
+        ret = prefetch_read(pls, buf, buf_size);
+    else
+        ret = avio_read(pls->input, buf, buf_size);
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1197,12 +1672,12 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
            seg->url, seg->url_offset, pls->index);
 
     if (seg->key_type == KEY_NONE) {
-        ret = open_url(pls->parent, in, seg->url, c->avio_opts, opts, &is_http);
+        ret = open_url(pls->parent, in, seg->url, c->avio_opts, opts, &is_http, NULL);
     } else if (seg->key_type == KEY_AES_128) {
         char iv[33], key[33], url[MAX_URL_SIZE];
         if (strcmp(seg->key, pls->key_url)) {
             AVIOContext *pb = NULL;
-            if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts, NULL) == 0) {
+            if (open_url(pls->parent, &pb, seg->key, c->avio_opts, opts, NULL, NULL) == 0) {
                 ret = avio_read(pb, pls->key, sizeof(pls->key));
                 if (ret != sizeof(pls->key)) {
                     av_log(pls->parent, AV_LOG_ERROR, "Unable to read key file %s\n",
@@ -1226,7 +1701,7 @@ static int open_input(HLSContext *c, struct playlist *pls, struct segment *seg,
         av_dict_set(&opts, "key", key, 0);
         av_dict_set(&opts, "iv", iv, 0);
 
-        ret = open_url(pls->parent, in, url, c->avio_opts, opts, &is_http);
+        ret = open_url(pls->parent, in, url, c->avio_opts, opts, &is_http, NULL);
         if (ret < 0) {
             goto cleanup;
         }
@@ -1387,7 +1862,8 @@ restart:
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->prefetch_active) ||
+        (c->http_persistent && v->input_read_done)) {
         int64_t reload_interval;
 
         /* Check that the playlist is still needed before opening a new
@@ -1397,6 +1873,7 @@ restart:
         if (!v->needed) {
             av_log(v->parent, AV_LOG_INFO, "No longer receiving playlist %d ('%s')\n",
                    v->index, v->url);
+            prefetch_flush(v);
             return AVERROR_EOF;
         }
 
@@ -1447,7 +1924,12 @@ reload:
         if (ret)
             return ret;
 
-        if (c->http_multiple == 1 && v->input_next_requested) {
+        if (c->prefetch && seg->key_type == KEY_NONE &&
+            prefetch_start_segment(c, v) >= 0) {
+            v->prefetch_active = 1;
+            v->cur_seg_offset = 0;
+            ret = 0;
+        } else if (c->http_multiple == 1 && v->input_next_requested) {
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->cur_seg_offset = 0;
             v->input_next_requested = 0;
@@ -1467,7 +1949,7 @@ reload:
         just_opened = 1;
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && v->input) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1477,7 +1959,7 @@ reload:
     }
 
     seg = next_segment(v);
-    if (c->http_multiple == 1 && !v->input_next_requested &&
+    if (c->http_multiple == 1 && !c->prefetch && !v->input_next_requested &&
         seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         ret = open_input(c, v, seg, &v->input_next);
         if (ret < 0) {
@@ -1510,7 +1992,12 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (v->prefetch_active) {
+        /* keep the segment on interrupt, the next read resumes at cur_seg_offset */
+        if (ret == AVERROR_EXIT)
+            return ret;
+        prefetch_end_segment(v);
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -1770,7 +2257,10 @@ static void update_noheader_flag(AVFormatContext *s)
 static int hls_close(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
+    int i;
 
+    for (i = 0; i < c->n_playlists; i++)
+        prefetch_stop(c->playlists[i]);
     free_playlist_list(c);
     free_variant_list(c);
     free_rendition_list(c);
@@ -2009,6 +2499,7 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             pls->input_read_done = 0;
             ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
+            prefetch_flush(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -2252,6 +2743,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
         pls->input_read_done = 0;
         ff_format_io_close(pls->parent, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_flush(pls);
         av_packet_unref(&pls->pkt);
         pls->pb.eof_reached = 0;
         /* Clear any buffered data */
@@ -2311,6 +2803,10 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"prefetch", "Number of segments to download ahead in a background thread per playlist, 0 = disable",
+        OFFSET(prefetch), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_size", "Maximum amount of prefetched data buffered per playlist",
+        OFFSET(prefetch_size), AV_OPT_TYPE_INT, {.i64 = 16 << 20}, PREFETCH_CHUNK_SIZE, INT_MAX, FLAGS},
     {NULL}
 };
 
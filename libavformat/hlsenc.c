@@ -85,6 +85,15 @@ typedef struct HLSSegment {
     struct HLSSegment *next;
 } HLSSegment;
 
+/* Partial segment (EXT-X-PART) of a low latency playlist */
+typedef struct HLSPart {
+    char *path;
+    char *uri;
+    double duration; /* in seconds */
+    int independent;
+    int64_t sequence; /* media sequence number of the parent segment */
+} HLSPart;
+
 typedef enum HLSFlags {
     // Generate a single media file and use byte ranges in the playlist.
     HLS_SINGLE_FILE = (1 << 0),
@@ -166,6 +175,14 @@ typedef struct VariantStream {
     char *ccgroup; /* closed caption group name */
     char *baseurl;
     char *varname; // variant name
+
+    HLSPart *parts;       // published parts of the recent segments
+    int nb_parts;
+    int part_index;       // index of the next part in the current segment
+    int part_packets;     // packets written into the current part
+    int part_independent; // current part starts with a keyframe
+    int part_buf_pos;     // start of the current part in the segment buffer
+    double part_seg_time; // duration of the parts written for the current segment
 } VariantStream;
 
 typedef struct ClosedCaptionsStream {
@@ -180,6 +197,7 @@ typedef struct HLSContext {
     uint32_t start_sequence_source_type;  // enum StartSequenceSourceType
 
     float time;            // Set by a private option.
+    float part_time;       // Set by a private option.
     float init_time;       // Set by a private option.
     int max_nb_segments;   // Set by a private option.
     int hls_delete_threshold; // Set by a private option.
@@ -1226,6 +1244,181 @@ static int hls_rename_temp_file(AVFormatContext *s, AVFormatContext *oc)
     return ret;
 }
 
+static void hls_flush_init_file(AVFormatContext *s, VariantStream *vs)
+{
+    HLSContext *hls = s->priv_data;
+    AVFormatContext *oc = vs->avf;
+    int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
+    uint8_t *buffer = NULL;
+    int range_length;
+
+    range_length = avio_close_dyn_buf(oc->pb, &buffer);
+    avio_write(vs->out, buffer, range_length);
+    av_freep(&buffer);
+    vs->init_range_length = range_length;
+    avio_open_dyn_buf(&oc->pb);
+    vs->packets_written = 0;
+    vs->start_pos = range_length;
+    vs->part_buf_pos = 0;
+    if (!byterange_mode) {
+        hlsenc_io_close(s, &vs->out, vs->base_output_dirname);
+    }
+}
+
+/* "dir/seg12.m4s" -> "dir/seg12.3.m4s" */
+static char *get_part_filename(HLSContext *hls, const char *segment_url, int index)
+{
+    const char *base = av_basename(segment_url);
+    size_t len = strlen(segment_url);
+    size_t ext;
+
+    if ((hls->flags & HLS_TEMP_FILE) && len > 4 && !strcmp(segment_url + len - 4, ".tmp"))
+        len -= 4;
+    for (ext = len; ext > base - segment_url && segment_url[ext - 1] != '.'; ext--)
+        ;
+    if (ext == base - segment_url)
+        return av_asprintf("%.*s.%d", (int)len, segment_url, index);
+    ext--;
+    return av_asprintf("%.*s.%d%.*s", (int)ext, segment_url, index,
+                       (int)(len - ext), segment_url + ext);
+}
+
+static const char *get_part_uri(HLSContext *hls, const char *path)
+{
+    return hls->use_localtime_mkdir ? path : av_basename(path);
+}
+
+/*
+ * Flush the fragment buffered since the previous part and publish it as
+ * a partial segment. The data stays in the segment buffer as well, the
+ * complete segment is written when it ends.
+ */
+static int hls_write_part(AVFormatContext *s, VariantStream *vs, double duration)
+{
+    HLSContext *hls = s->priv_data;
+    AVFormatContext *oc = vs->avf;
+    AVDictionary *options = NULL;
+    const char *proto;
+    char *path, *filename = NULL;
+    uint8_t *buffer;
+    HLSPart *parts;
+    int size, ret;
+
+    av_write_frame(oc, NULL); /* Flush any buffered data */
+    if (!vs->init_range_length) {
+        /* the first flush only produces the initialization section */
+        hls_flush_init_file(s, vs);
+        av_write_frame(oc, NULL);
+    }
+    avio_flush(oc->pb);
+    size = avio_get_dyn_buf(oc->pb, &buffer);
+
+    path = get_part_filename(hls, oc->url, vs->part_index);
+    if (!path)
+        return AVERROR(ENOMEM);
+
+    /* parts are referenced as soon as they exist, so let them appear atomically */
+    proto = avio_find_protocol_name(path);
+    if (proto && !strcmp(proto, "file"))
+        filename = av_asprintf("%s.tmp", path);
+    else
+        filename = av_strdup(path);
+    if (!filename) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    set_http_options(s, &options, hls);
+    ret = hlsenc_io_open(s, &vs->out, filename, &options);
+    av_dict_free(&options);
+    if (ret >= 0) {
+        avio_write(vs->out, buffer + vs->part_buf_pos, size - vs->part_buf_pos);
+        ret = hlsenc_io_close(s, &vs->out, filename);
+        if (ret >= 0 && strcmp(filename, path))
+            ret = ff_rename(filename, path, s);
+    }
+
+    vs->part_buf_pos   = size;
+    vs->part_index++;
+    vs->part_seg_time += duration;
+    vs->part_packets   = 0;
+
+    if (ret < 0) {
+        av_log(s, hls->ignore_io_errors ? AV_LOG_WARNING : AV_LOG_ERROR,
+               "Failed to write part '%s'\n", path);
+        if (hls->ignore_io_errors)
+            ret = 0;
+        goto fail;
+    }
+
+    parts = av_realloc_array(vs->parts, vs->nb_parts + 1, sizeof(*vs->parts));
+    if (!parts) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    vs->parts = parts;
+    parts += vs->nb_parts;
+    parts->uri = av_strdup(get_part_uri(hls, path));
+    if (!parts->uri) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    parts->path        = path;
+    parts->duration    = duration;
+    parts->independent = vs->part_independent > 0;
+    parts->sequence    = vs->sequence;
+    vs->nb_parts++;
+    path = NULL;
+
+fail:
+    vs->part_independent = -1;
+    av_free(filename);
+    av_free(path);
+    return ret;
+}
+
+/* Forget (and delete, if requested) the parts of segments before min_sequence */
+static void hls_prune_parts(AVFormatContext *s, VariantStream *vs, int64_t min_sequence)
+{
+    HLSContext *hls = s->priv_data;
+    const char *proto = avio_find_protocol_name(s->url);
+    int i, n = 0;
+
+    while (n < vs->nb_parts && vs->parts[n].sequence < min_sequence)
+        n++;
+
+    for (i = 0; i < n; i++) {
+        HLSPart *part = &vs->parts[i];
+
+        if (hls->flags & HLS_DELETE_SEGMENTS) {
+            if (hls->method || (proto && !av_strcasecmp(proto, "http"))) {
+                AVDictionary *options = NULL;
+                AVIOContext *out = NULL;
+
+                av_dict_set(&options, "method", "DELETE", 0);
+                if (vs->avf->io_open(vs->avf, &out, part->path, AVIO_FLAG_WRITE, &options) >= 0)
+                    ff_format_io_close(vs->avf, &out);
+                av_dict_free(&options);
+            } else if (unlink(part->path) < 0) {
+                av_log(hls, AV_LOG_ERROR, "failed to delete old part %s: %s\n",
+                       part->path, strerror(errno));
+            }
+        }
+        av_freep(&part->path);
+        av_freep(&part->uri);
+    }
+
+    memmove(vs->parts, vs->parts + n, (vs->nb_parts - n) * sizeof(*vs->parts));
+    vs->nb_parts -= n;
+}
+
+static void write_part_entry(AVIOContext *out, HLSPart *part, const char *baseurl)
+{
+    avio_printf(out, "#EXT-X-PART:DURATION=%.5f,URI=\"%s%s\"%s\n",
+                part->duration, baseurl ? baseurl : "", part->uri,
+                part->independent ? ",INDEPENDENT=YES" : "");
+}
+
 static const char* get_relative_url(const char *master_url, const char *media_url)
 {
     const char *p = strrchr(master_url, '/');
@@ -1432,6 +1625,8 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     double prog_date_time = vs->initial_prog_date_time;
     double *prog_date_time_p = (hls->flags & HLS_PROGRAM_DATE_TIME) ? &prog_date_time : NULL;
     int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
+    int64_t en_sequence;
+    int part = 0;
 
     hls->version = 3;
     if (byterange_mode) {
@@ -1463,6 +1658,20 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
             target_duration = lrint(en->duration);
     }
 
+    if (hls->part_time > 0) {
+        /* only list the parts of the last three target durations */
+        double remaining = 0;
+
+        for (en = vs->segments; en; en = en->next)
+            remaining += en->duration;
+        en_sequence = sequence;
+        for (en = vs->segments; en && remaining > 3 * target_duration; en = en->next) {
+            remaining -= en->duration;
+            en_sequence++;
+        }
+        hls_prune_parts(s, vs, en_sequence);
+    }
+
     vs->discontinuity_set = 0;
     ff_hls_write_playlist_header(byterange_mode ? hls->m3u8_out : vs->out, hls->version, hls->allowcache,
                                  target_duration, sequence, hls->pl_type, hls->flags & HLS_I_FRAMES_ONLY);
@@ -1474,7 +1683,12 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
     if (vs->has_video && (hls->flags & HLS_INDEPENDENT_SEGMENTS)) {
         avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "#EXT-X-INDEPENDENT-SEGMENTS\n");
     }
-    for (en = vs->segments; en; en = en->next) {
+    if (hls->part_time > 0) {
+        avio_printf(vs->out, "#EXT-X-PART-INF:PART-TARGET=%.5f\n", hls->part_time);
+        avio_printf(vs->out, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.5f\n",
+                    3 * hls->part_time);
+    }
+    for (en = vs->segments, en_sequence = sequence; en; en = en->next, en_sequence++) {
         if ((hls->encrypt || hls->key_info_file) && (!key_uri || strcmp(en->key_uri, key_uri) ||
                                     av_strcasecmp(en->iv_string, iv_string))) {
             avio_printf(byterange_mode ? hls->m3u8_out : vs->out, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"", en->key_uri);
@@ -1490,6 +1704,10 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
                                    hls->flags & HLS_SINGLE_FILE, vs->init_range_length, 0);
         }
 
+        for (; part < vs->nb_parts && vs->parts[part].sequence <= en_sequence; part++)
+            if (vs->parts[part].sequence == en_sequence)
+                write_part_entry(vs->out, &vs->parts[part], vs->baseurl);
+
         ret = ff_hls_write_file_entry(byterange_mode ? hls->m3u8_out : vs->out, en->discont, byterange_mode,
                                       en->duration, hls->flags & HLS_ROUND_DURATIONS,
                                       en->size, en->pos, vs->baseurl,
@@ -1499,6 +1717,21 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         }
     }
 
+    if (hls->part_time > 0 && !last) {
+        /* parts of the segment being written, and the one to come */
+        char *hint = get_part_filename(hls, vs->avf->url, vs->part_index);
+
+        if (!vs->segments && vs->init_range_length)
+            ff_hls_write_init_file(vs->out, vs->fmp4_init_filename, 0, vs->init_range_length, 0);
+        for (; part < vs->nb_parts; part++)
+            if (vs->parts[part].sequence == vs->sequence)
+                write_part_entry(vs->out, &vs->parts[part], vs->baseurl);
+        if (hint)
+            avio_printf(vs->out, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%s\"\n",
+                        vs->baseurl ? vs->baseurl : "", get_part_uri(hls, hint));
+        av_free(hint);
+    }
+
     if (last && (hls->flags & HLS_OMIT_ENDLIST)==0)
         ff_hls_write_end_list(byterange_mode ? hls->m3u8_out : vs->out);
 
@@ -1642,6 +1875,12 @@ static int hls_start(AVFormatContext *s, VariantStream *vs)
     }
     vs->number++;
 
+    vs->part_index       = 0;
+    vs->part_packets     = 0;
+    vs->part_independent = -1;
+    vs->part_buf_pos     = 0;
+    vs->part_seg_time    = 0;
+
     set_http_options(s, &options, c);
 
     proto = avio_find_protocol_name(oc->url);
@@ -2223,7 +2462,6 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
     int range_length = 0;
     const char *proto = NULL;
     int use_temp_file = 0;
-    uint8_t *buffer = NULL;
     VariantStream *vs = NULL;
     AVDictionary *options = NULL;
     char *old_filename = NULL;
@@ -2298,22 +2536,19 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         int64_t new_start_pos;
         int byterange_mode = (hls->flags & HLS_SINGLE_FILE) || (hls->max_seg_size > 0);
 
+        if (hls->part_time > 0 && vs->part_packets) {
+            ret = hls_write_part(s, vs, vs->duration - vs->part_seg_time);
+            if (ret < 0)
+                return ret;
+        }
+
         av_write_frame(oc, NULL); /* Flush any buffered data */
         new_start_pos = avio_tell(oc->pb);
         vs->size = new_start_pos - vs->start_pos;
         avio_flush(oc->pb);
         if (hls->segment_type == SEGMENT_TYPE_FMP4) {
             if (!vs->init_range_length) {
-                range_length = avio_close_dyn_buf(oc->pb, &buffer);
-                avio_write(vs->out, buffer, range_length);
-                av_freep(&buffer);
-                vs->init_range_length = range_length;
-                avio_open_dyn_buf(&oc->pb);
-                vs->packets_written = 0;
-                vs->start_pos = range_length;
-                if (!byterange_mode) {
-                    hlsenc_io_close(s, &vs->out, vs->base_output_dirname);
-                }
+                hls_flush_init_file(s, vs);
             }
         }
         if (!byterange_mode) {
@@ -2400,7 +2635,8 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         }
 
         // if we're building a VOD playlist, skip writing the manifest multiple times, and just wait until the end
-        if (hls->pl_type != PLAYLIST_TYPE_VOD) {
+        // with parts, the manifest is written once the next segment is opened, for its preload hint
+        if (hls->pl_type != PLAYLIST_TYPE_VOD && !(hls->part_time > 0)) {
             if ((ret = hls_window(s, 0, vs)) < 0) {
                 av_log(s, AV_LOG_WARNING, "upload playlist failed, will retry with a new http session.\n");
                 ff_format_io_close(s, &vs->out);
@@ -2438,6 +2674,24 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
             return ret;
         }
 
+        if (hls->part_time > 0 && hls->pl_type != PLAYLIST_TYPE_VOD) {
+            if ((ret = hls_window(s, 0, vs)) < 0)
+                return ret;
+        }
+    }
+
+    if (hls->part_time > 0 && oc == vs->avf) {
+        if (is_ref_pkt && vs->part_packets &&
+            vs->duration - vs->part_seg_time + pkt->duration * av_q2d(st->time_base) > hls->part_time) {
+            ret = hls_write_part(s, vs, vs->duration - vs->part_seg_time);
+            if (ret < 0)
+                return ret;
+            if (hls->pl_type != PLAYLIST_TYPE_VOD && (ret = hls_window(s, 0, vs)) < 0)
+                return ret;
+        }
+        if (is_ref_pkt && vs->part_independent < 0)
+            vs->part_independent = !vs->has_video || (pkt->flags & AV_PKT_FLAG_KEY);
+        vs->part_packets++;
     }
 
     vs->packets_written++;
@@ -2458,7 +2712,7 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
 
 static void hls_free_variant_streams(struct HLSContext *hls)
 {
-    int i = 0;
+    int i = 0, j;
     AVFormatContext *vtt_oc = NULL;
     VariantStream *vs = NULL;
 
@@ -2476,6 +2730,11 @@ static void hls_free_variant_streams(struct HLSContext *hls)
 
         hls_free_segments(vs->segments);
         hls_free_segments(vs->old_segments);
+        for (j = 0; j < vs->nb_parts; j++) {
+            av_freep(&vs->parts[j].path);
+            av_freep(&vs->parts[j].uri);
+        }
+        av_freep(&vs->parts);
         av_freep(&vs->m3u8_name);
         av_freep(&vs->streams);
         av_freep(&vs->agroup);
@@ -2523,6 +2782,11 @@ static int hls_write_trailer(struct AVFormatContext *s)
             return AVERROR(ENOMEM);
         }
 
+        if (hls->part_time > 0 && vs->part_packets) {
+            if (hls_write_part(s, vs, vs->duration + vs->dpp - vs->part_seg_time) < 0)
+                av_log(s, AV_LOG_WARNING, "Failed to write the last part of '%s'\n", oc->url);
+        }
+
         if ( hls->segment_type == SEGMENT_TYPE_FMP4) {
             int range_length = 0;
             if (!vs->init_range_length) {
@@ -2708,6 +2972,20 @@ static int hls_init(AVFormatContext *s)
     if (hls->segment_type == SEGMENT_TYPE_FMP4) {
         pattern = "%d.m4s";
     }
+
+    if (hls->part_time > 0) {
+        if (hls->segment_type != SEGMENT_TYPE_FMP4 || (hls->flags & HLS_SINGLE_FILE) ||
+            hls->max_seg_size > 0 || hls->encrypt || hls->key_info_file) {
+            av_log(s, AV_LOG_ERROR, "hls_part_time requires unencrypted fmp4 segments stored in separate files\n");
+            ret = AVERROR(EINVAL);
+            goto fail;
+        }
+        if (hls->part_time > hls->time) {
+            av_log(s, AV_LOG_ERROR, "hls_part_time must not be larger than hls_time\n");
+            ret = AVERROR(EINVAL);
+            goto fail;
+        }
+    }
     if ((hls->start_sequence_source_type == HLS_START_SEQUENCE_AS_SECONDS_SINCE_EPOCH) ||
         (hls->start_sequence_source_type == HLS_START_SEQUENCE_AS_FORMATTED_DATETIME)) {
         time_t t = time(NULL); // we will need it in either case
@@ -2981,6 +3259,7 @@ static const AVOption options[] = {
     {"start_number",  "set first number in the sequence",        OFFSET(start_sequence),AV_OPT_TYPE_INT64,  {.i64 = 0},     0, INT64_MAX, E},
     {"hls_time",      "set segment length in seconds",           OFFSET(time),    AV_OPT_TYPE_FLOAT,  {.dbl = 2},     0, FLT_MAX, E},
     {"hls_init_time", "set segment length in seconds at init list",           OFFSET(init_time),    AV_OPT_TYPE_FLOAT,  {.dbl = 0},     0, FLT_MAX, E},
+    {"hls_part_time", "set partial segment length in seconds for low latency playlists", OFFSET(part_time), AV_OPT_TYPE_FLOAT, {.dbl = 0}, 0, FLT_MAX, E},
     {"hls_list_size", "set maximum number of playlist entries",  OFFSET(max_nb_segments),    AV_OPT_TYPE_INT,    {.i64 = 5},     0, INT_MAX, E},
     {"hls_delete_threshold", "set number of unreferenced segments to keep before deleting",  OFFSET(hls_delete_threshold),    AV_OPT_TYPE_INT,    {.i64 = 1},     1, INT_MAX, E},
     {"hls_ts_options","set hls mpegts list of options for the container format used for hls", OFFSET(format_options_str), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
@@ -191,6 +191,12 @@ struct AVStreamInternal {
      */
     int need_context_update;
 
+    /**
+     * Number of times the internal avctx was updated from codecpar while
+     * reading packets, so that copies of it can tell they are outdated
+     */
+    int context_update_count;
+
     FFFrac *priv_pts;
 };
 
@@ -798,4 +804,28 @@ void ff_packet_list_free(AVPacketList **head, AVPacketList **tail);
 
 void avpriv_register_devices(const AVOutputFormat * const o[], const AVInputFormat * const i[]);
 
+/**
+ * Build the path of the probe cache entry of the input, from its URL, size
+ * and first bytes and the streams found in its header.
+ *
+ * Must be called before the stream parameters are updated by
+ * avformat_find_stream_info().
+ */
+int ff_probe_cache_path(AVFormatContext *s, char *path, int path_size);
+
+/**
+ * Restore the stream parameters found by a previous
+ * avformat_find_stream_info() on the same input from the probe cache.
+ *
+ * @return 1 if the cache entry was used, 0 or a negative AVERROR code if
+ *         the stream information has to be found by analyzing the input
+ */
+int ff_probe_cache_load(AVFormatContext *s, const char *path);
+
+/**
+ * Store the stream parameters found by avformat_find_stream_info() in the
+ * probe cache.
+ */
+int ff_probe_cache_store(AVFormatContext *s, const char *path);
+
 #endif /* AVFORMAT_INTERNAL_H */
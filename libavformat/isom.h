@@ -154,6 +154,35 @@ typedef struct MOVIndexRange {
     int64_t end;
 } MOVIndexRange;
 
+/**
+ * Sample table of a track kept in its run-length form, index entries are
+ * resolved from it on demand instead of being expanded into
+ * AVStream.index_entries.
+ */
+typedef struct MOVCompactIndex {
+    unsigned int first_sample; ///< number of coded samples dropped by the edit list
+    unsigned int nb_samples;   ///< number of samples in the index
+    unsigned int nb_discard;   ///< number of leading samples outside of the edit list
+    int64_t dts_offset;        ///< offset of the sample timestamps from the stts timeline
+    int key_off;               ///< offset between sample numbers and stss entries
+    int64_t *stts_sample;      ///< first sample of every MOV_COMPACT_STEP-th stts entry
+    int64_t *stts_dts;         ///< timestamp of these samples
+    int64_t *stsc_sample;      ///< first sample of every MOV_COMPACT_STEP-th stsc entry
+    MOVStts *ctts_data;        ///< coded ctts, if the one of the track starts at first_sample
+    unsigned int ctts_count;
+    struct {
+        int64_t sample;        ///< coded sample described by entry, -1 if none
+        unsigned int stts_index;
+        unsigned int stts_sample;
+        unsigned int stsc_index;
+        unsigned int chunk;
+        unsigned int chunk_sample;
+        AVIndexEntry entry;
+    } cur[2];                  ///< last resolved samples, by sample parity
+} MOVCompactIndex;
+
+#define MOV_COMPACT_STEP 64
+
 typedef struct MOVStreamContext {
     AVIOContext *pb;
     int pb_is_copied;
@@ -190,6 +219,8 @@ typedef struct MOVStreamContext {
     int64_t current_index;
     MOVIndexRange* index_ranges;
     MOVIndexRange* current_index_range;
+    MOVCompactIndex *compact_index; ///< set if index_entries are resolved on demand
+    int index_rebuilt;    ///< the index was expanded after the compact one was dropped
     unsigned int bytes_per_frame;
     unsigned int samples_per_frame;
     int dv_audio_container;
@@ -232,6 +263,7 @@ typedef struct MOVStreamContext {
     uint32_t format;
 
     int has_sidx;  // If there is an sidx entry for this stream.
+    int has_tfra;  // If there is a tfra entry for this stream.
     struct {
         struct AVAESCTR* aes_ctr;
         unsigned int per_sample_iv_size;  // Either 0, 8, or 16.
@@ -266,6 +298,8 @@ typedef struct MOVContext {
     int advanced_editlist;
     int ignore_chapters;
     int seek_individually;
+    int compact_index;
+    int lazy_fragments;
     int64_t next_root_atom; ///< offset of the next root atom
     int export_all;
     int export_xmp;
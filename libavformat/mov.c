@@ -75,6 +75,7 @@ typedef struct MOVParseTableEntry {
 
 static int mov_read_default(MOVContext *c, AVIOContext *pb, MOVAtom atom);
 static int mov_read_mfra(MOVContext *c, AVIOContext *f);
+static int mov_switch_root(AVFormatContext *s, int64_t target, int index);
 static int64_t add_ctts_entry(MOVStts** ctts_data, unsigned int* ctts_count, unsigned int* allocated_size,
                               int count, int duration);
 
@@ -1252,7 +1253,9 @@ static int64_t get_frag_time(MOVFragmentIndex *frag_index,
 
     if (track_id >= 0) {
         frag_stream_info = get_frag_stream_info(frag_index, index, track_id);
-        return frag_stream_info->sidx_pts;
+        if (frag_stream_info->sidx_pts != AV_NOPTS_VALUE)
+            return frag_stream_info->sidx_pts;
+        return frag_stream_info->first_tfra_pts;
     }
 
     for (i = 0; i < frag_index->item[index].nb_stream_info; i++) {
@@ -1272,10 +1275,10 @@ static int search_frag_timestamp(MOVFragmentIndex *frag_index,
     int id = -1;
 
     if (st) {
-        // If the stream is referenced by any sidx, limit the search
-        // to fragments that referenced this stream in the sidx
+        // If the stream is referenced by any sidx or tfra, limit the search
+        // to fragments that referenced this stream in the sidx or tfra
         MOVStreamContext *sc = st->priv_data;
-        if (sc->has_sidx)
+        if (sc->has_sidx || sc->has_tfra)
             id = st->id;
     }
 
@@ -1368,20 +1371,47 @@ static void fix_frag_index_entries(MOVFragmentIndex *frag_index, int index,
     }
 }
 
+/**
+ * Check that the decode time of all the tracks of a fragment is known without
+ * reading the previous fragments.
+ */
+static int frag_has_decode_times(MOVFragmentIndex *frag_index, int index)
+{
+    MOVFragmentIndexItem *item;
+    int i;
+
+    if (index < 0 || index >= frag_index->nb_items)
+        return 0;
+    item = &frag_index->item[index];
+    for (i = 0; i < item->nb_stream_info; i++) {
+        MOVFragmentStreamInfo *info = &item->stream_info[i];
+        if (info->index_entry >= 0 &&
+            info->tfdt_dts == AV_NOPTS_VALUE && info->sidx_pts == AV_NOPTS_VALUE)
+            return 0;
+    }
+    return 1;
+}
+
 static int mov_read_moof(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
+    int mfra_index = 0, ret;
+
     // Set by mov_read_tfhd(). mov_read_trun() will reject files missing tfhd.
     c->fragment.found_tfhd = 0;
 
-    if (!c->has_looked_for_mfra && c->use_mfra_for > 0) {
+    if (!c->has_looked_for_mfra && (c->use_mfra_for > 0 || c->lazy_fragments)) {
         c->has_looked_for_mfra = 1;
         if (pb->seekable & AVIO_SEEKABLE_NORMAL) {
-            int ret;
             av_log(c->fc, AV_LOG_VERBOSE, "stream has moof boxes, will look "
                     "for a mfra\n");
             if ((ret = mov_read_mfra(c, pb)) < 0) {
                 av_log(c->fc, AV_LOG_VERBOSE, "found a moof box but failed to "
                         "read the mfra (may be a live ismv)\n");
+            } else if (c->lazy_fragments && c->frag_index.nb_items) {
+                /* fragments not listed in the mfra are still found while
+                 * reading, but cannot be seeked to directly */
+                av_log(c->fc, AV_LOG_VERBOSE, "using the mfra as fragment index\n");
+                mfra_index = 1;
             }
         } else {
             av_log(c->fc, AV_LOG_VERBOSE, "found a moof box but stream is not "
@@ -1391,7 +1421,18 @@ static int mov_read_moof(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     c->fragment.moof_offset = c->fragment.implicit_offset = avio_tell(pb) - 8;
     av_log(c->fc, AV_LOG_TRACE, "moof offset %"PRIx64"\n", c->fragment.moof_offset);
     c->frag_index.current = update_frag_index(c, c->fragment.moof_offset);
-    return mov_read_default(c, pb, atom);
+    ret = mov_read_default(c, pb, atom);
+    // only stop reading root atoms once this fragment is complete
+    if (mfra_index) {
+        // without tfdt, e.g. in ismv, the decode times are only known by
+        // adding up the durations of all the previous fragments
+        if (frag_has_decode_times(&c->frag_index, c->frag_index.current))
+            c->frag_index.complete = 1;
+        else
+            av_log(c->fc, AV_LOG_VERBOSE, "fragments have no tfdt, "
+                   "reading all of them\n");
+    }
+    return ret;
 }
 
 static void mov_metadata_creation_time(AVDictionary **metadata, int64_t time)
@@ -3306,6 +3347,561 @@ static int64_t add_ctts_entry(MOVStts** ctts_data, unsigned int* ctts_count, uns
     return *ctts_count;
 }
 
+static void mov_compact_index_free(MOVCompactIndex **pci)
+{
+    MOVCompactIndex *ci = *pci;
+
+    if (!ci)
+        return;
+    av_freep(&ci->stts_sample);
+    av_freep(&ci->stts_dts);
+    av_freep(&ci->stsc_sample);
+    av_freep(&ci->ctts_data);
+    av_freep(pci);
+}
+
+/* Last keyframe at or before a coded sample, -1 if there is none. */
+static int64_t mov_compact_prev_keyframe(AVStream *st, int64_t sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int64_t key = sample + ci->key_off;
+    int a = -1, b = sc->keyframe_count;
+
+    if (sc->keyframe_absent)
+        return st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO ? sample : 0;
+    if (!sc->keyframe_count)
+        return sample;
+    while (b - a > 1) {
+        int m = (a + b) >> 1;
+        if (sc->keyframes[m] <= key)
+            a = m;
+        else
+            b = m;
+    }
+    return a < 0 ? -1 : sc->keyframes[a] - ci->key_off;
+}
+
+/* First keyframe at or after a coded sample, the end of the index if none. */
+static int64_t mov_compact_next_keyframe(AVStream *st, int64_t sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int64_t key = sample + ci->key_off;
+    int64_t end = ci->first_sample + ci->nb_samples;
+    int a = -1, b = sc->keyframe_count;
+
+    if (sc->keyframe_absent)
+        return st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || !sample ? sample : end;
+    if (!sc->keyframe_count)
+        return sample;
+    while (b - a > 1) {
+        int m = (a + b) >> 1;
+        if (sc->keyframes[m] >= key)
+            b = m;
+        else
+            a = m;
+    }
+    return b == sc->keyframe_count ? end : FFMIN(sc->keyframes[b] - ci->key_off, end);
+}
+
+static void mov_compact_fill(AVStream *st, int slot, int64_t sample,
+                             int64_t pos, int64_t timestamp)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    AVIndexEntry *e = &ci->cur[slot].entry;
+    int64_t key = mov_compact_prev_keyframe(st, sample);
+
+    ci->cur[slot].sample = sample;
+    e->pos          = pos;
+    e->timestamp    = timestamp;
+    e->size         = sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[sample];
+    e->min_distance = sample - FFMAX(key, 0);
+    e->flags        = (key == sample ? AVINDEX_KEYFRAME : 0) |
+                      (sample < ci->first_sample + ci->nb_discard ? AVINDEX_DISCARD_FRAME : 0);
+}
+
+/* Resolve a coded sample from the closest stts and stsc checkpoints. */
+static void mov_compact_seek(AVStream *st, int slot, int64_t sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int64_t first, timestamp, pos, k;
+    unsigned int i;
+    int a, b;
+
+    a = 0;
+    b = (sc->stts_count + MOV_COMPACT_STEP - 1) / MOV_COMPACT_STEP;
+    while (b - a > 1) {
+        int m = (a + b) >> 1;
+        if (ci->stts_sample[m] <= sample)
+            a = m;
+        else
+            b = m;
+    }
+    i         = a * MOV_COMPACT_STEP;
+    first     = ci->stts_sample[a];
+    timestamp = ci->stts_dts[a];
+    while (i + 1 < sc->stts_count && first + sc->stts_data[i].count <= sample) {
+        first     += sc->stts_data[i].count;
+        timestamp += (int64_t)sc->stts_data[i].count * sc->stts_data[i].duration;
+        i++;
+    }
+    timestamp += (sample - first) * sc->stts_data[i].duration;
+    ci->cur[slot].stts_index  = i;
+    ci->cur[slot].stts_sample = sample - first;
+
+    a = 0;
+    b = (sc->stsc_count + MOV_COMPACT_STEP - 1) / MOV_COMPACT_STEP;
+    while (b - a > 1) {
+        int m = (a + b) >> 1;
+        if (ci->stsc_sample[m] <= sample)
+            a = m;
+        else
+            b = m;
+    }
+    i     = a * MOV_COMPACT_STEP;
+    first = ci->stsc_sample[a];
+    while (i + 1 < sc->stsc_count && first + mov_get_stsc_samples(sc, i) <= sample) {
+        first += mov_get_stsc_samples(sc, i);
+        i++;
+    }
+    ci->cur[slot].stsc_index   = i;
+    ci->cur[slot].chunk        = sc->stsc_data[i].first - 1 + (sample - first) / sc->stsc_data[i].count;
+    ci->cur[slot].chunk_sample = (sample - first) % sc->stsc_data[i].count;
+
+    pos = sc->chunk_offsets[ci->cur[slot].chunk];
+    if (sc->stsz_sample_size > 0)
+        pos += (int64_t)ci->cur[slot].chunk_sample * sc->stsz_sample_size;
+    else
+        for (k = sample - ci->cur[slot].chunk_sample; k < sample; k++)
+            pos += sc->sample_sizes[k];
+
+    mov_compact_fill(st, slot, sample, pos, timestamp + ci->dts_offset);
+}
+
+/* Resolve the coded sample following the one held by the other slot. */
+static void mov_compact_next(AVStream *st, int slot)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    const AVIndexEntry *prev = &ci->cur[slot ^ 1].entry;
+    int64_t sample = ci->cur[slot ^ 1].sample + 1;
+    int64_t timestamp, pos;
+
+    ci->cur[slot] = ci->cur[slot ^ 1];
+    timestamp = prev->timestamp + sc->stts_data[ci->cur[slot].stts_index].duration;
+    if (ci->cur[slot].stts_index + 1 < sc->stts_count &&
+        ++ci->cur[slot].stts_sample == sc->stts_data[ci->cur[slot].stts_index].count) {
+        ci->cur[slot].stts_index++;
+        ci->cur[slot].stts_sample = 0;
+    }
+
+    if (++ci->cur[slot].chunk_sample == sc->stsc_data[ci->cur[slot].stsc_index].count) {
+        ci->cur[slot].chunk++;
+        ci->cur[slot].chunk_sample = 0;
+        if (mov_stsc_index_valid(ci->cur[slot].stsc_index, sc->stsc_count) &&
+            ci->cur[slot].chunk + 1 == sc->stsc_data[ci->cur[slot].stsc_index + 1].first)
+            ci->cur[slot].stsc_index++;
+        pos = sc->chunk_offsets[ci->cur[slot].chunk];
+    } else {
+        pos = prev->pos + prev->size;
+    }
+
+    mov_compact_fill(st, slot, sample, pos, timestamp);
+}
+
+static AVIndexEntry *mov_compact_get(AVStream *st, int64_t sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int slot = sample & 1;
+
+    sample += ci->first_sample;
+    if (ci->cur[slot].sample != sample) {
+        if (sample > 0 && ci->cur[slot ^ 1].sample == sample - 1)
+            mov_compact_next(st, slot);
+        else
+            mov_compact_seek(st, slot, sample);
+    }
+    return &ci->cur[slot].entry;
+}
+
+static int mov_nb_samples(AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    return sc->compact_index ? sc->compact_index->nb_samples : st->nb_index_entries;
+}
+
+static AVIndexEntry *mov_get_sample(AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    return sc->compact_index ? mov_compact_get(st, sample) : &st->index_entries[sample];
+}
+
+/* Same as av_index_search_timestamp(), for tracks with a compact index too. */
+static int mov_index_search_timestamp(AVStream *st, int64_t wanted_timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int a, b, m;
+    int64_t timestamp;
+
+    if (!ci)
+        return av_index_search_timestamp(st, wanted_timestamp, flags);
+
+    a = -1;
+    b = ci->nb_samples;
+    if (b && mov_compact_get(st, b - 1)->timestamp < wanted_timestamp)
+        a = b - 1;
+
+    while (b - a > 1) {
+        m = (a + b) >> 1;
+
+        while ((mov_compact_get(st, m)->flags & AVINDEX_DISCARD_FRAME) &&
+               m < b && m < ci->nb_samples - 1) {
+            m++;
+            if (m == b && mov_compact_get(st, m)->timestamp >= wanted_timestamp) {
+                m = b - 1;
+                break;
+            }
+        }
+
+        timestamp = mov_compact_get(st, m)->timestamp;
+        if (timestamp >= wanted_timestamp)
+            b = m;
+        if (timestamp <= wanted_timestamp)
+            a = m;
+    }
+    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
+
+    if (!(flags & AVSEEK_FLAG_ANY) && m >= 0 && m < ci->nb_samples) {
+        if (flags & AVSEEK_FLAG_BACKWARD)
+            m = FFMAX(mov_compact_prev_keyframe(st, m + ci->first_sample) - ci->first_sample, -1);
+        else
+            m = mov_compact_next_keyframe(st, m + ci->first_sample) - ci->first_sample;
+    }
+
+    if (m == ci->nb_samples)
+        return -1;
+    return m;
+}
+
+/* Same as find_prev_closest_index(), on the coded samples of a compact index. */
+static int64_t mov_compact_find_start(AVStream *st, int64_t timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t index = mov_index_search_timestamp(st, timestamp, flags | AVSEEK_FLAG_BACKWARD);
+    int64_t i, ctts_index = 0, ctts_sample;
+
+    if (index < 0)
+        return -1;
+    for (i = index; i > 0 && mov_compact_get(st, i)->timestamp == mov_compact_get(st, i - 1)->timestamp; i--)
+        if ((flags & AVSEEK_FLAG_ANY) || (mov_compact_get(st, i - 1)->flags & AVINDEX_KEYFRAME))
+            index = i - 1;
+
+    if (!sc->ctts_data)
+        return index;
+    ctts_sample = index;
+    while (ctts_index < sc->ctts_count && ctts_sample >= sc->ctts_data[ctts_index].count)
+        ctts_sample -= sc->ctts_data[ctts_index++].count;
+
+    while (index >= 0 && ctts_index >= 0 && ctts_index < sc->ctts_count) {
+        const AVIndexEntry *e = mov_compact_get(st, index);
+        if (e->timestamp + sc->ctts_data[ctts_index].duration <= timestamp &&
+            (e->flags & AVINDEX_KEYFRAME))
+            break;
+        index--;
+        if (!ctts_sample) {
+            ctts_index--;
+            if (ctts_index >= 0)
+                ctts_sample = sc->ctts_data[ctts_index].count - 1;
+        } else {
+            ctts_sample--;
+        }
+    }
+    return index;
+}
+
+typedef struct MOVCompactEdit {
+    unsigned int first_sample;
+    unsigned int nb_samples;
+    unsigned int nb_discard;
+    int64_t dts_offset;
+    int64_t min_corrected_pts;
+    int64_t skip_samples;
+    int64_t start_time;
+    int64_t duration;
+} MOVCompactEdit;
+
+/*
+ * Check whether mov_fix_index() would only drop samples from both ends of
+ * the track, shift the timestamps of the others and mark some of the leading
+ * ones as discarded, and compute how.
+ */
+static int mov_compact_check_edit_list(MOVContext *mov, AVStream *st, MOVCompactEdit *edit)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int video = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    int skip = !video && st->codecpar->codec_id != AV_CODEC_ID_VORBIS;
+    int64_t media_time, duration, empty_duration = 0, search, origin = 0;
+    int64_t min_corrected_pts = -1, ctts_index = 0, ctts_sample, first = -1, start, k;
+    unsigned int i;
+    int found_keyframe_after_edit = 0;
+
+    if (sc->dts_shift || (!video && sc->ctts_data))
+        return 0;
+    for (i = 0; i < sc->elst_count; i++) {
+        if (!get_edit_list_entry(mov, sc, i, &media_time, &duration, mov->time_scale))
+            return 0;
+        if (media_time != -1)
+            break;
+        empty_duration += duration;
+    }
+    if (i + 1 != sc->elst_count || media_time < 0)
+        return 0;
+
+    memset(edit, 0, sizeof(*edit));
+    edit->nb_samples = ci->nb_samples;
+    edit->start_time = empty_duration;
+    edit->duration   = empty_duration + duration;
+
+    search = video ? media_time : FFMAX(media_time - sc->time_scale, mov_compact_get(st, 0)->timestamp);
+    start  = mov_compact_find_start(st, search, 0);
+    if (start < 0)
+        start = mov_compact_find_start(st, search, AVSEEK_FLAG_ANY);
+    edit->first_sample = FFMAX(start, 0);
+
+    ctts_sample = edit->first_sample;
+    while (ctts_index < sc->ctts_count && ctts_sample >= sc->ctts_data[ctts_index].count)
+        ctts_sample -= sc->ctts_data[ctts_index++].count;
+
+    for (k = edit->first_sample; k < ci->nb_samples; k++) {
+        const AVIndexEntry *e = mov_compact_get(st, k);
+        int64_t dts = e->timestamp, pts = dts, frame_duration;
+        int key = e->flags & AVINDEX_KEYFRAME;
+
+        if (sc->ctts_data && ctts_index < sc->ctts_count) {
+            pts += sc->ctts_data[ctts_index].duration;
+            if (++ctts_sample == sc->ctts_data[ctts_index].count) {
+                ctts_index++;
+                ctts_sample = 0;
+            }
+        }
+        frame_duration = k + 1 < ci->nb_samples ?
+                         mov_compact_get(st, k + 1)->timestamp - dts : duration;
+
+        /* only leading samples may be discarded, as only they have
+         * their own timeline */
+        if (pts < media_time || pts >= media_time + duration) {
+            if (first >= 0)
+                return 0;
+            if (skip && pts < media_time && pts + frame_duration > media_time) {
+                edit->skip_samples += media_time - pts;
+                first  = k;
+                origin = dts + media_time - pts;
+            } else {
+                edit->nb_discard++;
+                if (skip)
+                    edit->skip_samples += frame_duration;
+            }
+        } else {
+            if (first < 0) {
+                first  = k;
+                origin = dts;
+            }
+            if (min_corrected_pts < 0)
+                min_corrected_pts = empty_duration + pts - origin;
+            else
+                min_corrected_pts = FFMIN(min_corrected_pts, empty_duration + pts - origin);
+        }
+
+        if (pts + frame_duration >= media_time + duration && (key || !video)) {
+            if (video && sc->ctts_data && !found_keyframe_after_edit++)
+                continue;
+            edit->nb_samples = k + 1;
+            break;
+        }
+    }
+    if (first < 0)
+        return 0;
+
+    edit->nb_samples       -= edit->first_sample;
+    edit->min_corrected_pts = min_corrected_pts - empty_duration;
+    edit->dts_offset        = empty_duration - origin;
+    if (video && edit->min_corrected_pts > 0)
+        edit->dts_offset -= edit->min_corrected_pts;
+    return 1;
+}
+
+/*
+ * Keep the sample tables of a track to resolve its index entries on demand,
+ * if they are guaranteed to be the same as the ones mov_build_index() would
+ * create. Returns 1 if the compact index is used, 0 if not.
+ */
+static int mov_compact_index_init(MOVContext *mov, AVStream *st, int64_t dts_offset)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci;
+    MOVCompactEdit edit;
+    int64_t nb_samples = 0, first, timestamp;
+    uint64_t stream_size = 0;
+    unsigned int i;
+    int fix_index = sc->elst_count && !mov->ignore_editlist && mov->advanced_editlist;
+
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+        st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+        return 0;
+    /* uncompressed audio is indexed by chunks, which is compact already */
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+        sc->stts_count == 1 && sc->stts_data[0].duration == 1)
+        return 0;
+    if (!sc->sample_count || st->nb_index_entries || !sc->chunk_count ||
+        !sc->stts_count || !sc->stsc_count ||
+        sc->sample_count >= UINT_MAX / sizeof(*st->index_entries))
+        return 0;
+    /* layouts that are only handled while building the full index */
+    if (sc->stps_count || (sc->rap_group_count && sc->rap_group) ||
+        sc->stsc_data[0].first != 1 ||
+        (sc->stsz_sample_size > 0 && sc->stsz_sample_size < sc->sample_size) ||
+        sc->stsz_sample_size > 0x3FFFFFFF)
+        return 0;
+
+    for (i = 0; i < sc->stts_count; i++)
+        if (!sc->stts_data[i].count || sc->stts_data[i].duration < 0)
+            return 0;
+    for (i = 0; i < sc->stsc_count; i++) {
+        if (sc->stsc_data[i].count <= 0 ||
+            (sc->pseudo_stream_id != -1 && sc->stsc_data[i].id - 1 != sc->pseudo_stream_id) ||
+            (mov_stsc_index_valid(i, sc->stsc_count) &&
+             sc->stsc_data[i + 1].first <= sc->stsc_data[i].first))
+            return 0;
+        nb_samples += mov_get_stsc_samples(sc, i);
+    }
+    if (nb_samples > sc->sample_count)
+        return 0;
+    for (i = 0; i < sc->keyframe_count; i++)
+        if (sc->keyframes[i] < 0 || (i && sc->keyframes[i] <= sc->keyframes[i - 1]))
+            return 0;
+
+    if (sc->stsz_sample_size > 0) {
+        if (sc->sample_size > 0 && sc->sample_size < sc->stsz_sample_size) {
+            unsigned int stsc_index = 0;
+            for (i = 0; i < sc->chunk_count; i++) {
+                int64_t next_offset = i + 1 < sc->chunk_count ? sc->chunk_offsets[i + 1] : INT64_MAX;
+                while (mov_stsc_index_valid(stsc_index, sc->stsc_count) &&
+                       i + 1 == sc->stsc_data[stsc_index + 1].first)
+                    stsc_index++;
+                if (next_offset > sc->chunk_offsets[i] &&
+                    sc->stsc_data[stsc_index].count * (int64_t)sc->stsz_sample_size >
+                    next_offset - sc->chunk_offsets[i])
+                    return 0;
+            }
+        }
+        stream_size = nb_samples * sc->stsz_sample_size;
+    } else {
+        if (!sc->sample_sizes)
+            return 0;
+        for (i = 0; i < nb_samples; i++) {
+            if ((unsigned)sc->sample_sizes[i] > 0x3FFFFFFF)
+                return 0;
+            stream_size += (unsigned)sc->sample_sizes[i];
+        }
+    }
+
+    ci = av_mallocz(sizeof(*ci));
+    if (!ci)
+        return AVERROR(ENOMEM);
+    sc->compact_index = ci;
+    ci->stts_sample = av_malloc_array((sc->stts_count + MOV_COMPACT_STEP - 1) / MOV_COMPACT_STEP,
+                                      sizeof(*ci->stts_sample));
+    ci->stts_dts    = av_malloc_array((sc->stts_count + MOV_COMPACT_STEP - 1) / MOV_COMPACT_STEP,
+                                      sizeof(*ci->stts_dts));
+    ci->stsc_sample = av_malloc_array((sc->stsc_count + MOV_COMPACT_STEP - 1) / MOV_COMPACT_STEP,
+                                      sizeof(*ci->stsc_sample));
+    if (!ci->stts_sample || !ci->stts_dts || !ci->stsc_sample) {
+        mov_compact_index_free(&sc->compact_index);
+        return AVERROR(ENOMEM);
+    }
+
+    first = timestamp = 0;
+    for (i = 0; i < sc->stts_count; i++) {
+        if (!(i % MOV_COMPACT_STEP)) {
+            ci->stts_sample[i / MOV_COMPACT_STEP] = first;
+            ci->stts_dts[i / MOV_COMPACT_STEP]    = timestamp;
+        }
+        first     += sc->stts_data[i].count;
+        timestamp += (int64_t)sc->stts_data[i].count * sc->stts_data[i].duration;
+    }
+    first = 0;
+    for (i = 0; i < sc->stsc_count; i++) {
+        if (!(i % MOV_COMPACT_STEP))
+            ci->stsc_sample[i / MOV_COMPACT_STEP] = first;
+        first += mov_get_stsc_samples(sc, i);
+    }
+
+    ci->nb_samples = nb_samples;
+    ci->dts_offset = dts_offset;
+    ci->key_off    = sc->keyframe_count && sc->keyframes[0] > 0;
+    ci->cur[0].sample = ci->cur[1].sample = -1;
+
+    if (fix_index) {
+        if (!mov_compact_check_edit_list(mov, st, &edit)) {
+            mov_compact_index_free(&sc->compact_index);
+            return 0;
+        }
+        /* mov_fix_index() drops the ctts of the leading samples as well */
+        if (sc->ctts_data && edit.first_sample) {
+            MOVStts *ctts_data = NULL;
+            int64_t skip = edit.first_sample;
+
+            for (i = 0; i < sc->ctts_count && skip >= sc->ctts_data[i].count; i++)
+                skip -= sc->ctts_data[i].count;
+            if (i < sc->ctts_count) {
+                ctts_data = av_malloc_array(sc->ctts_count - i, sizeof(*ctts_data));
+                if (!ctts_data) {
+                    mov_compact_index_free(&sc->compact_index);
+                    return AVERROR(ENOMEM);
+                }
+                memcpy(ctts_data, sc->ctts_data + i, (sc->ctts_count - i) * sizeof(*ctts_data));
+                ctts_data[0].count -= skip;
+            }
+            ci->ctts_data  = sc->ctts_data;
+            ci->ctts_count = sc->ctts_count;
+            sc->ctts_data  = ctts_data;
+            sc->ctts_count = ctts_data ? ci->ctts_count - i : 0;
+            sc->ctts_allocated_size = sc->ctts_count * sizeof(*ctts_data);
+        }
+    }
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        for (i = 0; i < FFMIN(nb_samples, 99); i++)
+            ff_rfps_add_frame(mov->fc, st, mov_compact_get(st, i)->timestamp);
+    if (st->duration > 0)
+        st->codecpar->bit_rate = stream_size*8*sc->time_scale/st->duration;
+
+    if (fix_index) {
+        /* what mov_fix_index() does to the track */
+        ci->first_sample  = edit.first_sample;
+        ci->nb_samples    = edit.nb_samples;
+        ci->nb_discard    = edit.nb_discard;
+        ci->dts_offset   += edit.dts_offset;
+        ci->cur[0].sample = ci->cur[1].sample = -1;
+        sc->min_corrected_pts = edit.min_corrected_pts;
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+            st->skip_samples = edit.skip_samples;
+        sc->start_pad  = st->skip_samples;
+        st->start_time = edit.start_time;
+        st->duration   = FFMIN(st->duration, edit.duration);
+    }
+
+    av_log(mov->fc, AV_LOG_DEBUG, "st: %d using compact index of %u samples\n",
+           st->index, ci->nb_samples);
+    return 1;
+}
+
 #define MAX_REORDER_DELAY 16
 static void mov_estimate_video_delay(MOVContext *c, AVStream* st) {
     MOVStreamContext *msc = st->priv_data;
@@ -3322,14 +3918,14 @@ static void mov_estimate_video_delay(MOVContext *c, AVStream* st) {
     if (st->codecpar->video_delay <= 0 && msc->ctts_data &&
         st->codecpar->codec_id == AV_CODEC_ID_H264) {
         st->codecpar->video_delay = 0;
-        for(ind = 0; ind < st->nb_index_entries && ctts_ind < msc->ctts_count; ++ind) {
+        for(ind = 0; ind < mov_nb_samples(st) && ctts_ind < msc->ctts_count; ++ind) {
             // Point j to the last elem of the buffer and insert the current pts there.
             j = buf_start;
             buf_start = (buf_start + 1);
             if (buf_start == MAX_REORDER_DELAY + 1)
                 buf_start = 0;
 
-            pts_buf[j] = st->index_entries[ind].timestamp + msc->ctts_data[ctts_ind].duration;
+            pts_buf[j] = mov_get_sample(st, ind)->timestamp + msc->ctts_data[ctts_ind].duration;
 
             // The timestamps that are already in the sorted buffer, and are greater than the
             // current pts, are exactly the timestamps that need to be buffered to output PTS
@@ -3772,8 +4368,11 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     }
 
     /* only use old uncompressed audio chunk demuxing when stts specifies it */
-    if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
-          sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
+    if (mov->compact_index && !sc->index_rebuilt &&
+        mov_compact_index_init(mov, st, current_dts - sc->dts_shift) > 0) {
+        /* entries are resolved on demand, ctts is kept in its coded form */
+    } else if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+                 sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
         unsigned int current_sample = 0;
         unsigned int stts_sample = 0;
         unsigned int sample_size;
@@ -3890,7 +4489,8 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
                     av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
                             "size %u, distance %u, keyframe %d\n", st->index, current_sample,
                             current_offset, current_dts, sample_size, distance, keyframe);
-                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries < 100)
+                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries < 100 &&
+                        !sc->index_rebuilt)
                         ff_rfps_add_frame(mov->fc, st, current_dts);
                 }
 
@@ -4030,14 +4630,14 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
     }
 
-    if (!mov->ignore_editlist && mov->advanced_editlist) {
+    if (!mov->ignore_editlist && mov->advanced_editlist && !sc->compact_index) {
         // Fix index according to edit lists.
         mov_fix_index(mov, st);
     }
 
     // Update start time of the stream.
-    if (st->start_time == AV_NOPTS_VALUE && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries > 0) {
-        st->start_time = st->index_entries[0].timestamp + sc->dts_shift;
+    if (st->start_time == AV_NOPTS_VALUE && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && mov_nb_samples(st) > 0) {
+        st->start_time = mov_get_sample(st, 0)->timestamp + sc->dts_shift;
         if (sc->ctts_data) {
             st->start_time += sc->ctts_data[0].duration;
         }
@@ -4046,6 +4646,40 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     mov_estimate_video_delay(mov, st);
 }
 
+static void mov_free_sample_tables(MOVStreamContext *sc)
+{
+    av_freep(&sc->chunk_offsets);
+    av_freep(&sc->sample_sizes);
+    av_freep(&sc->keyframes);
+    av_freep(&sc->stts_data);
+    av_freep(&sc->stps_data);
+    av_freep(&sc->elst_data);
+    av_freep(&sc->rap_group);
+}
+
+/**
+ * Replace the compact index of a track by the full index, for the code
+ * which needs to modify st->index_entries.
+ */
+static void mov_expand_compact_index(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (!sc->compact_index)
+        return;
+    if (sc->compact_index->ctts_data) {
+        av_free(sc->ctts_data);
+        sc->ctts_data  = sc->compact_index->ctts_data;
+        sc->ctts_count = sc->compact_index->ctts_count;
+        sc->compact_index->ctts_data = NULL;
+    }
+    mov_compact_index_free(&sc->compact_index);
+    sc->index_rebuilt = 1;
+    sc->min_corrected_pts = -1;
+    mov_build_index(mov, st);
+    mov_free_sample_tables(sc);
+}
+
 static int test_same_origin(const char *src, const char *ref) {
     char src_proto[64];
     char ref_proto[64];
@@ -4274,14 +4908,9 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         && sc->time_scale == st->codecpar->sample_rate) {
             st->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stts_data);
-    av_freep(&sc->stps_data);
-    av_freep(&sc->elst_data);
-    av_freep(&sc->rap_group);
+    /* Do not need those anymore, unless the index is resolved from them. */
+    if (!sc->compact_index)
+        mov_free_sample_tables(sc);
 
     return 0;
 }
@@ -4720,6 +5349,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     sc = st->priv_data;
     if (sc->pseudo_stream_id+1 != frag->stsd_id && sc->pseudo_stream_id != -1)
         return 0;
+    mov_expand_compact_index(c, st);
 
     // Find the next frag_index index that has a valid index_entry for
     // the current track_id.
@@ -7045,6 +7675,7 @@ static void mov_read_chapters(AVFormatContext *s)
 
         sc = st->priv_data;
         cur_pos = avio_tell(sc->pb);
+        mov_expand_compact_index(mov, st);
 
         if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             st->disposition |= AV_DISPOSITION_ATTACHED_PIC | AV_DISPOSITION_TIMED_THUMBNAILS;
@@ -7236,6 +7867,7 @@ static int mov_read_close(AVFormatContext *s)
         av_freep(&sc->rap_group);
         av_freep(&sc->display_matrix);
         av_freep(&sc->index_ranges);
+        mov_compact_index_free(&sc->compact_index);
 
         if (sc->extradata)
             for (j = 0; j < sc->stsd_count; j++)
@@ -7334,6 +7966,13 @@ static int read_tfra(MOVContext *mov, AVIOContext *f)
     track_id = avio_rb32(f);
     fieldlength = avio_rb32(f);
     item_count = avio_rb32(f);
+    for (i = 0; i < mov->fc->nb_streams; i++) {
+        if (mov->fc->streams[i]->id == track_id) {
+            MOVStreamContext *sc = mov->fc->streams[i]->priv_data;
+            sc->has_tfra = item_count > 0;
+            break;
+        }
+    }
     for (i = 0; i < item_count; i++) {
         int64_t time, offset;
         int index;
@@ -7456,6 +8095,35 @@ static int mov_read_header(AVFormatContext *s)
     }
     av_log(mov->fc, AV_LOG_TRACE, "on_parse_exit_offset=%"PRId64"\n", avio_tell(pb));
 
+    /* fragments are added to the full index */
+    if (mov->trex_data || mov->frag_index.nb_items)
+        for (i = 0; i < s->nb_streams; i++)
+            mov_expand_compact_index(mov, s->streams[i]);
+
+    /* Without sidx, only the end of the last fragment tells the duration
+     * of the tracks when the fragments are read lazily. */
+    if (mov->lazy_fragments && mov->frag_index.complete && mov->frag_index.nb_items > 1 &&
+        !mov->frag_index.item[mov->frag_index.nb_items - 1].headers_read) {
+        int64_t pos = avio_tell(pb), next_root_atom = mov->next_root_atom;
+        MOVFragment fragment = mov->fragment;
+        int has_sidx = 0;
+
+        for (i = 0; i < s->nb_streams; i++)
+            has_sidx |= ((MOVStreamContext *)s->streams[i]->priv_data)->has_sidx;
+        if (!has_sidx) {
+            err = mov_switch_root(s, -1, mov->frag_index.nb_items - 1);
+            if (err < 0 && err != AVERROR_EOF)
+                av_log(s, AV_LOG_WARNING, "Could not read the last fragment\n");
+            if (avio_seek(pb, pos, SEEK_SET) < 0) {
+                mov_read_close(s);
+                return AVERROR_INVALIDDATA;
+            }
+            mov->next_root_atom = next_root_atom;
+            mov->fragment = fragment;
+            mov->found_mdat = 1;
+        }
+    }
+
     if (pb->seekable & AVIO_SEEKABLE_NORMAL) {
         if (mov->nb_chapter_tracks > 0 && !mov->ignore_chapters)
             mov_read_chapters(s);
@@ -7533,7 +8201,8 @@ static int mov_read_header(AVFormatContext *s)
         }
     }
 
-    if (mov->use_mfra_for > 0) {
+    /* only the fragments read so far give an estimate with lazy reading */
+    if (mov->use_mfra_for > 0 || mov->lazy_fragments) {
         for (i = 0; i < s->nb_streams; i++) {
             AVStream *st = s->streams[i];
             MOVStreamContext *sc = st->priv_data;
@@ -7635,8 +8304,8 @@ static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *avst = s->streams[i];
         MOVStreamContext *msc = avst->priv_data;
-        if (msc->pb && msc->current_sample < avst->nb_index_entries) {
-            AVIndexEntry *current_sample = &avst->index_entries[msc->current_sample];
+        if (msc->pb && msc->current_sample < mov_nb_samples(avst)) {
+            AVIndexEntry *current_sample = mov_get_sample(avst, msc->current_sample);
             int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
             av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n", i, msc->current_sample, dts);
             if (!sample || (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) && current_sample->pos < sample->pos) ||
@@ -7675,12 +8344,16 @@ static int mov_switch_root(AVFormatContext *s, int64_t target, int index)
     mov->next_root_atom = 0;
     if (index < 0 || index >= mov->frag_index.nb_items)
         index = search_frag_moof_offset(&mov->frag_index, target);
-    if (index < mov->frag_index.nb_items) {
+    if (index < mov->frag_index.nb_items &&
+        (!mov->lazy_fragments || mov->frag_index.item[index].moof_offset == target)) {
         if (index + 1 < mov->frag_index.nb_items)
             mov->next_root_atom = mov->frag_index.item[index + 1].moof_offset;
         if (mov->frag_index.item[index].headers_read)
             return 0;
         mov->frag_index.item[index].headers_read = 1;
+    } else if (mov->lazy_fragments && index < mov->frag_index.nb_items) {
+        // fragment missing from the index, e.g. not listed in the mfra
+        mov->next_root_atom = mov->frag_index.item[index].moof_offset;
     }
 
     mov->found_mdat = 0;
@@ -7811,8 +8484,8 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             sc->ctts_sample = 0;
         }
     } else {
-        int64_t next_dts = (sc->current_sample < st->nb_index_entries) ?
-            st->index_entries[sc->current_sample].timestamp : st->duration;
+        int64_t next_dts = (sc->current_sample < mov_nb_samples(st)) ?
+            mov_get_sample(st, sc->current_sample)->timestamp : st->duration;
 
         if (next_dts >= pkt->dts)
             pkt->duration = next_dts - pkt->dts;
@@ -7857,7 +8530,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
 static int mov_seek_fragment(AVFormatContext *s, AVStream *st, int64_t timestamp)
 {
     MOVContext *mov = s->priv_data;
-    int index;
+    int index, ret;
 
     if (!mov->frag_index.complete)
         return 0;
@@ -7865,10 +8538,20 @@ static int mov_seek_fragment(AVFormatContext *s, AVStream *st, int64_t timestamp
     index = search_frag_timestamp(&mov->frag_index, st, timestamp);
     if (index < 0)
         index = 0;
+    // The index times are presentation times, the sample with the wanted
+    // decode time may be at the start of the next fragment.
+    if (mov->lazy_fragments && index + 1 < mov->frag_index.nb_items &&
+        !mov->frag_index.item[index + 1].headers_read) {
+        ret = mov_switch_root(s, -1, index + 1);
+        if (ret < 0 && ret != AVERROR_EOF)
+            return ret;
+    }
     if (!mov->frag_index.item[index].headers_read)
         return mov_switch_root(s, -1, index);
     if (index + 1 < mov->frag_index.nb_items)
         mov->next_root_atom = mov->frag_index.item[index + 1].moof_offset;
+    else if (mov->lazy_fragments)
+        mov->next_root_atom = 0;
 
     return 0;
 }
@@ -7887,9 +8570,9 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     if (ret < 0)
         return ret;
 
-    sample = av_index_search_timestamp(st, timestamp, flags);
+    sample = mov_index_search_timestamp(st, timestamp, flags);
     av_log(s, AV_LOG_TRACE, "stream %d, timestamp %"PRId64", sample %d\n", st->index, timestamp, sample);
-    if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
+    if (sample < 0 && mov_nb_samples(st) && timestamp < mov_get_sample(st, 0)->timestamp)
         sample = 0;
     if (sample < 0) /* not sure what to do */
         return AVERROR_INVALIDDATA;
@@ -7933,10 +8616,12 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
     AVStream *st;
     int sample;
     int i;
+    int seek_again = mc->lazy_fragments && mc->frag_index.complete;
 
     if (stream_index >= s->nb_streams)
         return AVERROR_INVALIDDATA;
 
+again:
     st = s->streams[stream_index];
     sample = mov_seek_stream(s, st, sample_time, flags);
     if (sample < 0)
@@ -7944,7 +8629,7 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
 
     if (mc->seek_individually) {
         /* adjust seek timestamp to found sample timestamp */
-        int64_t seek_timestamp = st->index_entries[sample].timestamp;
+        int64_t seek_timestamp = mov_get_sample(st, sample)->timestamp;
 
         for (i = 0; i < s->nb_streams; i++) {
             int64_t timestamp;
@@ -7958,6 +8643,13 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
             timestamp = av_rescale_q(seek_timestamp, s->streams[stream_index]->time_base, st->time_base);
             mov_seek_stream(s, st, timestamp, flags);
         }
+        /* The fragments read for the other streams may have been inserted
+         * before the samples already found, so seek once more now that all
+         * the needed fragments are in the index. */
+        if (seek_again) {
+            seek_again = 0;
+            goto again;
+        }
     } else {
         for (i = 0; i < s->nb_streams; i++) {
             MOVStreamContext *sc;
@@ -7990,6 +8682,10 @@ static const AVOption mov_options[] = {
         "Seek each stream individually to the to the closest point",
         OFFSET(seek_individually), AV_OPT_TYPE_BOOL, { .i64 = 1 },
         0, 1, FLAGS},
+    {"compact_index",
+        "Resolve sample index entries on demand instead of expanding them into the stream index",
+        OFFSET(compact_index), AV_OPT_TYPE_BOOL, {.i64 = 0},
+        0, 1, FLAGS},
     {"ignore_editlist", "Ignore the edit list atom.", OFFSET(ignore_editlist), AV_OPT_TYPE_BOOL, {.i64 = 0},
         0, 1, FLAGS},
     {"advanced_editlist",
@@ -8009,6 +8705,10 @@ static const AVOption mov_options[] = {
         FLAGS, "use_mfra_for" },
     {"pts", "pts", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_MFRA_PTS}, 0, 0,
         FLAGS, "use_mfra_for" },
+    {"lazy_fragments",
+        "Only read the fragments when their samples are needed, if the file has a sidx or mfra index",
+        OFFSET(lazy_fragments), AV_OPT_TYPE_BOOL, {.i64 = 0},
+        0, 1, FLAGS},
     { "export_all", "Export unrecognized metadata entries", OFFSET(export_all),
         AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = FLAGS },
     { "export_xmp", "Export full XMP metadata", OFFSET(export_xmp),
@@ -68,6 +68,7 @@ static const AVOption options[] = {
     { "frag_custom", "Flush fragments on caller requests", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_CUSTOM}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "isml", "Create a live smooth streaming feed (for pushing to a publishing point)", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_ISML}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "faststart", "Run a second pass to put the index (moov atom) at the beginning of the file", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FASTSTART}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
+    { "reserve_moov", "Reserve space for the moov atom from an estimate of its size, avoiding the faststart second pass", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RESERVE_MOOV}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "omit_tfhd_offset", "Omit the base data offset in tfhd atoms", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_OMIT_TFHD_OFFSET}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "disable_chpl", "Disable Nero chapter atom", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_DISABLE_CHPL}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "default_base_moof", "Set the default-base-is-moof flag in tfhd atoms", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_DEFAULT_BASE_MOOF}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
@@ -116,6 +117,7 @@ static const AVClass flavor ## _muxer_class = {\
 };
 
 static int get_moov_size(AVFormatContext *s);
+static int64_t estimate_moov_size(AVFormatContext *s);
 
 static int utf8len(const uint8_t *b)
 {
@@ -6159,6 +6161,9 @@ static int mov_init(AVFormatContext *s)
         mov->flags &= ~FF_MOV_FLAG_SKIP_SIDX;
     }
 
+    if (mov->flags & FF_MOV_FLAG_RESERVE_MOOV && !(mov->flags & FF_MOV_FLAG_FRAGMENT))
+        mov->flags |= FF_MOV_FLAG_FASTSTART;
+
     if (mov->flags & FF_MOV_FLAG_FASTSTART) {
         mov->reserved_moov_size = -1;
     }
@@ -6491,6 +6496,19 @@ static int mov_write_header(AVFormatContext *s)
             return ret;
     }
 
+    if (mov->flags & FF_MOV_FLAG_RESERVE_MOOV && mov->flags & FF_MOV_FLAG_FASTSTART) {
+        int64_t size = estimate_moov_size(s);
+        if (size < 0)
+            return size;
+        if (size > 0 && size <= INT_MAX) {
+            av_log(s, AV_LOG_VERBOSE, "Reserving %"PRId64" bytes for the moov atom\n", size);
+            mov->reserved_moov_size = size;
+        } else {
+            av_log(s, AV_LOG_WARNING, "Unable to estimate the moov size, "
+                   "falling back to a second pass\n");
+        }
+    }
+
     if (mov->reserved_moov_size){
         mov->reserved_header_pos = avio_tell(pb);
         if (mov->reserved_moov_size > 0)
@@ -6505,7 +6523,7 @@ static int mov_write_header(AVFormatContext *s)
             !mov->max_fragment_duration && !mov->max_fragment_size)
             mov->flags |= FF_MOV_FLAG_FRAG_KEYFRAME;
     } else {
-        if (mov->flags & FF_MOV_FLAG_FASTSTART)
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size < 0)
             mov->reserved_header_pos = avio_tell(pb);
         mov_write_mdat_tag(pb, mov);
     }
@@ -6580,6 +6598,94 @@ static int get_moov_size(AVFormatContext *s)
     return ffio_close_null_buf(moov_buf);
 }
 
+/*
+ * Estimate of the moov size for the expected duration of the output, so that
+ * it can be reserved before the media data and written in place once muxing
+ * is done. It follows the sample tables mov_write_stbl_tag() writes; if it
+ * turns out to be too small the trailer falls back to the second pass.
+ * Returns 0 if it cannot be estimated.
+ */
+static int64_t estimate_moov_size(AVFormatContext *s)
+{
+    MOVMuxContext *mov = s->priv_data;
+    int64_t size;
+    int i, ret;
+
+    if (mov->flags & FF_MOV_FLAG_RTP_HINT)
+        return 0;
+
+    /* mvhd and udta, empty tracks are not written */
+    if ((ret = get_moov_size(s)) < 0)
+        return ret;
+    size = ret + 1024 + 256 * s->nb_chapters;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        const AVCodecDescriptor *desc = avcodec_descriptor_get(par->codec_id);
+        int64_t duration = s->duration, samples, chunks;
+        int entry_size;
+
+        if (st->duration > 0)
+            duration = av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q);
+        if (duration <= 0)
+            return 0;
+
+        /* entry_size is the size of the per sample entries: stsz, plus stss
+         * unless all the samples are keyframes, ctts if they are reordered
+         * and stts if their duration varies */
+        switch (par->codec_type) {
+        case AVMEDIA_TYPE_VIDEO: {
+            AVRational rate = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+            if (rate.num <= 0 || rate.den <= 0)
+                return 0;
+            samples    = av_rescale(duration, rate.num, (int64_t)rate.den * AV_TIME_BASE);
+            chunks     = samples;
+            entry_size = 4;
+            if (!desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY))
+                entry_size += 4;
+            if (par->video_delay)
+                entry_size += 8;
+            break;
+        }
+        case AVMEDIA_TYPE_AUDIO:
+            if (par->sample_rate <= 0)
+                return 0;
+            if (par->codec_id != AV_CODEC_ID_ADPCM_MS &&
+                par->codec_id != AV_CODEC_ID_ADPCM_IMA_WAV &&
+                (par->frame_size > 1 || !av_get_bits_per_sample(par->codec_id) ||
+                 par->codec_id == AV_CODEC_ID_ILBC ||
+                 par->codec_id == AV_CODEC_ID_ADPCM_IMA_QT)) {
+                /* audio_vbr: one stsz entry per frame */
+                int frame_size = par->frame_size > 1 ? par->frame_size : 1024;
+                samples    = av_rescale(duration, par->sample_rate, (int64_t)frame_size * AV_TIME_BASE);
+                chunks     = samples;
+                entry_size = 4;
+            } else {
+                /* constant sample size: a single stsz and stts entry, and
+                 * packets of at least 1024 samples for the chunks */
+                samples    = 0;
+                chunks     = av_rescale(duration, par->sample_rate, 1024 * AV_TIME_BASE);
+                entry_size = 0;
+            }
+            break;
+        default:
+            samples    = av_rescale(duration, 4, AV_TIME_BASE);
+            chunks     = samples;
+            entry_size = 4 + 8;
+            break;
+        }
+
+        /* trak with its sample description, a few stts runs, and co64 and
+         * stsc entries for every chunk, at most one per sample when other
+         * tracks are interleaved */
+        size += 1024 + FFMAX(par->extradata_size, 256) + 16 * 8 +
+                samples * entry_size + (chunks + 1) * (8 + 12);
+    }
+
+    return size;
+}
+
 static int get_sidx_size(AVFormatContext *s)
 {
     int ret;
@@ -6769,7 +6875,23 @@ static int mov_write_trailer(AVFormatContext *s)
         }
         avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
-        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size > 0) {
+            /* The estimate was too low: turn the reserved space into a free
+             * atom and move the data after it as usual. */
+            if ((res = get_moov_size(s)) < 0)
+                return res;
+            if (res + 8 > mov->reserved_moov_size) {
+                av_log(s, AV_LOG_WARNING, "Reserved moov space is too small "
+                       "(%d < %d), falling back to a second pass\n",
+                       mov->reserved_moov_size, res + 8);
+                avio_wb32(pb, mov->reserved_moov_size);
+                ffio_wfourcc(pb, "free");
+                avio_seek(pb, moov_pos, SEEK_SET);
+                mov->reserved_moov_size = -1;
+            }
+        }
+
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size < 0) {
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
             res = shift_data(s);
             if (res < 0)
@@ -157,6 +157,17 @@ struct MpegTSContext {
     int resync_size;
     int merge_pmt_versions;
 
+    /** programs and PIDs selected by the user, all if empty */
+    char *select_programs_str;
+    char *select_pids_str;
+    int *select_programs;
+    int nb_select_programs;
+    int *select_pids;
+    int nb_select_pids;
+
+    /** the input protocol exports the arrival time of the data */
+    int has_arrival_time;
+
     /******************************************/
     /* private mpegts data */
     /* scan context */
@@ -169,6 +180,14 @@ struct MpegTSContext {
     MpegTSFilter *pids[NB_PID_MAX];
     int current_pid;
 
+    /** discard_pid() results, valid until the programs change */
+#define PID_DISCARD_UNKNOWN 0xff
+    uint8_t pid_discard[NB_PID_MAX];
+    int pid_discard_valid;
+    /** AVDISCARD_ALL flags of the AVPrograms the cache was built with */
+    uint8_t *program_discard;
+    int nb_program_discard;
+
     AVStream *epg_stream;
 };
 
@@ -191,6 +210,10 @@ static const AVOption options[] = {
      {.i64 = 0}, 0, 1, 0 },
     {"skip_clear", "skip clearing programs", offsetof(MpegTSContext, skip_clear), AV_OPT_TYPE_BOOL,
      {.i64 = 0}, 0, 1, 0 },
+    {"select_programs", "comma separated list of the only programs to demux", offsetof(MpegTSContext, select_programs_str), AV_OPT_TYPE_STRING,
+     {.str = NULL}, 0, 0, AV_OPT_FLAG_DECODING_PARAM },
+    {"select_pids", "comma separated list of the only elementary stream pids to demux", offsetof(MpegTSContext, select_pids_str), AV_OPT_TYPE_STRING,
+     {.str = NULL}, 0, 0, AV_OPT_FLAG_DECODING_PARAM },
     { NULL },
 };
 
@@ -297,12 +320,14 @@ static void clear_program(MpegTSContext *ts, unsigned int programid)
             ts->prg[i].nb_pids = 0;
             ts->prg[i].pmt_found = 0;
         }
+    ts->pid_discard_valid = 0;
 }
 
 static void clear_programs(MpegTSContext *ts)
 {
     av_freep(&ts->prg);
     ts->nb_prg = 0;
+    ts->pid_discard_valid = 0;
 }
 
 static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
@@ -317,6 +342,7 @@ static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
     p->nb_pids = 0;
     p->pmt_found = 0;
     ts->nb_prg++;
+    ts->pid_discard_valid = 0;
 }
 
 static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
@@ -335,6 +361,7 @@ static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid,
             return;
 
     p->pids[p->nb_pids++] = pid;
+    ts->pid_discard_valid = 0;
 }
 
 static void set_pmt_found(MpegTSContext *ts, unsigned int programid)
@@ -410,6 +437,78 @@ static int discard_pid(MpegTSContext *ts, unsigned int pid)
     return !used && discarded;
 }
 
+/**
+ * Invalidate the cached discard_pid() results if the caller changed the
+ * programs selection since they were computed.
+ */
+static void check_program_discard(MpegTSContext *ts)
+{
+    AVFormatContext *s = ts->stream;
+    int i;
+
+    if (ts->nb_program_discard != s->nb_programs) {
+        ts->pid_discard_valid = 0;
+        if (av_reallocp_array(&ts->program_discard, s->nb_programs,
+                              sizeof(*ts->program_discard)) < 0) {
+            ts->nb_program_discard = 0;
+            return;
+        }
+        ts->nb_program_discard = s->nb_programs;
+        memset(ts->program_discard, 0xff, s->nb_programs);
+    }
+    for (i = 0; i < s->nb_programs; i++) {
+        int discard = s->programs[i]->discard == AVDISCARD_ALL;
+        if (ts->program_discard[i] != discard) {
+            ts->program_discard[i] = discard;
+            ts->pid_discard_valid = 0;
+        }
+    }
+}
+
+/* discard_pid() with the result cached per pid */
+static int discard_pid_cached(MpegTSContext *ts, unsigned int pid)
+{
+    if (!ts->pid_discard_valid) {
+        memset(ts->pid_discard, PID_DISCARD_UNKNOWN, sizeof(ts->pid_discard));
+        ts->pid_discard_valid = 1;
+    }
+    if (ts->pid_discard[pid] == PID_DISCARD_UNKNOWN)
+        ts->pid_discard[pid] = discard_pid(ts, pid);
+    return ts->pid_discard[pid];
+}
+
+static int is_selected(const int *ids, int nb_ids, int id)
+{
+    int i;
+
+    if (!nb_ids)
+        return 1;
+    for (i = 0; i < nb_ids; i++)
+        if (ids[i] == id)
+            return 1;
+    return 0;
+}
+
+static int program_selected(MpegTSContext *ts, unsigned int programid)
+{
+    return is_selected(ts->select_programs, ts->nb_select_programs, programid);
+}
+
+static int pid_selected(MpegTSContext *ts, unsigned int pid)
+{
+    return is_selected(ts->select_pids, ts->nb_select_pids, pid);
+}
+
+/**
+ * Whether a stream may be created for a pid not announced in any PMT.
+ * Such a stream belongs to no program, so it is never guessed when only
+ * some programs are selected.
+ */
+static int guess_pid(MpegTSContext *ts, unsigned int pid)
+{
+    return ts->auto_guess && !ts->nb_select_programs && pid_selected(ts, pid);
+}
+
 /**
  *  Assemble PES packets out of TS packets, and then call the "section_cb"
  *  function when they are complete.
@@ -1022,6 +1121,18 @@ static int new_pes_packet(PESContext *pes, AVPacket *pkt)
         return AVERROR(ENOMEM);
     *sd = pes->stream_id;
 
+    if (pes->ts->has_arrival_time) {
+        int64_t arrival_time;
+        if (av_opt_get_int(pes->ts->stream->pb, "arrival_time",
+                           AV_OPT_SEARCH_CHILDREN, &arrival_time) >= 0 &&
+            arrival_time != AV_NOPTS_VALUE) {
+            sd = av_packet_new_side_data(pkt, AV_PKT_DATA_ARRIVAL_TIME, 8);
+            if (!sd)
+                return AVERROR(ENOMEM);
+            AV_WL64(sd, arrival_time);
+        }
+    }
+
     return 0;
 }
 
@@ -2253,6 +2364,8 @@ static void pmt_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
 
     if (ts->skip_unknown_pmt && !get_program(ts, h->id))
         return;
+    if (!program_selected(ts, h->id))
+        return;
     if (!ts->skip_clear)
         clear_program(ts, h->id);
 
@@ -2316,6 +2429,16 @@ static void pmt_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
         if (pid == ts->current_pid)
             goto out;
 
+        if (!pid_selected(ts, pid)) {
+            desc_list_len = get16(&p, p_end);
+            if (desc_list_len < 0)
+                goto out;
+            p += desc_list_len & 0xfff;
+            if (p > p_end)
+                goto out;
+            continue;
+        }
+
         if (ts->merge_pmt_versions)
             stream_identifier = parse_stream_identifier_desc(p, p_end);
 
@@ -2468,6 +2591,8 @@ static void pat_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
 
         if (sid == 0x0000) {
             /* NIT info */
+        } else if (!program_selected(ts, sid)) {
+            /* not selected, neither the program nor its PMT are used */
         } else {
             MpegTSFilter *fil = ts->pids[pmt_pid];
             program = av_new_program(ts->stream, sid);
@@ -2619,7 +2744,7 @@ static void sdt_cb(MpegTSFilter *filter, const uint8_t *section, int section_len
                 if (!provider_name)
                     break;
                 name = getstr8(&p, p_end);
-                if (name) {
+                if (name && program_selected(ts, sid)) {
                     AVProgram *program = av_new_program(ts->stream, sid);
                     if (program) {
                         av_dict_set(&program->metadata, "service_name", name, 0);
@@ -2654,14 +2779,14 @@ static int handle_packet(MpegTSContext *ts, const uint8_t *packet)
     pid = AV_RB16(packet + 1) & 0x1fff;
     is_start = packet[1] & 0x40;
     tss = ts->pids[pid];
-    if (ts->auto_guess && !tss && is_start) {
+    if (!tss && is_start && guess_pid(ts, pid)) {
         add_pes_stream(ts, pid, -1);
         tss = ts->pids[pid];
     }
     if (!tss)
         return 0;
     if (is_start)
-        tss->discard = discard_pid(ts, pid);
+        tss->discard = discard_pid_cached(ts, pid);
     if (tss->discard)
         return 0;
     ts->current_pid = pid;
@@ -2833,15 +2958,31 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
         return 0;
     }
 
-    for (i = 0; i < ts->resync_size; i++) {
-        c = avio_r8(pb);
-        if (avio_feof(pb))
-            return AVERROR_EOF;
-        if (c == 0x47) {
-            avio_seek(pb, -1, SEEK_CUR);
+    for (i = 0; i < ts->resync_size; ) {
+        /* search the buffered data at once, read a byte to refill */
+        const uint8_t *sync;
+        int len = FFMIN(pb->buf_end - pb->buf_ptr, ts->resync_size - i);
+
+        if (len <= 0) {
+            c = avio_r8(pb);
+            if (avio_feof(pb))
+                return AVERROR_EOF;
+            if (c == 0x47) {
+                avio_seek(pb, -1, SEEK_CUR);
+                reanalyze(s->priv_data);
+                return 0;
+            }
+            i++;
+            continue;
+        }
+        sync = memchr(pb->buf_ptr, 0x47, len);
+        if (sync) {
+            avio_skip(pb, sync - pb->buf_ptr);
             reanalyze(s->priv_data);
             return 0;
         }
+        avio_skip(pb, len);
+        i += len;
     }
     av_log(s, AV_LOG_ERROR,
            "max resync size reached, could not find sync byte\n");
@@ -2883,13 +3024,54 @@ static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
         avio_skip(pb, skip);
 }
 
+/**
+ * Skip the packets which handle_packet() would ignore without looking at
+ * their payload, those of PIDs without a filter or discarded ones, directly
+ * in the I/O buffer. Stops at the first packet which has to be handled, is
+ * out of sync or is not entirely buffered.
+ *
+ * @return the number of skipped packets
+ */
+static int skip_packets(MpegTSContext *ts, int max_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    const int raw_packet_size = ts->raw_packet_size;
+    const uint8_t *p = pb->buf_ptr;
+    int nb_skipped;
+
+    for (nb_skipped = 0; nb_skipped < max_packets; nb_skipped++) {
+        MpegTSFilter *tss;
+        int pid, is_start;
+
+        if (pb->buf_end - p < raw_packet_size || p[0] != 0x47)
+            break;
+        pid      = AV_RB16(p + 1) & 0x1fff;
+        is_start = p[1] & 0x40;
+        tss      = ts->pids[pid];
+        if (!tss) {
+            if (is_start && guess_pid(ts, pid))
+                break;
+        } else {
+            if (is_start)
+                tss->discard = discard_pid_cached(ts, pid);
+            if (!tss->discard)
+                break;
+        }
+        p += raw_packet_size;
+    }
+    if (nb_skipped)
+        avio_skip(pb, p - pb->buf_ptr);
+
+    return nb_skipped;
+}
+
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
     uint8_t packet[TS_PACKET_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
     const uint8_t *data;
     int64_t packet_num;
-    int ret = 0;
+    int nb_skipped, ret = 0;
 
     if (avio_tell(s->pb) != ts->last_pos) {
         int i;
@@ -2911,6 +3093,8 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         }
     }
 
+    check_program_discard(ts);
+
     ts->stop_parse = 0;
     packet_num = 0;
     memset(packet + TS_PACKET_SIZE, 0, AV_INPUT_BUFFER_PADDING_SIZE);
@@ -2924,6 +3108,12 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        nb_skipped = skip_packets(ts, nb_packets ? FFMIN(nb_packets - packet_num, INT_MAX) : INT_MAX);
+        if (nb_skipped) {
+            packet_num += nb_skipped - 1;
+            continue;
+        }
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
@@ -3014,11 +3204,45 @@ static void seek_back(AVFormatContext *s, AVIOContext *pb, int64_t pos) {
         av_log(s, (pb->seekable & AVIO_SEEKABLE_NORMAL) ? AV_LOG_ERROR : AV_LOG_INFO, "Unable to seek back to the start\n");
 }
 
+static int parse_id_list(AVFormatContext *s, const char *str, int max_id,
+                         int **ids, int *nb_ids)
+{
+    const char *p = str;
+
+    while (*p) {
+        char *end;
+        long id = strtol(p, &end, 0);
+        int ret;
+
+        if (end == p || id < 0 || id > max_id || (*end && *end != ',')) {
+            av_log(s, AV_LOG_ERROR, "Invalid id list '%s'\n", str);
+            return AVERROR(EINVAL);
+        }
+        if ((ret = av_reallocp_array(ids, *nb_ids + 1, sizeof(**ids))) < 0) {
+            *nb_ids = 0;
+            return ret;
+        }
+        (*ids)[(*nb_ids)++] = id;
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+}
+
 static int mpegts_read_header(AVFormatContext *s)
 {
     MpegTSContext *ts = s->priv_data;
     AVIOContext *pb   = s->pb;
     int64_t pos, probesize = s->probesize;
+    int ret;
+
+    if (ts->select_programs_str &&
+        (ret = parse_id_list(s, ts->select_programs_str, 0xffff,
+                             &ts->select_programs, &ts->nb_select_programs)) < 0)
+        goto fail;
+    if (ts->select_pids_str &&
+        (ret = parse_id_list(s, ts->select_pids_str, NB_PID_MAX - 1,
+                             &ts->select_pids, &ts->nb_select_pids)) < 0)
+        goto fail;
 
     s->internal->prefer_codec_framerate = 1;
 
@@ -3033,6 +3257,8 @@ static int mpegts_read_header(AVFormatContext *s)
     }
     ts->stream     = s;
     ts->auto_guess = 0;
+    ts->has_arrival_time = pb && av_opt_find(pb, "arrival_time", NULL, 0,
+                                             AV_OPT_SEARCH_CHILDREN);
 
     if (s->iformat == &ff_mpegts_demuxer) {
         /* normal demux */
@@ -3042,7 +3268,9 @@ static int mpegts_read_header(AVFormatContext *s)
 
         mpegts_open_section_filter(ts, SDT_PID, sdt_cb, ts, 1);
         mpegts_open_section_filter(ts, PAT_PID, pat_cb, ts, 1);
-        mpegts_open_section_filter(ts, EIT_PID, eit_cb, ts, 1);
+        /* the EPG is not part of a program */
+        if (!ts->nb_select_programs && pid_selected(ts, EIT_PID))
+            mpegts_open_section_filter(ts, EIT_PID, eit_cb, ts, 1);
 
         handle_packets(ts, probesize / ts->raw_packet_size);
         /* if could not find service, enable auto_guess */
@@ -3054,7 +3282,7 @@ static int mpegts_read_header(AVFormatContext *s)
         s->ctx_flags |= AVFMTCTX_NOHEADER;
     } else {
         AVStream *st;
-        int pcr_pid, pid, nb_packets, nb_pcrs, ret, pcr_l;
+        int pcr_pid, pid, nb_packets, nb_pcrs, pcr_l;
         int64_t pcrs[2], pcr_h;
         int packet_count[2];
         uint8_t packet[TS_PACKET_SIZE];
@@ -3115,6 +3343,10 @@ static int mpegts_read_header(AVFormatContext *s)
 
     seek_back(s, pb, pos);
     return 0;
+fail:
+    av_freep(&ts->select_programs);
+    av_freep(&ts->select_pids);
+    return ret;
 }
 
 #define MAX_PACKET_READAHEAD ((128 * 1024) / 188)
@@ -3202,6 +3434,9 @@ static void mpegts_free(MpegTSContext *ts)
     int i;
 
     clear_programs(ts);
+    av_freep(&ts->program_discard);
+    av_freep(&ts->select_programs);
+    av_freep(&ts->select_pids);
 
     for (i = 0; i < NB_PID_MAX; i++)
         if (ts->pids[i])
@@ -3314,6 +3549,7 @@ int avpriv_mpegts_parse_packet(MpegTSContext *ts, AVPacket *pkt,
 
     len1 = len;
     ts->pkt = pkt;
+    check_program_discard(ts);
     for (;;) {
         ts->stop_parse = 0;
         if (len < TS_PACKET_SIZE)
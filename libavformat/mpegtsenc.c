@@ -84,6 +84,19 @@ typedef struct MpegTSWrite {
     int64_t first_pcr;
     int64_t next_pcr;
     int mux_rate; ///< set to 1 when VBR
+    /* get_pcr() state, the rescaled position last computed and the
+     * remainder of the rescaling, to advance it without a division */
+    int64_t pcr_pos;
+    int64_t pcr_base;
+    int64_t pcr_rem;
+    int64_t pcr_step_q;
+    int64_t pcr_step_r;
+
+    /* output block the packets are built in before being written at once */
+    uint8_t *block;
+    int block_len;
+    int64_t block_pos;  ///< output position of the block
+    int packet_size;    ///< raw packet size, with the m2ts header
     int pes_payload_size;
 
     int transport_stream_id;
@@ -116,10 +129,16 @@ typedef struct MpegTSWrite {
 #define DEFAULT_PES_HEADER_FREQ  16
 #define DEFAULT_PES_PAYLOAD_SIZE ((DEFAULT_PES_HEADER_FREQ - 1) * 184 + 170)
 
+/* size of the block the packets are written out in */
+#define MPEGTS_BLOCK_SIZE (512 * (TS_PACKET_SIZE + 4))
+
 /* The section length is 12 bits. The first 2 are set to 0, the remaining
  * 10 bits should not exceed 1021. */
 #define SECTION_LENGTH 1020
 
+/* maximum payload of a section written by mpegts_write_section1() */
+#define SECTION_DATA_LENGTH (1024 - 3 - 5 - 4)
+
 /* NOTE: 4 bytes must be left at the end for the crc32 */
 static void mpegts_write_section(MpegTSSection *s, uint8_t *buf, int len)
 {
@@ -639,42 +658,64 @@ static int mpegts_write_pmt(AVFormatContext *s, MpegTSService *service)
     return 0;
 }
 
+/* size of the SDT entry of a service */
+static int sdt_service_size(const MpegTSService *service)
+{
+    return 8 + service->provider_name[0] + 1 + service->name[0] + 1;
+}
+
 static void mpegts_write_sdt(AVFormatContext *s)
 {
     MpegTSWrite *ts = s->priv_data;
     MpegTSService *service;
     uint8_t data[SECTION_LENGTH], *q, *desc_list_len_ptr, *desc_len_ptr;
-    int i, running_status, free_ca_mode, val;
+    int i, running_status, free_ca_mode, val, sec_num, last_sec_num, len;
 
-    q = data;
-    put16(&q, ts->onid);
-    *q++ = 0xff;
+    /* split the services in as many sections as needed */
+    last_sec_num = 0;
+    len          = 3;
     for (i = 0; i < ts->nb_services; i++) {
-        service = ts->services[i];
-        put16(&q, service->sid);
-        *q++              = 0xfc | 0x00; /* currently no EIT info */
-        desc_list_len_ptr = q;
-        q                += 2;
-        running_status    = 4; /* running */
-        free_ca_mode      = 0;
-
-        /* write only one descriptor for the service name and provider */
-        *q++         = 0x48;
-        desc_len_ptr = q;
-        q++;
-        *q++         = ts->service_type;
-        putbuf(&q, service->provider_name, service->provider_name[0] + 1);
-        putbuf(&q, service->name, service->name[0] + 1);
-        desc_len_ptr[0] = q - desc_len_ptr - 1;
-
-        /* fill descriptor length */
-        val = (running_status << 13) | (free_ca_mode << 12) |
-              (q - desc_list_len_ptr - 2);
-        desc_list_len_ptr[0] = val >> 8;
-        desc_list_len_ptr[1] = val;
+        if (len + sdt_service_size(ts->services[i]) > SECTION_DATA_LENGTH) {
+            last_sec_num++;
+            len = 3;
+        }
+        len += sdt_service_size(ts->services[i]);
+    }
+
+    i = 0;
+    for (sec_num = 0; sec_num <= last_sec_num; sec_num++) {
+        q = data;
+        put16(&q, ts->onid);
+        *q++ = 0xff;
+        for (; i < ts->nb_services; i++) {
+            service = ts->services[i];
+            if (q - data + sdt_service_size(service) > SECTION_DATA_LENGTH)
+                break;
+            put16(&q, service->sid);
+            *q++              = 0xfc | 0x00; /* currently no EIT info */
+            desc_list_len_ptr = q;
+            q                += 2;
+            running_status    = 4; /* running */
+            free_ca_mode      = 0;
+
+            /* write only one descriptor for the service name and provider */
+            *q++         = 0x48;
+            desc_len_ptr = q;
+            q++;
+            *q++         = ts->service_type;
+            putbuf(&q, service->provider_name, service->provider_name[0] + 1);
+            putbuf(&q, service->name, service->name[0] + 1);
+            desc_len_ptr[0] = q - desc_len_ptr - 1;
+
+            /* fill descriptor length */
+            val = (running_status << 13) | (free_ca_mode << 12) |
+                  (q - desc_list_len_ptr - 2);
+            desc_list_len_ptr[0] = val >> 8;
+            desc_list_len_ptr[1] = val;
+        }
+        mpegts_write_section1(&ts->sdt, SDT_TID, ts->tsid, ts->tables_version,
+                              sec_num, last_sec_num, data, q - data);
     }
-    mpegts_write_section1(&ts->sdt, SDT_TID, ts->tsid, ts->tables_version, 0, 0,
-                          data, q - data);
 }
 
 /* This stores a string in buf with the correct encoding and also sets the
@@ -713,29 +754,87 @@ invalid:
     return 0;
 }
 
-static int64_t get_pcr(const MpegTSWrite *ts, AVIOContext *pb)
+/* output position, including the packets not written yet */
+static int64_t output_tell(AVFormatContext *s)
+{
+    MpegTSWrite *ts = s->priv_data;
+
+    return ts->block_len ? ts->block_pos + ts->block_len : avio_tell(s->pb);
+}
+
+static int64_t get_pcr(AVFormatContext *s)
+{
+    MpegTSWrite *ts = s->priv_data;
+    int64_t pos = output_tell(s) + 11;
+
+    if (pos != ts->pcr_pos) {
+        int64_t delta = pos - ts->pcr_pos;
+
+        /* same as av_rescale(pos, 8 * PCR_TIME_BASE, ts->mux_rate) */
+        if (ts->pcr_pos >= 0 && delta == ts->packet_size) {
+            ts->pcr_base += ts->pcr_step_q;
+            ts->pcr_rem  += ts->pcr_step_r;
+        } else if (ts->pcr_pos >= 0 && delta > 0 && delta < INT_MAX) {
+            ts->pcr_base += delta * 8 * PCR_TIME_BASE / ts->mux_rate;
+            ts->pcr_rem  += delta * 8 * PCR_TIME_BASE % ts->mux_rate;
+        } else {
+            ts->pcr_base = av_rescale(pos, 8 * PCR_TIME_BASE, ts->mux_rate);
+            ts->pcr_rem  = ((pos % ts->mux_rate) * 8 * PCR_TIME_BASE +
+                            ts->mux_rate / 2) % ts->mux_rate;
+        }
+        if (ts->pcr_rem >= ts->mux_rate) {
+            ts->pcr_base++;
+            ts->pcr_rem -= ts->mux_rate;
+        }
+        ts->pcr_pos = pos;
+    }
+    return ts->pcr_base + ts->first_pcr;
+}
+
+static void flush_packets(AVFormatContext *s)
+{
+    MpegTSWrite *ts = s->priv_data;
+
+    if (ts->block_len) {
+        avio_write(s->pb, ts->block, ts->block_len);
+        ts->block_len = 0;
+    }
+}
+
+/* Get the buffer to build the next packet in, and commit it with
+ * output_packet(). */
+static uint8_t *get_packet_buf(AVFormatContext *s)
 {
-    return av_rescale(avio_tell(pb) + 11, 8 * PCR_TIME_BASE, ts->mux_rate) +
-           ts->first_pcr;
+    MpegTSWrite *ts = s->priv_data;
+
+    if (ts->block_len + ts->packet_size > MPEGTS_BLOCK_SIZE)
+        flush_packets(s);
+    if (!ts->block_len)
+        ts->block_pos = avio_tell(s->pb);
+    return ts->block + ts->block_len + ts->packet_size - TS_PACKET_SIZE;
 }
 
-static void mpegts_prefix_m2ts_header(AVFormatContext *s)
+static void output_packet(AVFormatContext *s)
 {
     MpegTSWrite *ts = s->priv_data;
+
     if (ts->m2ts_mode) {
-        int64_t pcr = get_pcr(s->priv_data, s->pb);
-        uint32_t tp_extra_header = pcr % 0x3fffffff;
-        tp_extra_header = AV_RB32(&tp_extra_header);
-        avio_write(s->pb, (unsigned char *) &tp_extra_header,
-                   sizeof(tp_extra_header));
+        int64_t pcr = get_pcr(s);
+        AV_WB32(ts->block + ts->block_len, pcr % 0x3fffffff);
     }
+    ts->block_len += ts->packet_size;
+}
+
+static void write_packet(AVFormatContext *s, const uint8_t *packet)
+{
+    memcpy(get_packet_buf(s), packet, TS_PACKET_SIZE);
+    output_packet(s);
 }
 
 static void section_write_packet(MpegTSSection *s, const uint8_t *packet)
 {
     AVFormatContext *ctx = s->opaque;
-    mpegts_prefix_m2ts_header(ctx);
-    avio_write(ctx->pb, packet, TS_PACKET_SIZE);
+    write_packet(ctx, packet);
 }
 
 static MpegTSService *mpegts_add_service(AVFormatContext *s, int sid,
@@ -1003,6 +1102,15 @@ static int mpegts_init(AVFormatContext *s)
         }
     }
 
+    ts->packet_size = TS_PACKET_SIZE + (ts->m2ts_mode ? 4 : 0);
+    ts->pcr_pos     = -1;
+    ts->pcr_step_q  = ts->packet_size * 8LL * PCR_TIME_BASE / ts->mux_rate;
+    ts->pcr_step_r  = ts->packet_size * 8LL * PCR_TIME_BASE % ts->mux_rate;
+
+    ts->block = av_malloc(MPEGTS_BLOCK_SIZE);
+    if (!ts->block)
+        return AVERROR(ENOMEM);
+
     return 0;
 
 fail:
@@ -1061,14 +1169,12 @@ static void mpegts_insert_null_packet(AVFormatContext *s)
     *q++ = 0xff;
     *q++ = 0x10;
     memset(q, 0x0FF, TS_PACKET_SIZE - (q - buf));
-    mpegts_prefix_m2ts_header(s);
-    avio_write(s->pb, buf, TS_PACKET_SIZE);
+    write_packet(s, buf);
 }
 
 /* Write a single transport stream packet with a PCR and no payload */
 static void mpegts_insert_pcr_only(AVFormatContext *s, AVStream *st)
 {
-    MpegTSWrite *ts = s->priv_data;
     MpegTSWriteStream *ts_st = st->priv_data;
     uint8_t *q;
     uint8_t buf[TS_PACKET_SIZE];
@@ -1087,12 +1193,11 @@ static void mpegts_insert_pcr_only(AVFormatContext *s, AVStream *st)
     }
 
     /* PCR coded into 6 bytes */
-    q += write_pcr_bits(q, get_pcr(ts, s->pb));
+    q += write_pcr_bits(q, get_pcr(s));
 
     /* stuffing bytes */
     memset(q, 0xFF, TS_PACKET_SIZE - (q - buf));
-    mpegts_prefix_m2ts_header(s);
-    avio_write(s->pb, buf, TS_PACKET_SIZE);
+    write_packet(s, buf);
 }
 
 static void write_pts(uint8_t *q, int fourbits, int64_t pts)
@@ -1152,15 +1257,13 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
 {
     MpegTSWriteStream *ts_st = st->priv_data;
     MpegTSWrite *ts = s->priv_data;
-    uint8_t buf[TS_PACKET_SIZE];
-    uint8_t *q;
+    uint8_t *buf, *q;
     int val, is_start, len, header_len, write_pcr, is_dvb_subtitle, is_dvb_teletext, flags;
     int afc_len, stuffing_len;
     int64_t delay = av_rescale(s->max_delay, 90000, AV_TIME_BASE);
     int force_pat = st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && key && !ts_st->prev_payload_key;
     int force_sdt = 0;
 
-    av_assert0(ts_st->payload != buf || st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO);
     if (ts->flags & MPEGTS_FLAG_PAT_PMT_AT_FRAMES && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
         force_pat = 1;
     }
@@ -1175,7 +1278,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
     while (payload_size > 0) {
         int64_t pcr = AV_NOPTS_VALUE;
         if (ts->mux_rate > 1)
-            pcr = get_pcr(ts, s->pb);
+            pcr = get_pcr(s);
         else if (dts != AV_NOPTS_VALUE)
             pcr = (dts - delay) * 300;
 
@@ -1186,7 +1289,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
         write_pcr = 0;
         if (ts->mux_rate > 1) {
             /* Send PCR packets for all PCR streams if needed */
-            pcr = get_pcr(ts, s->pb);
+            pcr = get_pcr(s);
             if (pcr >= ts->next_pcr) {
                 int64_t next_pcr = INT64_MAX;
                 for (int i = 0; i < s->nb_streams; i++) {
@@ -1200,7 +1303,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
                             ts_st2->last_pcr = FFMAX(pcr - ts_st2->pcr_period, ts_st2->last_pcr + ts_st2->pcr_period);
                             if (st2 != st) {
                                 mpegts_insert_pcr_only(s, st2);
-                                pcr = get_pcr(ts, s->pb);
+                                pcr = get_pcr(s);
                             } else {
                                 write_pcr = 1;
                             }
@@ -1227,6 +1330,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
         }
 
         /* prepare packet header */
+        buf  = get_packet_buf(s);
         q    = buf;
         *q++ = 0x47;
         val  = ts_st->pid >> 8;
@@ -1432,8 +1536,7 @@ static void mpegts_write_pes(AVFormatContext *s, AVStream *st,
 
         payload      += len;
         payload_size -= len;
-        mpegts_prefix_m2ts_header(s);
-        avio_write(s->pb, buf, TS_PACKET_SIZE);
+        output_packet(s);
     }
     ts_st->prev_payload_key = key;
 }
@@ -1786,18 +1889,24 @@ static void mpegts_write_flush(AVFormatContext *s)
 
 static int mpegts_write_packet(AVFormatContext *s, AVPacket *pkt)
 {
+    int ret;
+
     if (!pkt) {
         mpegts_write_flush(s);
-        return 1;
+        ret = 1;
     } else {
-        return mpegts_write_packet_internal(s, pkt);
+        ret = mpegts_write_packet_internal(s, pkt);
     }
+    flush_packets(s);
+    return ret;
 }
 
 static int mpegts_write_end(AVFormatContext *s)
 {
-    if (s->pb)
+    if (s->pb) {
         mpegts_write_flush(s);
+        flush_packets(s);
+    }
 
     return 0;
 }
@@ -1825,6 +1934,7 @@ static void mpegts_deinit(AVFormatContext *s)
         av_freep(&service);
     }
     av_freep(&ts->services);
+    av_freep(&ts->block);
 }
 
 static int mpegts_check_bitstream(struct AVFormatContext *s, const AVPacket *pkt)
@@ -0,0 +1,475 @@
+/*
+ * Persistent cache of the stream parameters found by avformat_find_stream_info()
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * The cache entries are text files named after the MD5 of the input URL,
+ * size and first bytes and of the streams found in its header, with one
+ * key=value line per cached field.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/bprint.h"
+#include "libavutil/dict.h"
+#include "libavutil/md5.h"
+#include "libavutil/random_seed.h"
+#include "libavcodec/avcodec.h"
+
+#include "avformat.h"
+#include "internal.h"
+
+#define PROBE_CACHE_VERSION   2
+#define PROBE_CACHE_HEAD_SIZE (64 * 1024)
+#define PROBE_CACHE_MAX_SIZE  (16 * 1024 * 1024)
+
+enum ProbeCacheType {
+    FIELD_INT,
+    FIELD_INT64,
+    FIELD_UINT64,
+    FIELD_RATIONAL,
+};
+
+typedef struct ProbeCacheField {
+    const char *name;
+    int offset;
+    enum ProbeCacheType type;
+} ProbeCacheField;
+
+#define PAR(x, t) { #x, offsetof(AVCodecParameters, x), t }
+static const ProbeCacheField par_fields[] = {
+    PAR(codec_type,            FIELD_INT),
+    PAR(codec_id,              FIELD_INT),
+    PAR(codec_tag,             FIELD_INT),
+    PAR(format,                FIELD_INT),
+    PAR(bit_rate,              FIELD_INT64),
+    PAR(bits_per_coded_sample, FIELD_INT),
+    PAR(bits_per_raw_sample,   FIELD_INT),
+    PAR(profile,               FIELD_INT),
+    PAR(level,                 FIELD_INT),
+    PAR(width,                 FIELD_INT),
+    PAR(height,                FIELD_INT),
+    PAR(sample_aspect_ratio,   FIELD_RATIONAL),
+    PAR(field_order,           FIELD_INT),
+    PAR(color_range,           FIELD_INT),
+    PAR(color_primaries,       FIELD_INT),
+    PAR(color_trc,             FIELD_INT),
+    PAR(color_space,           FIELD_INT),
+    PAR(chroma_location,       FIELD_INT),
+    PAR(video_delay,           FIELD_INT),
+    PAR(channel_layout,        FIELD_UINT64),
+    PAR(channels,              FIELD_INT),
+    PAR(sample_rate,           FIELD_INT),
+    PAR(block_align,           FIELD_INT),
+    PAR(frame_size,            FIELD_INT),
+    PAR(initial_padding,       FIELD_INT),
+    PAR(trailing_padding,      FIELD_INT),
+    PAR(seek_preroll,          FIELD_INT),
+};
+
+#define ST(x, t) { #x, offsetof(AVStream, x), t }
+static const ProbeCacheField stream_fields[] = {
+    ST(start_time,           FIELD_INT64),
+    ST(first_dts,            FIELD_INT64),
+    ST(duration,             FIELD_INT64),
+    ST(nb_frames,            FIELD_INT64),
+    ST(disposition,          FIELD_INT),
+    ST(sample_aspect_ratio,  FIELD_RATIONAL),
+    ST(avg_frame_rate,       FIELD_RATIONAL),
+    ST(r_frame_rate,         FIELD_RATIONAL),
+    ST(codec_info_nb_frames, FIELD_INT),
+};
+
+/* codec context fields used for the packet timing while demuxing */
+#define AVCTX(x, t) { #x, offsetof(AVCodecContext, x), t }
+static const ProbeCacheField avctx_fields[] = {
+    AVCTX(time_base,       FIELD_RATIONAL),
+    AVCTX(ticks_per_frame, FIELD_INT),
+    AVCTX(framerate,       FIELD_RATIONAL),
+};
+
+#define FMT(x, t) { #x, offsetof(AVFormatContext, x), t }
+static const ProbeCacheField format_fields[] = {
+    FMT(start_time,                 FIELD_INT64),
+    FMT(duration,                   FIELD_INT64),
+    FMT(bit_rate,                   FIELD_INT64),
+    FMT(duration_estimation_method, FIELD_INT),
+};
+
+static void write_fields(AVBPrint *bp, const char *prefix, const void *obj,
+                         const ProbeCacheField *fields, int nb_fields)
+{
+    int i;
+
+    for (i = 0; i < nb_fields; i++) {
+        const uint8_t *p = (const uint8_t *)obj + fields[i].offset;
+
+        av_bprintf(bp, "%s%s=", prefix, fields[i].name);
+        switch (fields[i].type) {
+        case FIELD_INT:
+            av_bprintf(bp, "%d", *(const int *)p);
+            break;
+        case FIELD_INT64:
+            av_bprintf(bp, "%"PRId64, *(const int64_t *)p);
+            break;
+        case FIELD_UINT64:
+            av_bprintf(bp, "%"PRIu64, *(const uint64_t *)p);
+            break;
+        case FIELD_RATIONAL:
+            av_bprintf(bp, "%d/%d", ((const AVRational *)p)->num,
+                       ((const AVRational *)p)->den);
+            break;
+        }
+        av_bprintf(bp, "\n");
+    }
+}
+
+/**
+ * Parse the fields into obj, or only check that they are present and valid
+ * if obj is NULL.
+ */
+static int read_fields(AVDictionary *dict, const char *prefix, void *obj,
+                       const ProbeCacheField *fields, int nb_fields)
+{
+    union {
+        int i;
+        int64_t i64;
+        uint64_t u64;
+        AVRational q;
+    } tmp;
+    int i;
+
+    for (i = 0; i < nb_fields; i++) {
+        uint8_t *p = obj ? (uint8_t *)obj + fields[i].offset : (uint8_t *)&tmp;
+        char key[64];
+        AVDictionaryEntry *e;
+        int ret = 0;
+
+        snprintf(key, sizeof(key), "%s%s", prefix, fields[i].name);
+        if (!(e = av_dict_get(dict, key, NULL, 0)))
+            return AVERROR_INVALIDDATA;
+        switch (fields[i].type) {
+        case FIELD_INT:
+            ret = sscanf(e->value, "%d", (int *)p);
+            break;
+        case FIELD_INT64:
+            ret = sscanf(e->value, "%"SCNd64, (int64_t *)p);
+            break;
+        case FIELD_UINT64:
+            ret = sscanf(e->value, "%"SCNu64, (uint64_t *)p);
+            break;
+        case FIELD_RATIONAL:
+            ret = sscanf(e->value, "%d/%d", &((AVRational *)p)->num,
+                         &((AVRational *)p)->den) == 2;
+            break;
+        }
+        if (ret != 1)
+            return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static const char *get_value(AVDictionary *dict, const char *prefix, const char *name)
+{
+    char key[64];
+    AVDictionaryEntry *e;
+
+    snprintf(key, sizeof(key), "%s%s", prefix, name);
+    e = av_dict_get(dict, key, NULL, 0);
+    return e ? e->value : NULL;
+}
+
+/* The values are written verbatim, so URLs need no escaping. */
+static int parse_entry(AVDictionary **dict, char *str)
+{
+    char *line, *next, *sep;
+    int ret;
+
+    for (line = str; *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = 0;
+        else
+            next = line + strlen(line);
+        if (!(sep = strchr(line, '=')))
+            return AVERROR_INVALIDDATA;
+        *sep = 0;
+        if ((ret = av_dict_set(dict, line, sep + 1, 0)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int ff_probe_cache_path(AVFormatContext *s, char *path, int path_size)
+{
+    AVIOContext *pb = s->pb;
+    struct AVMD5 *md5;
+    uint8_t *buf, digest[16];
+    char hex[33];
+    int64_t pos, size;
+    int i, ret;
+
+    if (!pb || !(pb->seekable & AVIO_SEEKABLE_NORMAL) || !s->url ||
+        strchr(s->url, '\n'))
+        return AVERROR(ENOSYS);
+    if ((size = avio_size(pb)) <= 0)
+        return AVERROR(ENOSYS);
+
+    buf = av_malloc(PROBE_CACHE_HEAD_SIZE);
+    md5 = av_md5_alloc();
+    if (!buf || !md5) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    pos = avio_tell(pb);
+    if ((ret = avio_seek(pb, 0, SEEK_SET)) < 0)
+        goto end;
+    ret = avio_read(pb, buf, PROBE_CACHE_HEAD_SIZE);
+    if (avio_seek(pb, pos, SEEK_SET) < 0)
+        ret = AVERROR(EIO);
+    if (ret < 0)
+        goto end;
+
+    av_md5_init(md5);
+    av_md5_update(md5, s->url, strlen(s->url) + 1);
+    av_md5_update(md5, (const uint8_t *)&size, sizeof(size));
+    av_md5_update(md5, buf, ret);
+    av_md5_update(md5, s->iformat->name, strlen(s->iformat->name) + 1);
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        int header[] = { st->id, st->codecpar->codec_type, st->codecpar->codec_id,
+                         st->time_base.num, st->time_base.den };
+
+        av_md5_update(md5, (const uint8_t *)header, sizeof(header));
+        if (st->codecpar->extradata)
+            av_md5_update(md5, st->codecpar->extradata, st->codecpar->extradata_size);
+    }
+    av_md5_final(md5, digest);
+    ff_data_to_hex(hex, digest, sizeof(digest), 1);
+    hex[32] = 0;
+
+    snprintf(path, path_size, "%s/%s.probe", s->probe_cache, hex);
+    ret = 0;
+end:
+    av_free(md5);
+    av_free(buf);
+    return ret;
+}
+
+/* only a hash of the URL is stored, as it may contain credentials */
+static void url_hash(const char *url, char *hex)
+{
+    uint8_t digest[16];
+
+    av_md5_sum(digest, url, strlen(url));
+    ff_data_to_hex(hex, digest, sizeof(digest), 1);
+    hex[32] = 0;
+}
+
+/* the fields of each structure are kept apart, as some share their name */
+static void stream_prefixes(int index, char *prefix, char *par_prefix,
+                            char *st_prefix, char *avctx_prefix)
+{
+    snprintf(prefix,       32, "%d.",       index);
+    snprintf(par_prefix,   32, "%d.par.",   index);
+    snprintf(st_prefix,    32, "%d.st.",    index);
+    snprintf(avctx_prefix, 32, "%d.avctx.", index);
+}
+
+static int check_stream(AVDictionary *dict, int index, AVStream *st)
+{
+    char prefix[32], par_prefix[32], st_prefix[32], avctx_prefix[32];
+    const char *value, *extradata;
+
+    stream_prefixes(index, prefix, par_prefix, st_prefix, avctx_prefix);
+    if (read_fields(dict, par_prefix, NULL, par_fields, FF_ARRAY_ELEMS(par_fields)) < 0 ||
+        read_fields(dict, st_prefix, NULL, stream_fields, FF_ARRAY_ELEMS(stream_fields)) < 0 ||
+        read_fields(dict, avctx_prefix, NULL, avctx_fields, FF_ARRAY_ELEMS(avctx_fields)) < 0 ||
+        !(value = get_value(dict, prefix, "id")) || atoi(value) != st->id ||
+        !(extradata = get_value(dict, prefix, "extradata")) ||
+        strlen(extradata) & 1 || strspn(extradata, "0123456789abcdef") != strlen(extradata))
+        return AVERROR_INVALIDDATA;
+
+    return 0;
+}
+
+static int apply_stream(AVDictionary *dict, int index, AVStream *st)
+{
+    AVCodecParameters *par = st->codecpar;
+    AVCodecContext *avctx = st->internal->avctx;
+    char prefix[32], par_prefix[32], st_prefix[32], avctx_prefix[32];
+    const char *extradata;
+    int extradata_size, ret;
+
+    stream_prefixes(index, prefix, par_prefix, st_prefix, avctx_prefix);
+    extradata      = get_value(dict, prefix, "extradata");
+    extradata_size = strlen(extradata) / 2;
+
+    read_fields(dict, par_prefix, par, par_fields, FF_ARRAY_ELEMS(par_fields));
+    read_fields(dict, st_prefix, st, stream_fields, FF_ARRAY_ELEMS(stream_fields));
+    if (st->first_dts != AV_NOPTS_VALUE)
+        st->cur_dts = st->first_dts;
+
+    av_freep(&par->extradata);
+    par->extradata_size = 0;
+    if (extradata_size) {
+        par->extradata = av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!par->extradata)
+            return AVERROR(ENOMEM);
+        par->extradata_size = ff_hex_to_data(par->extradata, extradata);
+    }
+
+    if ((ret = avcodec_parameters_to_context(avctx, par)) < 0)
+        return ret;
+    read_fields(dict, avctx_prefix, avctx, avctx_fields, FF_ARRAY_ELEMS(avctx_fields));
+    st->internal->orig_codec_id = par->codec_id;
+    if (st->request_probe > 0)
+        st->request_probe = -1;
+
+#if FF_API_LAVF_AVCTX
+FF_DISABLE_DEPRECATION_WARNINGS
+    if ((ret = avcodec_parameters_to_context(st->codec, par)) < 0)
+        return ret;
+    if (st->codec->codec_tag != MKTAG('t','m','c','d')) {
+        st->codec->time_base = avctx->time_base;
+        st->codec->ticks_per_frame = avctx->ticks_per_frame;
+    }
+    st->codec->framerate = st->avg_frame_rate;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+
+    return 0;
+}
+
+int ff_probe_cache_load(AVFormatContext *s, const char *path)
+{
+    AVIOContext *pb = NULL;
+    AVDictionary *dict = NULL;
+    AVBPrint bp;
+    const char *value;
+    char hex[33];
+    int i, ret;
+
+    av_bprint_init(&bp, 0, PROBE_CACHE_MAX_SIZE);
+    if ((ret = s->io_open(s, &pb, path, AVIO_FLAG_READ, NULL)) < 0) {
+        av_log(s, AV_LOG_DEBUG, "No probe cache entry %s\n", path);
+        goto end;
+    }
+    ret = avio_read_to_bprint(pb, &bp, PROBE_CACHE_MAX_SIZE);
+    ff_format_io_close(s, &pb);
+    if (ret < 0)
+        goto end;
+    if (!av_bprint_is_complete(&bp)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = parse_entry(&dict, bp.str)) < 0)
+        goto mismatch;
+
+    /* Check everything first, so that a bad entry leaves the streams as the
+     * demuxer set them up. */
+    ret = AVERROR_INVALIDDATA;
+    url_hash(s->url, hex);
+    if (!(value = get_value(dict, "", "version"))    || atoi(value) != PROBE_CACHE_VERSION ||
+        !(value = get_value(dict, "", "url_md5"))    || strcmp(value, hex) ||
+        !(value = get_value(dict, "", "size"))       || strtoll(value, NULL, 10) != avio_size(s->pb) ||
+        !(value = get_value(dict, "", "format"))     || strcmp(value, s->iformat->name) ||
+        !(value = get_value(dict, "", "nb_streams")) || atoi(value) != s->nb_streams ||
+        read_fields(dict, "", NULL, format_fields, FF_ARRAY_ELEMS(format_fields)) < 0)
+        goto mismatch;
+    for (i = 0; i < s->nb_streams; i++)
+        if (check_stream(dict, i, s->streams[i]) < 0)
+            goto mismatch;
+
+    for (i = 0; i < s->nb_streams; i++)
+        if ((ret = apply_stream(dict, i, s->streams[i])) < 0)
+            goto end;
+    read_fields(dict, "", s, format_fields, FF_ARRAY_ELEMS(format_fields));
+
+    av_log(s, AV_LOG_VERBOSE, "Using the stream parameters from the probe cache entry %s\n", path);
+    ret = 1;
+    goto end;
+
+mismatch:
+    av_log(s, AV_LOG_WARNING, "Ignoring the invalid probe cache entry %s\n", path);
+end:
+    av_dict_free(&dict);
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
+
+int ff_probe_cache_store(AVFormatContext *s, const char *path)
+{
+    AVIOContext *pb = NULL;
+    AVBPrint bp;
+    char tmp[1040], hex[33];
+    char prefix[32], par_prefix[32], st_prefix[32], avctx_prefix[32];
+    int i, j, ret;
+
+    url_hash(s->url, hex);
+    av_bprint_init(&bp, 0, PROBE_CACHE_MAX_SIZE);
+    av_bprintf(&bp, "version=%d\n", PROBE_CACHE_VERSION);
+    av_bprintf(&bp, "url_md5=%s\n", hex);
+    av_bprintf(&bp, "size=%"PRId64"\n", avio_size(s->pb));
+    av_bprintf(&bp, "format=%s\n", s->iformat->name);
+    av_bprintf(&bp, "nb_streams=%d\n", s->nb_streams);
+    write_fields(&bp, "", s, format_fields, FF_ARRAY_ELEMS(format_fields));
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+
+        stream_prefixes(i, prefix, par_prefix, st_prefix, avctx_prefix);
+        av_bprintf(&bp, "%sid=%d\n", prefix, st->id);
+        write_fields(&bp, par_prefix, st->codecpar, par_fields, FF_ARRAY_ELEMS(par_fields));
+        write_fields(&bp, st_prefix, st, stream_fields, FF_ARRAY_ELEMS(stream_fields));
+        write_fields(&bp, avctx_prefix, st->internal->avctx, avctx_fields, FF_ARRAY_ELEMS(avctx_fields));
+        av_bprintf(&bp, "%sextradata=", prefix);
+        for (j = 0; j < st->codecpar->extradata_size; j++)
+            av_bprintf(&bp, "%02x", st->codecpar->extradata[j]);
+        av_bprintf(&bp, "\n");
+    }
+    if (!av_bprint_is_complete(&bp)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* write to a temporary file first so that readers never see a partial
+     * entry, with a name of its own as other processes may be storing the
+     * same entry */
+    snprintf(tmp, sizeof(tmp), "%s.%08"PRIx32".tmp", path, av_get_random_seed());
+    if ((ret = s->io_open(s, &pb, tmp, AVIO_FLAG_WRITE, NULL)) < 0) {
+        av_log(s, AV_LOG_WARNING, "Could not create the probe cache entry %s\n", tmp);
+        goto end;
+    }
+    avio_write(pb, bp.str, bp.len);
+    avio_flush(pb);
+    ret = pb->error;
+    ff_format_io_close(s, &pb);
+    if (ret >= 0)
+        ret = ff_rename(tmp, path, s);
+    else
+        av_log(s, AV_LOG_WARNING, "Could not write the probe cache entry %s\n", tmp);
+    if (ret < 0)
+        avpriv_io_delete(tmp);
+end:
+    av_bprint_finalize(&bp, NULL);
+    return ret;
+}
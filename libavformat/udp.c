@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() and sendmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -63,6 +64,22 @@
 
 #if HAVE_PTHREAD_CANCEL
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#endif
+
+#if HAVE_PRCTL
+#include <sys/prctl.h>
+#endif
+
+#if HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+
+#if HAVE_LINUX_NET_TSTAMP_H && defined(SO_TXTIME) && defined(CLOCK_TAI)
+#define HAVE_TXTIME 1
+#else
+#define HAVE_TXTIME 0
 #endif
 
 #ifndef IPV6_ADD_MEMBERSHIP
@@ -73,6 +90,13 @@
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_DEFAULT_RX_BATCH 16
+/* length and arrival time stored before each datagram in the receive ring */
+#define UDP_RING_HEADER_SIZE 12
+
+#if HAVE_RECVMMSG
+#define UDP_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))
+#endif
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -89,6 +113,9 @@ typedef struct UDPContext {
     struct sockaddr_storage dest_addr;
     int dest_addr_len;
     int is_connected;
+    int batch_size;
+    int timestamps;
+    int64_t arrival_time;
 
     /* Circular Buffer variables for use in UDP receive code */
     int circular_buffer_size;
@@ -96,12 +123,35 @@ typedef struct UDPContext {
     int circular_buffer_error;
     int64_t bitrate; /* number of bits to send per second */
     int64_t burst_bits;
+    int pcr_pacing;
+    int txtime;
     int close_req;
 #if HAVE_PTHREAD_CANCEL
     pthread_t circular_buffer_thread;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int thread_started;
+
+    /* single producer, single consumer ring between the receive thread
+     * and udp_read(), the mutex is only taken to wait for data */
+    uint8_t *ring;
+    size_t ring_size;
+    atomic_size_t ring_head;
+    atomic_size_t ring_tail;
+    atomic_int reader_waiting;
+#endif
+#if HAVE_RECVMMSG
+    struct mmsghdr *rx_msgs;
+    struct iovec *rx_iov;
+    struct sockaddr_storage *rx_addr;
+    uint8_t *rx_control;
+    uint8_t *rx_buf;
+#endif
+#if HAVE_SENDMMSG
+    struct mmsghdr *tx_msgs;
+    struct iovec *tx_iov;
+    uint8_t *tx_buf;
+    int tx_count;
 #endif
     uint8_t tmp[UDP_MAX_PKT_SIZE+4];
     int remaining_in_dg;
@@ -120,6 +170,8 @@ static const AVOption options[] = {
     { "buffer_size",    "System data size (in bytes)",                     OFFSET(buffer_size),    AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "bitrate",        "Bits to send per second",                         OFFSET(bitrate),        AV_OPT_TYPE_INT64,  { .i64 = 0  },     0, INT64_MAX, .flags = E },
     { "burst_bits",     "Max length of bursts in bits (when using bitrate)", OFFSET(burst_bits),   AV_OPT_TYPE_INT64,  { .i64 = 0  },     0, INT64_MAX, .flags = E },
+    { "pcr_pacing",     "Send MPEG-TS datagrams at the time given by their PCR", OFFSET(pcr_pacing), AV_OPT_TYPE_BOOL,   { .i64 = 0  },     0, 1,       E },
+    { "txtime",         "Hand datagrams to the kernel this many microseconds before their send time (SO_TXTIME)", OFFSET(txtime), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1000000, E },
     { "localport",      "Local port",                                      OFFSET(local_port),     AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, D|E },
     { "local_port",     "Local port",                                      OFFSET(local_port),     AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "localaddr",      "Local address",                                   OFFSET(localaddr),      AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -135,6 +187,9 @@ static const AVOption options[] = {
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
+    { "batch_size",     "Number of datagrams received or sent per system call", OFFSET(batch_size), AV_OPT_TYPE_INT,   { .i64 = -1 },    -1, 1024,    D|E },
+    { "timestamps",     "Export the arrival time of the received datagrams", OFFSET(timestamps),    AV_OPT_TYPE_BOOL,   { .i64 = 0 },      0, 1,       D },
+    { "arrival_time",   "Arrival time of the last datagram read",          OFFSET(arrival_time),   AV_OPT_TYPE_INT64,  { .i64 = AV_NOPTS_VALUE }, INT64_MIN, INT64_MAX, D|AV_OPT_FLAG_EXPORT|AV_OPT_FLAG_READONLY },
     { NULL }
 };
 
@@ -453,78 +508,444 @@ static int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
+#if HAVE_RECVMMSG
+static int64_t udp_arrival_time(struct msghdr *msg)
+{
+#ifdef SCM_TIMESTAMPNS
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return ts.tv_sec * INT64_C(1000000) + ts.tv_nsec / 1000;
+        }
+    }
+#endif
+    return av_gettime();
+}
+
+static int udp_alloc_rx_batch(UDPContext *s)
+{
+    int i;
+
+    s->rx_msgs = av_mallocz_array(s->batch_size, sizeof(*s->rx_msgs));
+    s->rx_iov  = av_malloc_array(s->batch_size, sizeof(*s->rx_iov));
+    s->rx_addr = av_malloc_array(s->batch_size, sizeof(*s->rx_addr));
+    s->rx_buf  = av_malloc_array(s->batch_size, UDP_MAX_PKT_SIZE);
+    if (s->timestamps)
+        s->rx_control = av_malloc_array(s->batch_size, UDP_CONTROL_SIZE);
+    if (!s->rx_msgs || !s->rx_iov || !s->rx_addr || !s->rx_buf ||
+        (s->timestamps && !s->rx_control))
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < s->batch_size; i++) {
+        struct msghdr *msg = &s->rx_msgs[i].msg_hdr;
+
+        s->rx_iov[i].iov_base = s->rx_buf + i * UDP_MAX_PKT_SIZE;
+        s->rx_iov[i].iov_len  = UDP_MAX_PKT_SIZE;
+        msg->msg_name    = &s->rx_addr[i];
+        msg->msg_iov     = &s->rx_iov[i];
+        msg->msg_iovlen  = 1;
+        msg->msg_control = s->rx_control ? s->rx_control + i * UDP_CONTROL_SIZE : NULL;
+    }
+    return 0;
+}
+#endif
+
+#if HAVE_SENDMMSG
+static int udp_alloc_tx_batch(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+    int i;
+
+    s->tx_msgs = av_mallocz_array(s->batch_size, sizeof(*s->tx_msgs));
+    s->tx_iov  = av_malloc_array(s->batch_size, sizeof(*s->tx_iov));
+    s->tx_buf  = av_malloc_array(s->batch_size, h->max_packet_size);
+    if (!s->tx_msgs || !s->tx_iov || !s->tx_buf)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < s->batch_size; i++) {
+        s->tx_iov[i].iov_base = s->tx_buf + i * h->max_packet_size;
+        s->tx_msgs[i].msg_hdr.msg_iov    = &s->tx_iov[i];
+        s->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+static int udp_flush_tx_batch(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+    int i, sent = 0, ret = 0;
+
+    for (i = 0; i < s->tx_count; i++) {
+        struct msghdr *msg = &s->tx_msgs[i].msg_hdr;
+        msg->msg_name    = s->is_connected ? NULL : &s->dest_addr;
+        msg->msg_namelen = s->is_connected ? 0    : s->dest_addr_len;
+    }
+
+    while (sent < s->tx_count) {
+        ret = sendmmsg(s->udp_fd, s->tx_msgs + sent, s->tx_count - sent, 0);
+        if (ret >= 0) {
+            sent += ret;
+            continue;
+        }
+        ret = ff_neterrno();
+        if (ret == AVERROR(EAGAIN))
+            ret = ff_network_wait_fd(s->udp_fd, 1);
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+            break;
+        ret = 0;
+    }
+    s->tx_count = 0;
+    return ret;
+}
+#endif
+
+static void udp_free_batches(UDPContext *s)
+{
+#if HAVE_RECVMMSG
+    av_freep(&s->rx_msgs);
+    av_freep(&s->rx_iov);
+    av_freep(&s->rx_addr);
+    av_freep(&s->rx_control);
+    av_freep(&s->rx_buf);
+#endif
+#if HAVE_SENDMMSG
+    av_freep(&s->tx_msgs);
+    av_freep(&s->tx_iov);
+    av_freep(&s->tx_buf);
+#endif
+}
+
 #if HAVE_PTHREAD_CANCEL
+static void ring_copy_in(UDPContext *s, size_t pos, const uint8_t *src, int len)
+{
+    size_t offset = pos & (s->ring_size - 1);
+    int n = FFMIN(len, s->ring_size - offset);
+
+    memcpy(s->ring + offset, src, n);
+    memcpy(s->ring, src + n, len - n);
+}
+
+static void ring_copy_out(UDPContext *s, size_t pos, uint8_t *dst, int len)
+{
+    size_t offset = pos & (s->ring_size - 1);
+    int n = FFMIN(len, s->ring_size - offset);
+
+    memcpy(dst, s->ring + offset, n);
+    memcpy(dst + n, s->ring, len - n);
+}
+
+/* called by the receive thread only, the datagram becomes visible to the
+ * reader when ring_tail is updated */
+static int ring_put(URLContext *h, size_t *tail, const uint8_t *data, int len,
+                    struct sockaddr_storage *addr, int64_t time)
+{
+    UDPContext *s = h->priv_data;
+    uint8_t hdr[UDP_RING_HEADER_SIZE];
+    size_t head;
+
+    if (ff_ip_check_source_lists(addr, &s->filters))
+        return 0;
+
+    head = atomic_load_explicit(&s->ring_head, memory_order_acquire);
+    if (s->ring_size - (*tail - head) < len + UDP_RING_HEADER_SIZE) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            return AVERROR(EIO);
+        }
+    }
+
+    AV_WL32(hdr,     len);
+    AV_WL64(hdr + 4, time);
+    ring_copy_in(s, *tail, hdr, sizeof(hdr));
+    ring_copy_in(s, *tail + sizeof(hdr), data, len);
+    *tail += sizeof(hdr) + len;
+    return 0;
+}
+
+/* called by the reader only, returns AVERROR(EAGAIN) if the ring is empty */
+static int ring_get(URLContext *h, uint8_t *buf, int size)
+{
+    UDPContext *s = h->priv_data;
+    size_t head = atomic_load_explicit(&s->ring_head, memory_order_relaxed);
+    uint8_t hdr[UDP_RING_HEADER_SIZE];
+    int len, avail;
+
+    if (head == atomic_load_explicit(&s->ring_tail, memory_order_acquire))
+        return AVERROR(EAGAIN);
+
+    ring_copy_out(s, head, hdr, sizeof(hdr));
+    avail = len = AV_RL32(hdr);
+    if (avail > size) {
+        av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
+        avail = size;
+    }
+    ring_copy_out(s, head + sizeof(hdr), buf, avail);
+    s->arrival_time = AV_RL64(hdr + 4);
+
+    atomic_store_explicit(&s->ring_head, head + sizeof(hdr) + len, memory_order_release);
+    return avail;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
     UDPContext *s = h->priv_data;
-    int old_cancelstate;
+    int old_cancelstate, ret = 0;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-    pthread_mutex_lock(&s->mutex);
     if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
         av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
-        s->circular_buffer_error = AVERROR(EIO);
+        ret = AVERROR(EIO);
         goto end;
     }
-    while(1) {
-        int len;
+    while (!ret) {
+        size_t tail = atomic_load_explicit(&s->ring_tail, memory_order_relaxed);
+        int n;
+#if HAVE_RECVMMSG
+        int i;
+
+        for (i = 0; i < s->batch_size; i++) {
+            s->rx_msgs[i].msg_hdr.msg_namelen    = sizeof(*s->rx_addr);
+            s->rx_msgs[i].msg_hdr.msg_controllen = s->rx_control ? UDP_CONTROL_SIZE : 0;
+        }
+#else
         struct sockaddr_storage addr;
         socklen_t addr_len = sizeof(addr);
+#endif
 
-        pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
+#if HAVE_RECVMMSG
+        n = recvmmsg(s->udp_fd, s->rx_msgs, s->batch_size, MSG_WAITFORONE, NULL);
+#else
+        n = recvfrom(s->udp_fd, s->tmp, sizeof(s->tmp), 0, (struct sockaddr *)&addr, &addr_len);
+#endif
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-        pthread_mutex_lock(&s->mutex);
-        if (len < 0) {
-            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
-                s->circular_buffer_error = ff_neterrno();
-                goto end;
-            }
+        if (n < 0) {
+            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR))
+                ret = ff_neterrno();
             continue;
         }
-        if (ff_ip_check_source_lists(&addr, &s->filters))
-            continue;
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
-            }
+
+#if HAVE_RECVMMSG
+        for (i = 0; i < n && !ret; i++) {
+            struct msghdr *msg = &s->rx_msgs[i].msg_hdr;
+            ret = ring_put(h, &tail, msg->msg_iov->iov_base, s->rx_msgs[i].msg_len,
+                           msg->msg_name, s->timestamps ? udp_arrival_time(msg) : AV_NOPTS_VALUE);
+        }
+#else
+        ret = ring_put(h, &tail, s->tmp, n, &addr, s->timestamps ? av_gettime() : AV_NOPTS_VALUE);
+#endif
+
+        /* publish the whole batch at once, the reader only needs to be
+         * woken up if it is waiting for data */
+        atomic_store(&s->ring_tail, tail);
+        if (atomic_load(&s->reader_waiting)) {
+            pthread_mutex_lock(&s->mutex);
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
-        pthread_cond_signal(&s->cond);
     }
 
 end:
+    pthread_mutex_lock(&s->mutex);
+    s->circular_buffer_error = ret;
     pthread_cond_signal(&s->cond);
     pthread_mutex_unlock(&s->mutex);
     return NULL;
 }
 
+#define PCR_MAX         ((INT64_C(1) << 33) * 300)
+#define PCR_FREQ        27000000
+/* a PCR further than this from the previous one is a discontinuity */
+#define PCR_MAX_GAP     PCR_FREQ
+/* rebase the schedule rather than catching up in a burst */
+#define PACER_MAX_LATE  100000
+
+typedef struct UDPPacer {
+    /* bitrate pacing */
+    int64_t start_timestamp;
+    int64_t sent_bits;
+    int64_t burst_interval;
+    int64_t max_delay;
+
+    /* PCR pacing, all the times are in microseconds */
+    int64_t pcr_base;       /* PCR mapped to base_time */
+    int64_t base_time;
+    int64_t last_pcr;
+    int64_t last_pcr_time;  /* send time of the last datagram carrying a PCR */
+    int64_t bytes;          /* bytes sent since that datagram */
+    int64_t rate_bytes;     /* bytes and duration between the last two PCRs */
+    int64_t rate_time;
+} UDPPacer;
+
+/* return the PCR of the first packet carrying one if the datagram consists of
+ * MPEG-TS packets, AV_NOPTS_VALUE otherwise */
+static int64_t udp_find_pcr(const uint8_t *buf, int len)
+{
+    int i;
+
+    if (len % 188)
+        return AV_NOPTS_VALUE;
+    for (i = 0; i < len; i += 188) {
+        const uint8_t *p = buf + i;
+        if (p[0] != 0x47)
+            return AV_NOPTS_VALUE;
+        /* adaptation field with the PCR flag */
+        if ((p[3] & 0x20) && p[4] >= 7 && (p[5] & 0x10)) {
+            int64_t base = (int64_t)AV_RB32(p + 6) << 1 | p[10] >> 7;
+            return base * 300 + ((p[10] & 1) << 8 | p[11]);
+        }
+    }
+    return AV_NOPTS_VALUE;
+}
+
+/* return the time at which a datagram should be sent */
+static int64_t pacer_bitrate_time(UDPContext *s, UDPPacer *p, int len, int64_t now)
+{
+    int64_t target = p->start_timestamp + p->sent_bits * 1000000 / s->bitrate;
+
+    if (target - now > p->max_delay) {
+        target = now + p->max_delay;
+        p->start_timestamp = target;
+        p->sent_bits = 0;
+    } else if (now - p->burst_interval > target) {
+        p->start_timestamp = now - p->burst_interval;
+        p->sent_bits = 0;
+    }
+    p->sent_bits += len * 8;
+    return target;
+}
+
+static int64_t pacer_pcr_time(UDPContext *s, UDPPacer *p, const uint8_t *buf,
+                              int len, int64_t now)
+{
+    int64_t pcr = udp_find_pcr(buf, len);
+    int64_t t   = AV_NOPTS_VALUE;
+
+    /* extrapolate from the last PCR with the rate between the last two */
+    if (p->last_pcr_time != AV_NOPTS_VALUE && p->rate_bytes > 0)
+        t = p->last_pcr_time + p->bytes * p->rate_time / p->rate_bytes;
+    else if (s->bitrate)
+        t = pacer_bitrate_time(s, p, len, now);
+
+    if (pcr != AV_NOPTS_VALUE) {
+        if (p->last_pcr == AV_NOPTS_VALUE ||
+            (pcr - p->last_pcr + PCR_MAX) % PCR_MAX > PCR_MAX_GAP) {
+            p->pcr_base  = pcr;
+            p->base_time = t != AV_NOPTS_VALUE ? t : now;
+            p->rate_bytes = 0;
+        }
+        t = p->base_time + (pcr - p->pcr_base + PCR_MAX) % PCR_MAX / (PCR_FREQ / 1000000);
+        if (p->last_pcr_time != AV_NOPTS_VALUE && t > p->last_pcr_time && p->bytes) {
+            p->rate_bytes = p->bytes;
+            p->rate_time  = t - p->last_pcr_time;
+        }
+        p->last_pcr      = pcr;
+        p->last_pcr_time = t;
+        p->bytes         = 0;
+    }
+    p->bytes += len;
+
+    if (t == AV_NOPTS_VALUE)
+        return now;
+    /* keep the schedule close to the wallclock when the input stalls or
+     * the timestamps jump, instead of sending a burst or waiting forever */
+    if (now - t > PACER_MAX_LATE || t - now > PCR_MAX_GAP / (PCR_FREQ / 1000000)) {
+        int64_t shift = now - t;
+        p->base_time     += shift;
+        p->last_pcr_time += shift;
+        t = now;
+    }
+    return t;
+}
+
+static void udp_wait_until(int64_t deadline)
+{
+#if HAVE_CLOCK_NANOSLEEP && defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
+    /* same clock as av_gettime_relative(), absolute deadlines do not drift */
+    struct timespec ts = { .tv_sec  =  deadline / 1000000,
+                           .tv_nsec = (deadline % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+    int64_t delay = deadline - av_gettime_relative();
+    if (delay > 0)
+        av_usleep(delay);
+#endif
+}
+
+static int udp_send_datagram(UDPContext *s, const uint8_t *p, int len, int64_t txtime)
+{
+    while (len) {
+        int ret;
+        av_assert0(len > 0);
+#if HAVE_TXTIME
+        if (txtime != AV_NOPTS_VALUE) {
+            uint8_t control[CMSG_SPACE(sizeof(uint64_t))] = { 0 };
+            struct iovec iov = { .iov_base = (uint8_t *)p, .iov_len = len };
+            struct msghdr msg = {
+                .msg_name       = s->is_connected ? NULL : &s->dest_addr,
+                .msg_namelen    = s->is_connected ? 0    : s->dest_addr_len,
+                .msg_iov        = &iov,
+                .msg_iovlen     = 1,
+                .msg_control    = control,
+                .msg_controllen = sizeof(control),
+            };
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            uint64_t ns = txtime;
+
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type  = SCM_TXTIME;
+            cmsg->cmsg_len   = CMSG_LEN(sizeof(ns));
+            memcpy(CMSG_DATA(cmsg), &ns, sizeof(ns));
+            ret = sendmsg(s->udp_fd, &msg, 0);
+        } else
+#endif
+        if (!s->is_connected) {
+            ret = sendto (s->udp_fd, p, len, 0,
+                        (struct sockaddr *) &s->dest_addr,
+                        s->dest_addr_len);
+        } else
+            ret = send(s->udp_fd, p, len, 0);
+        if (ret >= 0) {
+            len -= ret;
+            p   += ret;
+        } else {
+            ret = ff_neterrno();
+            if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                return ret;
+        }
+    }
+    return 0;
+}
+
 static void *circular_buffer_task_tx( void *_URLContext)
 {
     URLContext *h = _URLContext;
     UDPContext *s = h->priv_data;
     int old_cancelstate;
-    int64_t target_timestamp = av_gettime_relative();
-    int64_t start_timestamp = av_gettime_relative();
-    int64_t sent_bits = 0;
-    int64_t burst_interval = s->bitrate ? (s->burst_bits * 1000000 / s->bitrate) : 0;
-    int64_t max_delay = s->bitrate ?  ((int64_t)h->max_packet_size * 8 * 1000000 / s->bitrate + 1) : 0;
+    UDPPacer pacer = {
+        .start_timestamp = av_gettime_relative(),
+        .burst_interval  = s->bitrate ? (s->burst_bits * 1000000 / s->bitrate) : 0,
+        .max_delay       = s->bitrate ?  ((int64_t)h->max_packet_size * 8 * 1000000 / s->bitrate + 1) : 0,
+        .last_pcr        = AV_NOPTS_VALUE,
+        .last_pcr_time   = AV_NOPTS_VALUE,
+    };
+#if HAVE_TXTIME
+    int64_t tai_offset = 0;
+#endif
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
     pthread_mutex_lock(&s->mutex);
@@ -535,11 +956,24 @@ static void *circular_buffer_task_tx( void *_URLContext)
         goto end;
     }
 
+#if HAVE_PRCTL && defined(PR_SET_TIMERSLACK)
+    /* the default slack of 50us would dominate the pacing jitter */
+    prctl(PR_SET_TIMERSLACK, 1);
+#endif
+#if HAVE_TXTIME
+    if (s->txtime) {
+        struct timespec mono, tai;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_TAI, &tai);
+        tai_offset = (tai.tv_sec - mono.tv_sec) * INT64_C(1000000000) +
+                     tai.tv_nsec - mono.tv_nsec;
+    }
+#endif
+
     for(;;) {
-        int len;
-        const uint8_t *p;
+        int len, ret;
         uint8_t tmp[4];
-        int64_t timestamp;
+        int64_t now, timestamp, target, txtime = AV_NOPTS_VALUE;
 
         len=av_fifo_size(s->fifo);
 
@@ -559,52 +993,36 @@ static void *circular_buffer_task_tx( void *_URLContext)
         av_assert0(len <= sizeof(s->tmp));
 
         av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+        /* udp_write() may be waiting for space */
+        pthread_cond_signal(&s->cond);
 
         pthread_mutex_unlock(&s->mutex);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
 
-        if (s->bitrate) {
-            timestamp = av_gettime_relative();
-            if (timestamp < target_timestamp) {
-                int64_t delay = target_timestamp - timestamp;
-                if (delay > max_delay) {
-                    delay = max_delay;
-                    start_timestamp = timestamp + delay;
-                    sent_bits = 0;
-                }
-                av_usleep(delay);
-            } else {
-                if (timestamp - burst_interval > target_timestamp) {
-                    start_timestamp = timestamp - burst_interval;
-                    sent_bits = 0;
-                }
-            }
-            sent_bits += len * 8;
-            target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
-        }
+        /* with SO_TXTIME, datagrams are handed over s->txtime early and
+         * scheduled as if that much time had already passed */
+        now       = av_gettime_relative();
+        timestamp = now + s->txtime;
+        if (s->pcr_pacing)
+            target = pacer_pcr_time(s, &pacer, s->tmp, len, timestamp);
+        else
+            target = pacer_bitrate_time(s, &pacer, len, timestamp);
 
-        p = s->tmp;
-        while (len) {
-            int ret;
-            av_assert0(len > 0);
-            if (!s->is_connected) {
-                ret = sendto (s->udp_fd, p, len, 0,
-                            (struct sockaddr *) &s->dest_addr,
-                            s->dest_addr_len);
-            } else
-                ret = send(s->udp_fd, p, len, 0);
-            if (ret >= 0) {
-                len -= ret;
-                p   += ret;
-            } else {
-                ret = ff_neterrno();
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
-                    pthread_mutex_lock(&s->mutex);
-                    s->circular_buffer_error = ret;
-                    pthread_mutex_unlock(&s->mutex);
-                    return NULL;
-                }
-            }
+#if HAVE_TXTIME
+        /* the kernel drops datagrams whose send time has passed */
+        if (s->txtime && target > now)
+            txtime = target * 1000 + tai_offset;
+#endif
+        if (target > timestamp)
+            udp_wait_until(target - s->txtime);
+
+        ret = udp_send_datagram(s, s->tmp, len, txtime);
+        if (ret < 0) {
+            pthread_mutex_lock(&s->mutex);
+            s->circular_buffer_error = ret;
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+            return NULL;
         }
 
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
@@ -709,6 +1127,30 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (av_find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
             s->burst_bits = strtoll(buf, NULL, 10);
         }
+        if (av_find_info_tag(buf, sizeof(buf), "pcr_pacing", p)) {
+            char *endptr = NULL;
+            s->pcr_pacing = strtol(buf, &endptr, 10);
+            /* assume if no digits were found it is a request to enable it */
+            if (buf == endptr)
+                s->pcr_pacing = 1;
+            if (!HAVE_PTHREAD_CANCEL)
+                av_log(h, AV_LOG_WARNING,
+                       "'pcr_pacing' option was set but it is not supported "
+                       "on this build (pthread support is required)\n");
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "txtime", p)) {
+            s->txtime = strtol(buf, NULL, 10);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "batch_size", p)) {
+            s->batch_size = strtol(buf, NULL, 10);
+        }
+        if (!is_output && av_find_info_tag(buf, sizeof(buf), "timestamps", p)) {
+            char *endptr = NULL;
+            s->timestamps = strtol(buf, &endptr, 10);
+            /* assume if no digits were found it is a request to enable it */
+            if (buf == endptr)
+                s->timestamps = 1;
+        }
         if (av_find_info_tag(buf, sizeof(buf), "localaddr", p)) {
             av_strlcpy(localaddr, buf, sizeof(localaddr));
         }
@@ -842,6 +1284,20 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         }
     }
 
+    if (is_output && s->txtime) {
+#if HAVE_TXTIME
+        struct sock_txtime txtime = { .clockid = CLOCK_TAI };
+        if (setsockopt(udp_fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+            ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(SO_TXTIME)");
+            s->txtime = 0;
+        }
+#else
+        av_log(h, AV_LOG_WARNING, "'txtime' option was set but SO_TXTIME "
+               "is not supported on this build\n");
+        s->txtime = 0;
+#endif
+    }
+
     if (is_output) {
         /* limit the tx buf size to limit latency */
         tmp = s->buffer_size;
@@ -864,6 +1320,17 @@ static int udp_open(URLContext *h, const char *uri, int flags)
                 av_log(h, AV_LOG_WARNING, "attempted to set receive buffer to size %d but it only ended up set as %d", s->buffer_size, tmp);
         }
 
+        if (s->timestamps) {
+#ifdef SO_TIMESTAMPNS
+            tmp = 1;
+            if (setsockopt(udp_fd, SOL_SOCKET, SO_TIMESTAMPNS, &tmp, sizeof(tmp)) < 0)
+                ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(SO_TIMESTAMPNS)");
+#else
+            av_log(h, AV_LOG_WARNING, "Kernel timestamps are not supported, "
+                   "using the time of reception\n");
+#endif
+        }
+
         /* make the socket non-blocking */
         ff_socket_nonblock(udp_fd, 1);
     }
@@ -876,23 +1343,46 @@ static int udp_open(URLContext *h, const char *uri, int flags)
 
     s->udp_fd = udp_fd;
 
+    /* by default, batch received datagrams when a receive thread is used,
+     * and send them one by one to avoid adding latency */
+    if (s->batch_size < 0)
+        s->batch_size = !is_output && s->circular_buffer_size ? UDP_DEFAULT_RX_BATCH : 1;
+
 #if HAVE_PTHREAD_CANCEL
     /*
       Create thread in case of:
       1. Input and circular_buffer_size is set
-      2. Output and bitrate and circular_buffer_size is set
+      2. Output and bitrate or pcr_pacing and circular_buffer_size is set
     */
 
-    if (is_output && s->bitrate && !s->circular_buffer_size) {
+    if (is_output && (s->bitrate || s->pcr_pacing) && !s->circular_buffer_size) {
         /* Warn user in case of 'circular_buffer_size' is not set */
-        av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
+        av_log(h, AV_LOG_WARNING,"'bitrate' or 'pcr_pacing' option was set but 'circular_buffer_size' is not, but required\n");
     }
 
-    if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
+    if ((!is_output && s->circular_buffer_size) || (is_output && (s->bitrate || s->pcr_pacing) && s->circular_buffer_size)) {
         int ret;
 
         /* start the task going */
-        s->fifo = av_fifo_alloc(s->circular_buffer_size);
+        if (is_output) {
+            s->fifo = av_fifo_alloc(s->circular_buffer_size);
+            if (!s->fifo)
+                goto fail;
+        } else {
+            s->ring_size = 1;
+            while (s->ring_size < s->circular_buffer_size)
+                s->ring_size <<= 1;
+            s->ring = av_malloc(s->ring_size);
+            if (!s->ring)
+                goto fail;
+            atomic_init(&s->ring_head, 0);
+            atomic_init(&s->ring_tail, 0);
+            atomic_init(&s->reader_waiting, 0);
+#if HAVE_RECVMMSG
+            if (udp_alloc_rx_batch(s) < 0)
+                goto fail;
+#endif
+        }
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -912,6 +1402,13 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     }
 #endif
 
+#if HAVE_SENDMMSG
+    if (is_output && !s->fifo && s->batch_size > 1) {
+        if (udp_alloc_tx_batch(h) < 0)
+            goto fail;
+    }
+#endif
+
     return 0;
 #if HAVE_PTHREAD_CANCEL
  thread_fail:
@@ -923,6 +1420,10 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_PTHREAD_CANCEL
+    av_freep(&s->ring);
+#endif
+    udp_free_batches(s);
     ff_ip_reset_filters(&s->filters);
     return AVERROR(EIO);
 }
@@ -943,48 +1444,39 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
     int ret;
     struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
+    int64_t arrival_time = AV_NOPTS_VALUE;
 #if HAVE_PTHREAD_CANCEL
-    int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
+    int nonblock = h->flags & AVIO_FLAG_NONBLOCK;
 
-    if (s->fifo) {
-        pthread_mutex_lock(&s->mutex);
+    if (s->ring) {
         do {
-            avail = av_fifo_size(s->fifo);
-            if (avail) { // >=size) {
-                uint8_t tmp[4];
-
-                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-                avail= AV_RL32(tmp);
-                if(avail > size){
-                    av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
-                    avail= size;
+            ret = ring_get(h, buf, size);
+            if (ret != AVERROR(EAGAIN))
+                return ret;
+
+            ret = 0;
+            pthread_mutex_lock(&s->mutex);
+            atomic_store(&s->reader_waiting, 1);
+            /* check again, the receive thread now signals new data */
+            if (atomic_load(&s->ring_tail) == atomic_load_explicit(&s->ring_head, memory_order_relaxed)) {
+                if (s->circular_buffer_error) {
+                    ret = s->circular_buffer_error;
+                } else if (nonblock) {
+                    ret = AVERROR(EAGAIN);
+                } else {
+                    /* FIXME: using the monotonic clock would be better,
+                       but it does not exist on all supported platforms. */
+                    int64_t t = av_gettime() + 100000;
+                    struct timespec tv = { .tv_sec  =  t / 1000000,
+                                           .tv_nsec = (t % 1000000) * 1000 };
+                    pthread_cond_timedwait(&s->cond, &s->mutex, &tv);
+                    nonblock = 1;
                 }
-
-                av_fifo_generic_read(s->fifo, buf, avail, NULL);
-                av_fifo_drain(s->fifo, AV_RL32(tmp) - avail);
-                pthread_mutex_unlock(&s->mutex);
-                return avail;
-            } else if(s->circular_buffer_error){
-                int err = s->circular_buffer_error;
-                pthread_mutex_unlock(&s->mutex);
-                return err;
-            } else if(nonblock) {
-                pthread_mutex_unlock(&s->mutex);
-                return AVERROR(EAGAIN);
-            }
-            else {
-                /* FIXME: using the monotonic clock would be better,
-                   but it does not exist on all supported platforms. */
-                int64_t t = av_gettime() + 100000;
-                struct timespec tv = { .tv_sec  =  t / 1000000,
-                                       .tv_nsec = (t % 1000000) * 1000 };
-                if (pthread_cond_timedwait(&s->cond, &s->mutex, &tv) < 0) {
-                    pthread_mutex_unlock(&s->mutex);
-                    return AVERROR(errno == ETIMEDOUT ? EAGAIN : errno);
-                }
-                nonblock = 1;
             }
-        } while( 1);
+            atomic_store(&s->reader_waiting, 0);
+            pthread_mutex_unlock(&s->mutex);
+        } while (!ret);
+        return ret;
     }
 #endif
 
@@ -993,11 +1485,31 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
         if (ret < 0)
             return ret;
     }
+#if HAVE_RECVMMSG
+    if (s->timestamps) {
+        uint8_t control[UDP_CONTROL_SIZE];
+        struct iovec iov = { .iov_base = buf, .iov_len = size };
+        struct msghdr msg = {
+            .msg_name       = &addr,
+            .msg_namelen    = addr_len,
+            .msg_iov        = &iov,
+            .msg_iovlen     = 1,
+            .msg_control    = control,
+            .msg_controllen = sizeof(control),
+        };
+
+        ret = recvmsg(s->udp_fd, &msg, 0);
+        if (ret >= 0)
+            arrival_time = udp_arrival_time(&msg);
+    } else
+#endif
     ret = recvfrom(s->udp_fd, buf, size, 0, (struct sockaddr *)&addr, &addr_len);
     if (ret < 0)
         return ff_neterrno();
     if (ff_ip_check_source_lists(&addr, &s->filters))
         return AVERROR(EINTR);
+    if (s->timestamps)
+        s->arrival_time = arrival_time != AV_NOPTS_VALUE ? arrival_time : av_gettime();
     return ret;
 }
 
@@ -1022,11 +1534,28 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
             return err;
         }
 
-        if(av_fifo_space(s->fifo) < size + 4) {
+        if (size + 4 > s->circular_buffer_size) {
             /* What about a partial packet tx ? */
             pthread_mutex_unlock(&s->mutex);
             return AVERROR(ENOMEM);
         }
+        /* wait for the transmit thread to make room */
+        while (av_fifo_space(s->fifo) < size + 4) {
+            int64_t t = av_gettime() + 100000;
+            struct timespec tv = { .tv_sec  =  t / 1000000,
+                                   .tv_nsec = (t % 1000000) * 1000 };
+            int err = s->circular_buffer_error;
+
+            if (!err && h->flags & AVIO_FLAG_NONBLOCK)
+                err = AVERROR(EAGAIN);
+            if (!err && ff_check_interrupt(&h->interrupt_callback))
+                err = AVERROR_EXIT;
+            if (err) {
+                pthread_mutex_unlock(&s->mutex);
+                return err;
+            }
+            pthread_cond_timedwait(&s->cond, &s->mutex, &tv);
+        }
         AV_WL32(tmp, size);
         av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
         av_fifo_generic_write(s->fifo, (uint8_t *)buf, size, NULL); /* the data */
@@ -1034,6 +1563,15 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
         pthread_mutex_unlock(&s->mutex);
         return size;
     }
+#endif
+#if HAVE_SENDMMSG
+    if (s->tx_msgs && size <= h->max_packet_size) {
+        memcpy(s->tx_iov[s->tx_count].iov_base, buf, size);
+        s->tx_iov[s->tx_count].iov_len = size;
+        if (++s->tx_count == s->batch_size && (ret = udp_flush_tx_batch(h)) < 0)
+            return ret;
+        return size;
+    }
 #endif
     if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = ff_network_wait_fd(s->udp_fd, 1);
@@ -1055,6 +1593,11 @@ static int udp_close(URLContext *h)
 {
     UDPContext *s = h->priv_data;
 
+#if HAVE_SENDMMSG
+    if (s->tx_count)
+        udp_flush_tx_batch(h);
+#endif
+
 #if HAVE_PTHREAD_CANCEL
     // Request close once writing is finished
     if (s->thread_started && !(h->flags & AVIO_FLAG_READ)) {
@@ -1082,6 +1625,10 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_PTHREAD_CANCEL
+    av_freep(&s->ring);
+#endif
+    udp_free_batches(s);
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
@@ -0,0 +1,667 @@
+/*
+ * io_uring I/O protocol
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Asynchronous I/O on the file descriptor of a nested protocol (file, pipe,
+ * tcp, ...) through a Linux io_uring, without helper threads.
+ *
+ * Reads from seekable files are issued ahead of the read position, up to
+ * queue_depth blocks at a time, and writes return as soon as they are
+ * queued. Streams (sockets, pipes) keep one transfer in flight, preceded by
+ * a linked poll request, so that the kernel fills the next block while the
+ * caller processes the previous one.
+ *
+ * If io_uring is not available, all calls are passed through to the nested
+ * protocol.
+ */
+
+/* for syscall() and MAP_POPULATE */
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "url.h"
+
+#define USER_DATA_TIMEOUT (UINT64_MAX)
+#define USER_DATA_IGNORE  (UINT64_MAX - 1)
+
+/* how often the interrupt callback is checked while waiting */
+#define WAIT_TIMEOUT_NS   (100 * 1000000)
+
+enum SlotState {
+    SLOT_FREE,
+    SLOT_PENDING,
+    SLOT_DONE,
+};
+
+typedef struct UringSlot {
+    uint8_t *buf;
+    struct iovec iov;
+    enum SlotState state;
+    int64_t offset;     /* logical position of buf[0] */
+    int len;            /* number of bytes to transfer */
+    int done;           /* number of bytes transferred so far */
+    int res;            /* error code once completed */
+} UringSlot;
+
+/* same layout as struct __kernel_timespec */
+typedef struct UringTimespec {
+    int64_t tv_sec;
+    long long tv_nsec;
+} UringTimespec;
+
+typedef struct UringContext {
+    const AVClass *class;
+    URLContext *inner;
+
+    int queue_depth;
+    int block_size;
+
+    int fd;
+    int ring_fd;            /* -1 when falling back to the nested protocol */
+    int seekable;
+    int write;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+    unsigned *sq_head, *sq_tail, *sq_array;
+    unsigned *cq_head, *cq_tail;
+    unsigned sq_mask, sq_entries, cq_mask;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    struct io_uring_cqe *cqes;
+    unsigned nb_to_submit;
+
+    UringTimespec timeout;
+    int timeout_pending;
+    int no_timeout;         /* timeouts rejected by the kernel, wait blocking */
+
+    UringSlot *slots;
+    int nb_slots;
+    int slot_head;          /* oldest slot in use */
+    int nb_used;            /* number of slots in use, starting at slot_head */
+
+    int64_t pos;            /* logical read or write position */
+    int64_t next_offset;    /* position of the next block to read */
+    int error;              /* deferred write error */
+    int closing;
+} UringContext;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ring_init(UringContext *c, unsigned entries)
+{
+    struct io_uring_params p = { 0 };
+    int ret;
+
+    c->ring_fd = io_uring_setup(entries, &p);
+    if (c->ring_fd < 0)
+        return AVERROR(errno);
+
+    c->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    c->cq_map_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        c->sq_map_size = c->cq_map_size = FFMAX(c->sq_map_size, c->cq_map_size);
+
+    c->sq_map = mmap(NULL, c->sq_map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, c->ring_fd, IORING_OFF_SQ_RING);
+    if (c->sq_map == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        c->cq_map = c->sq_map;
+    } else {
+        c->cq_map = mmap(NULL, c->cq_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, c->ring_fd, IORING_OFF_CQ_RING);
+        if (c->cq_map == MAP_FAILED)
+            goto fail;
+    }
+    c->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    c->sqes = mmap(NULL, c->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, c->ring_fd, IORING_OFF_SQES);
+    if (c->sqes == MAP_FAILED)
+        goto fail;
+
+    c->sq_head    = (unsigned *)((uint8_t *)c->sq_map + p.sq_off.head);
+    c->sq_tail    = (unsigned *)((uint8_t *)c->sq_map + p.sq_off.tail);
+    c->sq_array   = (unsigned *)((uint8_t *)c->sq_map + p.sq_off.array);
+    c->sq_mask    = *(unsigned *)((uint8_t *)c->sq_map + p.sq_off.ring_mask);
+    c->sq_entries = p.sq_entries;
+    c->cq_head    = (unsigned *)((uint8_t *)c->cq_map + p.cq_off.head);
+    c->cq_tail    = (unsigned *)((uint8_t *)c->cq_map + p.cq_off.tail);
+    c->cq_mask    = *(unsigned *)((uint8_t *)c->cq_map + p.cq_off.ring_mask);
+    c->cqes       = (struct io_uring_cqe *)((uint8_t *)c->cq_map + p.cq_off.cqes);
+    return 0;
+
+fail:
+    ret = AVERROR(errno);
+    if (c->sq_map && c->sq_map != MAP_FAILED)
+        munmap(c->sq_map, c->sq_map_size);
+    if (c->cq_map && c->cq_map != MAP_FAILED && c->cq_map != c->sq_map)
+        munmap(c->cq_map, c->cq_map_size);
+    c->sq_map = c->cq_map = NULL;
+    c->sqes   = NULL;
+    close(c->ring_fd);
+    c->ring_fd = -1;
+    return ret;
+}
+
+static void ring_uninit(UringContext *c)
+{
+    munmap(c->sqes, c->sqes_size);
+    if (c->cq_map != c->sq_map)
+        munmap(c->cq_map, c->cq_map_size);
+    munmap(c->sq_map, c->sq_map_size);
+    close(c->ring_fd);
+    c->ring_fd = -1;
+}
+
+static int ring_submit(UringContext *c, unsigned min_complete)
+{
+    int ret;
+
+    if (!c->nb_to_submit && !min_complete)
+        return 0;
+    do {
+        ret = io_uring_enter(c->ring_fd, c->nb_to_submit, min_complete,
+                             min_complete ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return AVERROR(errno);
+    c->nb_to_submit -= FFMIN(ret, c->nb_to_submit);
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(UringContext *c)
+{
+    unsigned tail = *c->sq_tail, index;
+    struct io_uring_sqe *sqe;
+
+    if (tail - atomic_load_explicit((_Atomic unsigned *)c->sq_head,
+                                    memory_order_acquire) >= c->sq_entries) {
+        /* the kernel consumes all the entries when they are submitted */
+        if (ring_submit(c, 0) < 0)
+            return NULL;
+    }
+
+    index = tail & c->sq_mask;
+    sqe   = &c->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    c->sq_array[index] = index;
+    atomic_store_explicit((_Atomic unsigned *)c->sq_tail, tail + 1,
+                          memory_order_release);
+    c->nb_to_submit++;
+    return sqe;
+}
+
+static int submit_slot(UringContext *c, int index)
+{
+    UringSlot *s = &c->slots[index];
+    struct io_uring_sqe *sqe;
+
+    if (!c->seekable) {
+        /* streams may not be ready, wait for them without blocking the
+         * transfer itself, which would fail on non-blocking sockets */
+        sqe = get_sqe(c);
+        if (!sqe)
+            return AVERROR(EIO);
+        sqe->opcode      = IORING_OP_POLL_ADD;
+        sqe->fd          = c->fd;
+        sqe->poll_events = c->write ? POLLOUT : POLLIN;
+        sqe->flags       = IOSQE_IO_LINK;
+        sqe->user_data   = c->nb_slots + index;
+    }
+
+    sqe = get_sqe(c);
+    if (!sqe)
+        return AVERROR(EIO);
+    s->iov.iov_base = s->buf + s->done;
+    s->iov.iov_len  = s->len - s->done;
+    sqe->opcode     = c->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd         = c->fd;
+    sqe->addr       = (uintptr_t)&s->iov;
+    sqe->len        = 1;
+    sqe->off        = c->seekable ? s->offset + s->done : 0;
+    sqe->user_data  = index;
+    s->state        = SLOT_PENDING;
+    return 0;
+}
+
+static void complete_slot(UringContext *c, UringSlot *s, int res)
+{
+    if (!c->seekable && !c->closing && (res == -EAGAIN || res == -ECANCELED)) {
+        /* spurious wakeup or failed poll, try again */
+        if (submit_slot(c, s - c->slots) >= 0)
+            return;
+        res = -EIO;
+    }
+    if (res > 0 && c->write) {
+        s->done += res;
+        if (s->done < s->len && submit_slot(c, s - c->slots) >= 0)
+            return;
+    } else if (res >= 0) {
+        s->done = res;
+    }
+    s->res   = FFMIN(res, 0);
+    s->state = SLOT_DONE;
+    if (c->write && res < 0 && !c->error)
+        c->error = AVERROR(-res);
+    else if (c->write && !res && !c->error)
+        c->error = AVERROR(EIO);
+}
+
+/* process the completions available without blocking */
+static int reap_completions(UringContext *c)
+{
+    unsigned head = *c->cq_head, tail;
+    int nb = 0;
+
+    tail = atomic_load_explicit((_Atomic unsigned *)c->cq_tail, memory_order_acquire);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &c->cqes[head & c->cq_mask];
+
+        if (cqe->user_data == USER_DATA_TIMEOUT) {
+            c->timeout_pending = 0;
+            /* expired timeouts complete with -ETIME, the ones cut short by
+             * another completion with 0 */
+            if (cqe->res == -EINVAL && !c->no_timeout) {
+                av_log(c, AV_LOG_WARNING, "io_uring timeouts not supported "
+                       "by the kernel, waits cannot be interrupted\n");
+                c->no_timeout = 1;
+            }
+        } else if (cqe->user_data < c->nb_slots) {
+            complete_slot(c, &c->slots[cqe->user_data], cqe->res);
+            nb++;
+        }
+    }
+    atomic_store_explicit((_Atomic unsigned *)c->cq_head, head, memory_order_release);
+    return nb;
+}
+
+/* wait until at least one transfer has completed */
+static int wait_completion(URLContext *h, int interruptible)
+{
+    UringContext *c = h->priv_data;
+    int ret;
+
+    while (!reap_completions(c)) {
+        if (interruptible && ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+
+        /* otherwise the failed timeout would complete the wait at once,
+         * again and again */
+        if (!c->timeout_pending && !c->no_timeout) {
+            struct io_uring_sqe *sqe = get_sqe(c);
+            if (!sqe)
+                return AVERROR(EIO);
+            c->timeout.tv_sec  = 0;
+            c->timeout.tv_nsec = WAIT_TIMEOUT_NS;
+            sqe->opcode    = IORING_OP_TIMEOUT;
+            sqe->fd        = -1;
+            sqe->addr      = (uintptr_t)&c->timeout;
+            sqe->len       = 1;
+            sqe->off       = 1; /* or as soon as anything else completes */
+            sqe->user_data = USER_DATA_TIMEOUT;
+            c->timeout_pending = 1;
+        }
+        ret = ring_submit(c, 1);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/* wait for all the transfers in flight, then forget about them */
+static int drain(URLContext *h, int64_t next_offset)
+{
+    UringContext *c = h->priv_data;
+    int i, ret = 0;
+
+    for (i = 0; i < c->nb_slots; i++) {
+        while (c->slots[i].state == SLOT_PENDING) {
+            if ((ret = wait_completion(h, 0)) < 0)
+                return ret;
+        }
+        c->slots[i].state = SLOT_FREE;
+    }
+    c->slot_head   = 0;
+    c->nb_used     = 0;
+    c->next_offset = next_offset;
+    return 0;
+}
+
+static void pop_slot(UringContext *c)
+{
+    c->slots[c->slot_head].state = SLOT_FREE;
+    c->slot_head = (c->slot_head + 1) % c->nb_slots;
+    c->nb_used--;
+}
+
+/* queue reads of the following blocks on all the free slots */
+static int fill_queue(UringContext *c)
+{
+    int ret;
+
+    while (c->nb_used < c->nb_slots) {
+        int index = (c->slot_head + c->nb_used) % c->nb_slots;
+        UringSlot *s = &c->slots[index];
+
+        s->offset = c->next_offset;
+        s->len    = c->block_size;
+        s->done   = 0;
+        s->res    = 0;
+        if ((ret = submit_slot(c, index)) < 0)
+            return ret;
+        c->next_offset += c->block_size;
+        c->nb_used++;
+    }
+    return ring_submit(c, 0);
+}
+
+static int uring_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
+{
+    UringContext *c = h->priv_data;
+    int i, ret;
+
+    av_strstart(arg, "uring:", &arg);
+
+    c->ring_fd = -1;
+    ret = ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
+                               options, h->protocol_whitelist,
+                               h->protocol_blacklist, h);
+    if (ret < 0)
+        return ret;
+    h->is_streamed     = c->inner->is_streamed;
+    h->min_packet_size = c->inner->min_packet_size;
+    h->max_packet_size = c->inner->max_packet_size;
+
+    c->fd = ffurl_get_file_handle(c->inner);
+    if (c->fd < 0 || (flags & AVIO_FLAG_READ && flags & AVIO_FLAG_WRITE)) {
+        av_log(h, AV_LOG_VERBOSE, "Asynchronous I/O not supported for %s, "
+               "using synchronous I/O\n", arg);
+        return 0;
+    }
+    c->write    = !!(flags & AVIO_FLAG_WRITE);
+    c->seekable = !c->inner->is_streamed && lseek(c->fd, 0, SEEK_CUR) >= 0;
+    c->nb_slots = c->seekable ? c->queue_depth : 1;
+    if (c->seekable)
+        c->pos = c->next_offset = lseek(c->fd, 0, SEEK_CUR);
+
+    ret = ring_init(c, 2 * c->nb_slots + 2);
+    if (ret < 0) {
+        av_log(h, AV_LOG_VERBOSE, "io_uring not available, using synchronous "
+               "I/O: %s\n", av_err2str(ret));
+        return 0;
+    }
+
+    c->slots = av_mallocz_array(c->nb_slots, sizeof(*c->slots));
+    if (!c->slots)
+        goto fail;
+    for (i = 0; i < c->nb_slots; i++) {
+        c->slots[i].buf = av_malloc(c->block_size);
+        if (!c->slots[i].buf)
+            goto fail;
+    }
+    return 0;
+
+fail:
+    for (i = 0; c->slots && i < c->nb_slots; i++)
+        av_freep(&c->slots[i].buf);
+    av_freep(&c->slots);
+    ring_uninit(c);
+    ffurl_closep(&c->inner);
+    return AVERROR(ENOMEM);
+}
+
+static int uring_read(URLContext *h, unsigned char *buf, int size)
+{
+    UringContext *c = h->priv_data;
+    int ret;
+
+    if (c->ring_fd < 0)
+        return ffurl_read(c->inner, buf, size);
+
+    for (;;) {
+        UringSlot *s;
+        int64_t end;
+
+        if ((ret = fill_queue(c)) < 0)
+            return ret;
+
+        s = &c->slots[c->slot_head];
+        if (s->state == SLOT_PENDING) {
+            if ((ret = wait_completion(h, 1)) < 0)
+                return ret;
+            continue;
+        }
+        if (s->res < 0) {
+            ret = AVERROR(-s->res);
+            drain(h, c->pos);
+            return ret;
+        }
+
+        end = s->offset + s->done;
+        if (c->pos < end) {
+            size = FFMIN(size, end - c->pos);
+            memcpy(buf, s->buf + (c->pos - s->offset), size);
+            c->pos += size;
+            if (c->pos == end) {
+                if (s->done == s->len)
+                    pop_slot(c);
+                else if ((ret = drain(h, end)) < 0)
+                    return ret;
+                /* get the kernel working on the next block right away */
+                if ((ret = fill_queue(c)) < 0)
+                    return ret;
+            }
+            return size;
+        }
+        if (!s->done)
+            return AVERROR_EOF;
+
+        /* short read before the position, read again from where it ended */
+        if ((ret = drain(h, end)) < 0)
+            return ret;
+    }
+}
+
+static int uring_write(URLContext *h, const unsigned char *buf, int size)
+{
+    UringContext *c = h->priv_data;
+    UringSlot *s;
+    int index, ret;
+
+    if (c->ring_fd < 0)
+        return ffurl_write(c->inner, buf, size);
+
+    for (;;) {
+        /* release the completed writes */
+        while (c->nb_used && c->slots[c->slot_head].state == SLOT_DONE)
+            pop_slot(c);
+        if (c->error)
+            return c->error;
+        if (c->nb_used < c->nb_slots)
+            break;
+        if ((ret = wait_completion(h, 1)) < 0)
+            return ret;
+    }
+
+    index     = (c->slot_head + c->nb_used) % c->nb_slots;
+    s         = &c->slots[index];
+    s->offset = c->pos;
+    s->len    = FFMIN(size, c->block_size);
+    s->done   = 0;
+    s->res    = 0;
+    memcpy(s->buf, buf, s->len);
+    if ((ret = submit_slot(c, index)) < 0)
+        return ret;
+    c->nb_used++;
+    c->pos += s->len;
+
+    ret = ring_submit(c, 0);
+    return ret < 0 ? ret : s->len;
+}
+
+static int64_t uring_seek(URLContext *h, int64_t pos, int whence)
+{
+    UringContext *c = h->priv_data;
+    int64_t size;
+    int ret;
+
+    if (c->ring_fd < 0 || !c->seekable)
+        return ffurl_seek(c->inner, pos, whence);
+
+    if (whence == SEEK_CUR) {
+        pos += c->pos;
+        whence = SEEK_SET;
+    } else if (whence != SEEK_SET && whence != SEEK_END && whence != AVSEEK_SIZE) {
+        return AVERROR(EINVAL);
+    }
+
+    if (c->write || whence != SEEK_SET) {
+        /* the size of the file depends on the writes in flight */
+        if (c->write && (ret = drain(h, c->next_offset)) < 0)
+            return ret;
+        if (c->error)
+            return c->error;
+        size = ffurl_seek(c->inner, 0, AVSEEK_SIZE);
+        if (whence == AVSEEK_SIZE)
+            return size;
+        if (whence == SEEK_END) {
+            if (size < 0)
+                return size;
+            pos += size;
+        }
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+    if (!c->write) {
+        /* keep the blocks in flight which are still ahead of the new position */
+        while (c->nb_used && pos < c->next_offset &&
+               pos >= c->slots[c->slot_head].offset + c->block_size) {
+            while (c->slots[c->slot_head].state == SLOT_PENDING) {
+                if ((ret = wait_completion(h, 0)) < 0)
+                    return ret;
+            }
+            pop_slot(c);
+        }
+        if (!c->nb_used || pos < c->slots[c->slot_head].offset ||
+            pos >= c->next_offset) {
+            if ((ret = drain(h, pos)) < 0)
+                return ret;
+        }
+    }
+
+    c->pos = pos;
+    return pos;
+}
+
+static int uring_get_file_handle(URLContext *h)
+{
+    UringContext *c = h->priv_data;
+    return ffurl_get_file_handle(c->inner);
+}
+
+static int uring_close(URLContext *h)
+{
+    UringContext *c = h->priv_data;
+    int i, ret = 0;
+
+    if (c->ring_fd >= 0) {
+        if (!c->write) {
+            /* do not wait for data nobody is going to read */
+            for (i = 0; i < c->nb_slots; i++) {
+                struct io_uring_sqe *sqe;
+                if (c->slots[i].state != SLOT_PENDING || !(sqe = get_sqe(c)))
+                    continue;
+                sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+                sqe->fd        = -1;
+                /* for streams, cancelling the poll cancels the linked read */
+                sqe->addr      = c->seekable ? i : c->nb_slots + i;
+                sqe->user_data = USER_DATA_IGNORE;
+            }
+        }
+        c->closing = 1;
+        ret = drain(h, 0);
+        if (c->write && c->error)
+            ret = c->error;
+        for (i = 0; i < c->nb_slots; i++)
+            av_freep(&c->slots[i].buf);
+        av_freep(&c->slots);
+        ring_uninit(c);
+    }
+
+    i = ffurl_closep(&c->inner);
+    return ret < 0 ? ret : i;
+}
+
+#define OFFSET(x) offsetof(UringContext, x)
+#define E AV_OPT_FLAG_ENCODING_PARAM
+#define D AV_OPT_FLAG_DECODING_PARAM
+
+static const AVOption options[] = {
+    { "queue_depth", "maximum number of blocks in flight", OFFSET(queue_depth), AV_OPT_TYPE_INT, { .i64 = 4 }, 1, 64, D|E },
+    { "block_size",  "size of the blocks read or written", OFFSET(block_size),  AV_OPT_TYPE_INT, { .i64 = 256 * 1024 }, 4096, INT_MAX / 2, D|E },
+    { NULL }
+};
+
+#undef D
+#undef E
+#undef OFFSET
+
+static const AVClass uring_context_class = {
+    .class_name = "uring",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+const URLProtocol ff_uring_protocol = {
+    .name                = "uring",
+    .url_open2           = uring_open,
+    .url_read            = uring_read,
+    .url_write           = uring_write,
+    .url_seek            = uring_seek,
+    .url_close           = uring_close,
+    .url_get_file_handle = uring_get_file_handle,
+    .priv_data_size      = sizeof(UringContext),
+    .priv_data_class     = &uring_context_class,
+    .flags               = URL_PROTOCOL_FLAG_NESTED_SCHEME,
+};
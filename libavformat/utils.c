@@ -26,7 +26,9 @@
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
+#include "libavutil/cpu.h"
 #include "libavutil/dict.h"
+#include "libavutil/fifo.h"
 #include "libavutil/internal.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
@@ -1026,22 +1028,27 @@ static int is_intra_only(enum AVCodecID id)
     return 1;
 }
 
-static int has_decode_delay_been_guessed(AVStream *st)
+static int decode_delay_guessed(AVCodecContext *avctx, int nb_decoded_frames)
 {
-    if (st->codecpar->codec_id != AV_CODEC_ID_H264) return 1;
-    if (!st->info) // if we have left find_stream_info then nb_decoded_frames won't increase anymore for stream copy
-        return 1;
 #if CONFIG_H264_DECODER
-    if (st->internal->avctx->has_b_frames &&
-       avpriv_h264_has_num_reorder_frames(st->internal->avctx) == st->internal->avctx->has_b_frames)
+    if (avctx->has_b_frames &&
+       avpriv_h264_has_num_reorder_frames(avctx) == avctx->has_b_frames)
         return 1;
 #endif
-    if (st->internal->avctx->has_b_frames<3)
-        return st->nb_decoded_frames >= 7;
-    else if (st->internal->avctx->has_b_frames<4)
-        return st->nb_decoded_frames >= 18;
+    if (avctx->has_b_frames<3)
+        return nb_decoded_frames >= 7;
+    else if (avctx->has_b_frames<4)
+        return nb_decoded_frames >= 18;
     else
-        return st->nb_decoded_frames >= 20;
+        return nb_decoded_frames >= 20;
+}
+
+static int has_decode_delay_been_guessed(AVStream *st)
+{
+    if (st->codecpar->codec_id != AV_CODEC_ID_H264) return 1;
+    if (!st->info) // if we have left find_stream_info then nb_decoded_frames won't increase anymore for stream copy
+        return 1;
+    return decode_delay_guessed(st->internal->avctx, st->nb_decoded_frames);
 }
 
 static AVPacketList *get_next_pkt(AVFormatContext *s, AVStream *st, AVPacketList *pktl)
@@ -1632,6 +1639,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
 #endif
 
             st->internal->need_context_update = 0;
+            st->internal->context_update_count++;
         }
 
         if (pkt->pts != AV_NOPTS_VALUE &&
@@ -2999,10 +3007,15 @@ static void estimate_timings(AVFormatContext *ic, int64_t old_offset)
     }
 }
 
-static int has_codec_parameters(AVStream *st, const char **errmsg_ptr)
+/**
+ * Check the parameters of a stream as found in avctx, which is either the
+ * internal codec context of the stream or the context of its probe decoder.
+ */
+static int codec_parameters_found(AVStream *st, AVCodecContext *avctx,
+                                  int found_decoder, int nb_decoded_frames,
+                                  int codec_info_nb_frames,
+                                  const char **errmsg_ptr)
 {
-    AVCodecContext *avctx = st->internal->avctx;
-
 #define FAIL(errmsg) do {                                         \
         if (errmsg_ptr)                                           \
             *errmsg_ptr = errmsg;                                 \
@@ -3016,23 +3029,23 @@ static int has_codec_parameters(AVStream *st, const char **errmsg_ptr)
     case AVMEDIA_TYPE_AUDIO:
         if (!avctx->frame_size && determinable_frame_size(avctx))
             FAIL("unspecified frame size");
-        if (st->info->found_decoder >= 0 &&
+        if (found_decoder >= 0 &&
             avctx->sample_fmt == AV_SAMPLE_FMT_NONE)
             FAIL("unspecified sample format");
         if (!avctx->sample_rate)
             FAIL("unspecified sample rate");
         if (!avctx->channels)
             FAIL("unspecified number of channels");
-        if (st->info->found_decoder >= 0 && !st->nb_decoded_frames && avctx->codec_id == AV_CODEC_ID_DTS)
+        if (found_decoder >= 0 && !nb_decoded_frames && avctx->codec_id == AV_CODEC_ID_DTS)
             FAIL("no decodable DTS frames");
         break;
     case AVMEDIA_TYPE_VIDEO:
         if (!avctx->width)
             FAIL("unspecified size");
-        if (st->info->found_decoder >= 0 && avctx->pix_fmt == AV_PIX_FMT_NONE)
+        if (found_decoder >= 0 && avctx->pix_fmt == AV_PIX_FMT_NONE)
             FAIL("unspecified pixel format");
-        if (st->codecpar->codec_id == AV_CODEC_ID_RV30 || st->codecpar->codec_id == AV_CODEC_ID_RV40)
-            if (!st->sample_aspect_ratio.num && !st->codecpar->sample_aspect_ratio.num && !st->codec_info_nb_frames)
+        if (avctx->codec_id == AV_CODEC_ID_RV30 || avctx->codec_id == AV_CODEC_ID_RV40)
+            if (!st->sample_aspect_ratio.num && !st->codecpar->sample_aspect_ratio.num && !codec_info_nb_frames)
                 FAIL("no frame in rv30/40 and no sar");
         break;
     case AVMEDIA_TYPE_SUBTITLE:
@@ -3046,11 +3059,26 @@ static int has_codec_parameters(AVStream *st, const char **errmsg_ptr)
     return 1;
 }
 
-/* returns 1 or 0 if or if not decoded data was returned, or a negative error */
-static int try_decode_frame(AVFormatContext *s, AVStream *st,
-                            const AVPacket *avpkt, AVDictionary **options)
+static int has_codec_parameters(AVStream *st, const char **errmsg_ptr)
+{
+    return codec_parameters_found(st, st->internal->avctx,
+                                  st->info->found_decoder, st->nb_decoded_frames,
+                                  st->codec_info_nb_frames, errmsg_ptr);
+}
+
+/**
+ * Decode avpkt with avctx, opening the decoder first if needed, until the
+ * codec parameters of st are found.
+ *
+ * @param found_decoder     decoder state of the stream, see AVStream.info
+ * @param nb_decoded_frames number of frames decoded so far for the stream
+ * @return 1 or 0 if or if not decoded data was returned, or a negative error
+ */
+static int decode_probe_frame(AVFormatContext *s, AVStream *st,
+                              AVCodecContext *avctx, int *found_decoder,
+                              int *nb_decoded_frames, int codec_info_nb_frames,
+                              const AVPacket *avpkt, AVDictionary **options)
 {
-    AVCodecContext *avctx = st->internal->avctx;
     const AVCodec *codec;
     int got_picture = 1, ret = 0;
     AVFrame *frame = av_frame_alloc();
@@ -3063,14 +3091,14 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st,
         return AVERROR(ENOMEM);
 
     if (!avcodec_is_open(avctx) &&
-        st->info->found_decoder <= 0 &&
-        (st->codecpar->codec_id != -st->info->found_decoder || !st->codecpar->codec_id)) {
+        *found_decoder <= 0 &&
+        (avctx->codec_id != -*found_decoder || !avctx->codec_id)) {
         AVDictionary *thread_opt = NULL;
 
-        codec = find_probe_decoder(s, st, st->codecpar->codec_id);
+        codec = find_probe_decoder(s, st, avctx->codec_id);
 
         if (!codec) {
-            st->info->found_decoder = -st->codecpar->codec_id;
+            *found_decoder = -avctx->codec_id;
             ret                     = -1;
             goto fail;
         }
@@ -3084,14 +3112,14 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st,
         if (!options)
             av_dict_free(&thread_opt);
         if (ret < 0) {
-            st->info->found_decoder = -avctx->codec_id;
+            *found_decoder = -avctx->codec_id;
             goto fail;
         }
-        st->info->found_decoder = 1;
-    } else if (!st->info->found_decoder)
-        st->info->found_decoder = 1;
+        *found_decoder = 1;
+    } else if (!*found_decoder)
+        *found_decoder = 1;
 
-    if (st->info->found_decoder < 0) {
+    if (*found_decoder < 0) {
         ret = -1;
         goto fail;
     }
@@ -3104,8 +3132,11 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st,
 
     while ((pkt.size > 0 || (!pkt.data && got_picture)) &&
            ret >= 0 &&
-           (!has_codec_parameters(st, NULL) || !has_decode_delay_been_guessed(st) ||
-            (!st->codec_info_nb_frames &&
+           (!codec_parameters_found(st, avctx, *found_decoder, *nb_decoded_frames,
+                                    codec_info_nb_frames, NULL) ||
+            (avctx->codec_id == AV_CODEC_ID_H264 &&
+             !decode_delay_guessed(avctx, *nb_decoded_frames)) ||
+            (!codec_info_nb_frames &&
              (avctx->codec->capabilities & AV_CODEC_CAP_CHANNEL_CONF)))) {
         got_picture = 0;
         if (avctx->codec_type == AVMEDIA_TYPE_VIDEO ||
@@ -3128,7 +3159,7 @@ static int try_decode_frame(AVFormatContext *s, AVStream *st,
         }
         if (ret >= 0) {
             if (got_picture)
-                st->nb_decoded_frames++;
+                (*nb_decoded_frames)++;
             ret       = got_picture;
         }
     }
@@ -3145,6 +3176,472 @@ fail:
     return ret;
 }
 
+static int try_decode_frame(AVFormatContext *s, AVStream *st,
+                            const AVPacket *avpkt, AVDictionary **options)
+{
+    return decode_probe_frame(s, st, st->internal->avctx, &st->info->found_decoder,
+                              &st->nb_decoded_frames, st->codec_info_nb_frames,
+                              avpkt, options);
+}
+
+#if HAVE_THREADS
+/* Packets queued per stream before the demuxing thread waits for the decoder. */
+#define PROBE_DECODE_QUEUE_SIZE 8
+
+typedef struct ProbeDecodePacket {
+    AVPacket pkt;
+    int codec_info_nb_frames;
+} ProbeDecodePacket;
+
+/**
+ * A stream decoded by the probe_threads workers of
+ * avformat_find_stream_info(). It is decoded with its own codec context so
+ * that the demuxer and the parsers can keep using the internal one on the
+ * demuxing thread; the results are merged back by probe_decode_sync().
+ * The decoder state (avctx, found_decoder and nb_decoded_frames) belongs to
+ * the worker which set busy, the rest is protected by the mutex of the
+ * ProbeDecodeContext.
+ */
+typedef struct ProbeDecodeStream {
+    AVStream *st;
+    AVCodecContext *avctx;
+    AVDictionary *opts;
+    AVFifoBuffer *queue;
+    int found_decoder;
+    int nb_decoded_frames;
+    int busy;
+    int updated;            ///< decoded since the last probe_decode_sync()
+    int done;               ///< codec parameters found, no packets are needed
+    int flush;              ///< flush requested
+    int flush_nb_frames;    ///< codec_info_nb_frames at the flush request
+    int flush_ret;
+    int context_update_count; ///< of the internal context avctx was made from
+} ProbeDecodeStream;
+
+typedef struct ProbeDecodeContext {
+    AVFormatContext *s;
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ProbeDecodeStream **streams;    ///< indexed by stream index, may be NULL
+    int nb_streams;
+    int next_stream;
+    int abort;
+} ProbeDecodeContext;
+
+static int probe_decode_done(ProbeDecodeStream *ps, int codec_info_nb_frames)
+{
+    return codec_parameters_found(ps->st, ps->avctx, ps->found_decoder,
+                                  ps->nb_decoded_frames, codec_info_nb_frames, NULL) &&
+           (ps->avctx->codec_id != AV_CODEC_ID_H264 ||
+            decode_delay_guessed(ps->avctx, ps->nb_decoded_frames));
+}
+
+static void *probe_decode_thread(void *arg)
+{
+    ProbeDecodeContext *pd = arg;
+
+    pthread_mutex_lock(&pd->mutex);
+    while (!pd->abort) {
+        ProbeDecodeStream *ps = NULL;
+        ProbeDecodePacket entry;
+        int i, flush, done, ret = 0;
+
+        for (i = 0; i < pd->nb_streams; i++) {
+            ProbeDecodeStream *cur = pd->streams[(pd->next_stream + i) % pd->nb_streams];
+            if (cur && !cur->busy && (cur->flush || av_fifo_size(cur->queue))) {
+                ps = cur;
+                pd->next_stream = (pd->next_stream + i + 1) % pd->nb_streams;
+                break;
+            }
+        }
+        if (!ps) {
+            pthread_cond_wait(&pd->cond, &pd->mutex);
+            continue;
+        }
+        flush = !av_fifo_size(ps->queue);
+        if (!flush)
+            av_fifo_generic_read(ps->queue, &entry, sizeof(entry), NULL);
+        ps->busy = 1;
+        pthread_cond_broadcast(&pd->cond);
+        pthread_mutex_unlock(&pd->mutex);
+
+        if (flush) {
+            AVPacket empty_pkt = { 0 };
+            av_init_packet(&empty_pkt);
+
+            do {
+                ret = decode_probe_frame(pd->s, ps->st, ps->avctx, &ps->found_decoder,
+                                         &ps->nb_decoded_frames, ps->flush_nb_frames,
+                                         &empty_pkt, &ps->opts);
+            } while (ret > 0 && !codec_parameters_found(ps->st, ps->avctx, ps->found_decoder,
+                                                        ps->nb_decoded_frames,
+                                                        ps->flush_nb_frames, NULL));
+            done = 1;
+        } else {
+            if (!ps->done)
+                decode_probe_frame(pd->s, ps->st, ps->avctx, &ps->found_decoder,
+                                   &ps->nb_decoded_frames, entry.codec_info_nb_frames,
+                                   &entry.pkt, &ps->opts);
+            av_packet_unref(&entry.pkt);
+            done = ps->found_decoder < 0 ||
+                   probe_decode_done(ps, entry.codec_info_nb_frames);
+        }
+
+        pthread_mutex_lock(&pd->mutex);
+        if (flush) {
+            ps->flush     = 0;
+            ps->flush_ret = ret;
+        }
+        ps->busy    = 0;
+        ps->updated = 1;
+        ps->done    = done;
+        pthread_cond_broadcast(&pd->cond);
+    }
+    pthread_mutex_unlock(&pd->mutex);
+
+    return NULL;
+}
+
+static void probe_decode_stream_free(ProbeDecodeStream **pps)
+{
+    ProbeDecodeStream *ps = *pps;
+    ProbeDecodePacket entry;
+
+    if (!ps)
+        return;
+    while (ps->queue && av_fifo_size(ps->queue)) {
+        av_fifo_generic_read(ps->queue, &entry, sizeof(entry), NULL);
+        av_packet_unref(&entry.pkt);
+    }
+    av_fifo_freep(&ps->queue);
+    avcodec_free_context(&ps->avctx);
+    av_dict_free(&ps->opts);
+    av_freep(pps);
+}
+
+/**
+ * Drop the probe decoder of a stream if the demuxer changed the codec
+ * parameters since it was set up: the internal context has been reset from
+ * them and its decoder closed, so what the worker decodes is outdated. The
+ * decoder is set up again from the updated context on the next packet.
+ */
+static void probe_decode_check_update(ProbeDecodeContext *pd, int index)
+{
+    ProbeDecodeStream *ps = pd->streams[index];
+
+    if (!ps || ps->context_update_count == ps->st->internal->context_update_count)
+        return;
+
+    pthread_mutex_lock(&pd->mutex);
+    while (ps->busy)
+        pthread_cond_wait(&pd->cond, &pd->mutex);
+    pd->streams[index] = NULL;
+    pthread_cond_broadcast(&pd->cond);
+    pthread_mutex_unlock(&pd->mutex);
+
+    probe_decode_stream_free(&ps);
+}
+
+static void probe_decode_free(ProbeDecodeContext **ppd)
+{
+    ProbeDecodeContext *pd = *ppd;
+    int i;
+
+    if (!pd)
+        return;
+
+    pthread_mutex_lock(&pd->mutex);
+    pd->abort = 1;
+    pthread_cond_broadcast(&pd->cond);
+    pthread_mutex_unlock(&pd->mutex);
+    for (i = 0; i < pd->nb_threads; i++)
+        pthread_join(pd->threads[i], NULL);
+    pthread_cond_destroy(&pd->cond);
+    pthread_mutex_destroy(&pd->mutex);
+
+    for (i = 0; i < pd->nb_streams; i++)
+        probe_decode_stream_free(&pd->streams[i]);
+    av_freep(&pd->streams);
+    av_freep(&pd->threads);
+    av_freep(ppd);
+}
+
+/**
+ * Start the probe_threads workers, if more than one thread is requested.
+ * pd is left NULL if the streams are to be decoded on the calling thread.
+ */
+static int probe_decode_init(AVFormatContext *s, ProbeDecodeContext **ppd)
+{
+    ProbeDecodeContext *pd;
+    int nb_threads = s->probe_threads ? s->probe_threads : av_cpu_count();
+    int ret;
+
+    *ppd = NULL;
+    if (!(s->ctx_flags & AVFMTCTX_NOHEADER))
+        nb_threads = FFMIN(nb_threads, s->nb_streams);
+    if (nb_threads <= 1)
+        return 0;
+
+    pd = av_mallocz(sizeof(*pd));
+    if (!pd)
+        return AVERROR(ENOMEM);
+    pd->s       = s;
+    pd->threads = av_malloc_array(nb_threads, sizeof(*pd->threads));
+    if (!pd->threads) {
+        av_free(pd);
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = pthread_mutex_init(&pd->mutex, NULL))) {
+        av_free(pd->threads);
+        av_free(pd);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&pd->cond, NULL))) {
+        pthread_mutex_destroy(&pd->mutex);
+        av_free(pd->threads);
+        av_free(pd);
+        return AVERROR(ret);
+    }
+    *ppd = pd;
+
+    for (; pd->nb_threads < nb_threads; pd->nb_threads++) {
+        ret = pthread_create(&pd->threads[pd->nb_threads], NULL, probe_decode_thread, pd);
+        if (ret) {
+            probe_decode_free(ppd);
+            return AVERROR(ret);
+        }
+    }
+    av_log(s, AV_LOG_DEBUG, "Decoding the streams with %d threads\n", nb_threads);
+
+    return 0;
+}
+
+static ProbeDecodeStream *probe_decode_stream_alloc(AVFormatContext *s, AVStream *st,
+                                                    AVDictionary **options)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    AVCodecParameters *par = NULL;
+    ProbeDecodeStream *ps = av_mallocz(sizeof(*ps));
+
+    if (!ps)
+        return NULL;
+    ps->st            = st;
+    ps->found_decoder = st->info->found_decoder;
+    ps->nb_decoded_frames = st->nb_decoded_frames;
+    ps->context_update_count = st->internal->context_update_count;
+    ps->avctx = avcodec_alloc_context3(NULL);
+    ps->queue = av_fifo_alloc_array(PROBE_DECODE_QUEUE_SIZE, sizeof(ProbeDecodePacket));
+    par       = avcodec_parameters_alloc();
+    if (!ps->avctx || !ps->queue || !par ||
+        avcodec_parameters_from_context(par, avctx) < 0 ||
+        avcodec_parameters_to_context(ps->avctx, par) < 0 ||
+        (options && av_dict_copy(&ps->opts, *options, 0) < 0))
+        goto fail;
+    avcodec_parameters_free(&par);
+
+    ps->avctx->time_base       = avctx->time_base;
+    ps->avctx->pkt_timebase    = avctx->pkt_timebase;
+    ps->avctx->framerate       = avctx->framerate;
+    ps->avctx->ticks_per_frame = avctx->ticks_per_frame;
+
+    /* Keep decoding with the decoder the stream was opened with, even if a
+     * parser changed the codec id since. */
+    if (avcodec_is_open(avctx)) {
+        av_dict_set(&ps->opts, "threads", "1", 0);
+        if (s->codec_whitelist)
+            av_dict_set(&ps->opts, "codec_whitelist", s->codec_whitelist, 0);
+        ps->avctx->codec_id = avctx->codec->id;
+        if (avcodec_open2(ps->avctx, avctx->codec, &ps->opts) < 0)
+            ps->found_decoder = -avctx->codec_id;
+        ps->avctx->codec_id = avctx->codec_id;
+    }
+
+    return ps;
+fail:
+    avcodec_parameters_free(&par);
+    av_fifo_freep(&ps->queue);
+    avcodec_free_context(&ps->avctx);
+    av_dict_free(&ps->opts);
+    av_free(ps);
+    return NULL;
+}
+
+/**
+ * Queue a packet for the decoder of its stream, waiting if the queue is full.
+ * Only audio and video streams are decoded by the workers.
+ *
+ * @return 1 if the packet was handled, 0 if it has to be decoded on the
+ *         calling thread, a negative error code on failure
+ */
+static int probe_decode_send(ProbeDecodeContext *pd, AVStream *st,
+                             const AVPacket *pkt, AVDictionary **options)
+{
+    ProbeDecodeStream *ps;
+    ProbeDecodePacket entry = { .codec_info_nb_frames = st->codec_info_nb_frames };
+    int ret;
+
+    if (st->internal->avctx->codec_type != AVMEDIA_TYPE_VIDEO &&
+        st->internal->avctx->codec_type != AVMEDIA_TYPE_AUDIO)
+        return 0;
+
+    if (st->index >= pd->nb_streams) {
+        ProbeDecodeStream **streams;
+
+        pthread_mutex_lock(&pd->mutex);
+        streams = av_realloc_array(pd->streams, st->index + 1, sizeof(*streams));
+        if (streams) {
+            memset(streams + pd->nb_streams, 0,
+                   (st->index + 1 - pd->nb_streams) * sizeof(*streams));
+            pd->streams    = streams;
+            pd->nb_streams = st->index + 1;
+        }
+        pthread_mutex_unlock(&pd->mutex);
+        if (!streams)
+            return AVERROR(ENOMEM);
+    }
+    probe_decode_check_update(pd, st->index);
+    if (!pd->streams[st->index]) {
+        ps = probe_decode_stream_alloc(pd->s, st, options);
+        if (!ps)
+            return AVERROR(ENOMEM);
+        pthread_mutex_lock(&pd->mutex);
+        pd->streams[st->index] = ps;
+        pthread_mutex_unlock(&pd->mutex);
+    }
+    ps = pd->streams[st->index];
+
+    if ((ret = av_packet_ref(&entry.pkt, pkt)) < 0)
+        return ret;
+
+    pthread_mutex_lock(&pd->mutex);
+    while (av_fifo_space(ps->queue) < sizeof(entry) && !ps->done)
+        pthread_cond_wait(&pd->cond, &pd->mutex);
+    if (!ps->done) {
+        av_fifo_generic_write(ps->queue, &entry, sizeof(entry), NULL);
+        pthread_cond_broadcast(&pd->cond);
+    } else {
+        av_packet_unref(&entry.pkt);
+    }
+    pthread_mutex_unlock(&pd->mutex);
+
+    return 1;
+}
+
+/* Merge what the probe decoder of a stream found into its internal context. */
+static void probe_decode_update(ProbeDecodeStream *ps)
+{
+    AVStream *st          = ps->st;
+    AVCodecContext *avctx = st->internal->avctx;
+    AVCodecContext *dec   = ps->avctx;
+
+#define COPY_IF_SET(field, unset)       \
+    if (dec->field != unset)            \
+        avctx->field = dec->field
+
+    st->info->found_decoder = ps->found_decoder;
+    st->nb_decoded_frames   = ps->nb_decoded_frames;
+    if (!avcodec_is_open(dec))
+        return;
+
+    COPY_IF_SET(profile,             FF_PROFILE_UNKNOWN);
+    COPY_IF_SET(level,               FF_LEVEL_UNKNOWN);
+    COPY_IF_SET(bits_per_raw_sample, 0);
+    avctx->properties |= dec->properties;
+
+    if (dec->codec_type == AVMEDIA_TYPE_VIDEO) {
+        COPY_IF_SET(width,                  0);
+        COPY_IF_SET(height,                 0);
+        COPY_IF_SET(coded_width,            0);
+        COPY_IF_SET(coded_height,           0);
+        COPY_IF_SET(pix_fmt,                AV_PIX_FMT_NONE);
+        COPY_IF_SET(sample_aspect_ratio.num, 0);
+        COPY_IF_SET(sample_aspect_ratio.den, 0);
+        COPY_IF_SET(field_order,            AV_FIELD_UNKNOWN);
+        COPY_IF_SET(color_range,            AVCOL_RANGE_UNSPECIFIED);
+        COPY_IF_SET(color_primaries,        AVCOL_PRI_UNSPECIFIED);
+        COPY_IF_SET(color_trc,              AVCOL_TRC_UNSPECIFIED);
+        COPY_IF_SET(colorspace,             AVCOL_SPC_UNSPECIFIED);
+        COPY_IF_SET(chroma_sample_location, AVCHROMA_LOC_UNSPECIFIED);
+        avctx->has_b_frames    = FFMAX(avctx->has_b_frames, dec->has_b_frames);
+        avctx->ticks_per_frame = dec->ticks_per_frame;
+        if (dec->framerate.num > 0 && dec->framerate.den > 0) {
+            avctx->framerate = dec->framerate;
+            avctx->time_base = dec->time_base;
+        }
+    } else {
+        COPY_IF_SET(sample_fmt,         AV_SAMPLE_FMT_NONE);
+        COPY_IF_SET(sample_rate,        0);
+        COPY_IF_SET(channels,           0);
+        COPY_IF_SET(channel_layout,     0);
+        COPY_IF_SET(frame_size,         0);
+        COPY_IF_SET(audio_service_type, AV_AUDIO_SERVICE_TYPE_MAIN);
+    }
+#undef COPY_IF_SET
+}
+
+/**
+ * Merge the results of the workers into the streams. With wait set, first
+ * wait for all queued packets and flushes to be decoded; otherwise the
+ * streams being decoded are left for a later call.
+ */
+static void probe_decode_sync(ProbeDecodeContext *pd, int wait)
+{
+    int i;
+
+    for (i = 0; i < pd->nb_streams; i++)
+        probe_decode_check_update(pd, i);
+
+    pthread_mutex_lock(&pd->mutex);
+    for (i = 0; i < pd->nb_streams; i++) {
+        ProbeDecodeStream *ps = pd->streams[i];
+
+        if (!ps)
+            continue;
+        while (wait && (ps->busy || ps->flush || av_fifo_size(ps->queue)))
+            pthread_cond_wait(&pd->cond, &pd->mutex);
+        if (ps->busy || !ps->updated)
+            continue;
+        probe_decode_update(ps);
+        ps->updated = 0;
+    }
+    pthread_mutex_unlock(&pd->mutex);
+}
+
+/* Flush the decoders of the streams decoded by the workers. */
+static void probe_decode_flush(ProbeDecodeContext *pd)
+{
+    int i;
+
+    for (i = 0; i < pd->nb_streams; i++)
+        probe_decode_check_update(pd, i);
+
+    pthread_mutex_lock(&pd->mutex);
+    for (i = 0; i < pd->nb_streams; i++) {
+        ProbeDecodeStream *ps = pd->streams[i];
+
+        if (ps && ps->found_decoder == 1) {
+            ps->flush           = 1;
+            ps->flush_nb_frames = ps->st->codec_info_nb_frames;
+            ps->flush_ret       = 0;
+        }
+    }
+    pthread_cond_broadcast(&pd->cond);
+    pthread_mutex_unlock(&pd->mutex);
+
+    probe_decode_sync(pd, 1);
+
+    for (i = 0; i < pd->nb_streams; i++) {
+        ProbeDecodeStream *ps = pd->streams[i];
+
+        if (ps && ps->flush_ret < 0)
+            av_log(pd->s, AV_LOG_INFO,
+                   "decoding for stream %d failed\n", ps->st->index);
+    }
+}
+#endif /* HAVE_THREADS */
+
 unsigned int ff_codec_get_tag(const AVCodecTag *tags, enum AVCodecID id)
 {
     while (tags->id != AV_CODEC_ID_NONE) {
@@ -3614,6 +4111,10 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
     int *missing_streams = av_opt_ptr(ic->iformat->priv_class, ic->priv_data, "missing_streams");
+    char probe_cache_path[1024] = "";
+#if HAVE_THREADS
+    ProbeDecodeContext *pd = NULL;
+#endif
 
     flush_codecs = probesize > 0;
 
@@ -3635,6 +4136,13 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
         av_log(ic, AV_LOG_DEBUG, "Before avformat_find_stream_info() pos: %"PRId64" bytes read:%"PRId64" seeks:%d nb_streams:%d\n",
                avio_tell(ic->pb), ic->pb->bytes_read, ic->pb->seek_count, ic->nb_streams);
 
+    if (ic->probe_cache &&
+        ff_probe_cache_path(ic, probe_cache_path, sizeof(probe_cache_path)) >= 0 &&
+        ff_probe_cache_load(ic, probe_cache_path) > 0) {
+        ret = 0;
+        goto find_stream_info_err;
+    }
+
     for (i = 0; i < ic->nb_streams; i++) {
         const AVCodec *codec;
         AVDictionary *thread_opt = NULL;
@@ -3720,6 +4228,15 @@ FF_ENABLE_DEPRECATION_WARNINGS
         ic->streams[i]->info->fps_last_dts  = AV_NOPTS_VALUE;
     }
 
+#if HAVE_THREADS
+    ret = probe_decode_init(ic, &pd);
+    if (ret < 0) {
+        av_log(ic, AV_LOG_WARNING, "Failed to start the decoding threads: %s\n",
+               av_err2str(ret));
+        ret = 0;
+    }
+#endif
+
     read_size = 0;
     for (;;) {
         const AVPacket *pkt;
@@ -3730,6 +4247,11 @@ FF_ENABLE_DEPRECATION_WARNINGS
             break;
         }
 
+#if HAVE_THREADS
+        if (pd)
+            probe_decode_sync(pd, 0);
+#endif
+
         /* check if one codec still needs to be handled */
         for (i = 0; i < ic->nb_streams; i++) {
             int fps_analyze_framecount = 20;
@@ -3936,8 +4458,16 @@ FF_ENABLE_DEPRECATION_WARNINGS
          * least one frame of codec data, this makes sure the codec initializes
          * the channel configuration and does not only trust the values from
          * the container. */
-        try_decode_frame(ic, st, pkt,
-                         (options && i < orig_nb_streams) ? &options[i] : NULL);
+        ret = 0;
+#if HAVE_THREADS
+        if (pd && (ret = probe_decode_send(pd, st, pkt,
+                                           (options && st->index < orig_nb_streams) ?
+                                           &options[st->index] : NULL)) < 0)
+            goto unref_then_goto_end;
+#endif
+        if (!ret)
+            try_decode_frame(ic, st, pkt,
+                             (options && i < orig_nb_streams) ? &options[i] : NULL);
 
         if (ic->flags & AVFMT_FLAG_NOBUFFER)
             av_packet_unref(&pkt1);
@@ -3946,6 +4476,11 @@ FF_ENABLE_DEPRECATION_WARNINGS
         count++;
     }
 
+#if HAVE_THREADS
+    if (pd)
+        probe_decode_sync(pd, 1);
+#endif
+
     if (eof_reached) {
         int stream_index;
         for (stream_index = 0; stream_index < ic->nb_streams; stream_index++) {
@@ -3977,10 +4512,19 @@ FF_ENABLE_DEPRECATION_WARNINGS
         int err = 0;
         av_init_packet(&empty_pkt);
 
+#if HAVE_THREADS
+        if (pd)
+            probe_decode_flush(pd);
+#endif
+
         for (i = 0; i < ic->nb_streams; i++) {
 
             st = ic->streams[i];
 
+#if HAVE_THREADS
+            if (pd && i < pd->nb_streams && pd->streams[i])
+                continue;
+#endif
             /* flush the decoders */
             if (st->info->found_decoder == 1) {
                 do {
@@ -3997,6 +4541,10 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
     }
 
+#if HAVE_THREADS
+    probe_decode_free(&pd);
+#endif
+
     ff_rfps_calculate(ic);
 
     for (i = 0; i < ic->nb_streams; i++) {
@@ -4186,7 +4734,14 @@ FF_ENABLE_DEPRECATION_WARNINGS
         st->internal->avctx_inited = 0;
     }
 
+    /* only cache the streams that are known once the header is read */
+    if (*probe_cache_path && ret >= 0 && ic->nb_streams == orig_nb_streams)
+        ff_probe_cache_store(ic, probe_cache_path);
+
 find_stream_info_err:
+#if HAVE_THREADS
+    probe_decode_free(&pd);
+#endif
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
         if (st->info)
@@ -284,6 +284,41 @@ void av_buffer_pool_uninit(AVBufferPool **pool);
  */
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool);
 
+/**
+ * Usage statistics of a buffer pool, as returned by av_buffer_pool_get_stats().
+ *
+ * sizeof(AVBufferPoolStats) is not a part of the public ABI, new fields may be
+ * added to the end with a minor version bump.
+ */
+typedef struct AVBufferPoolStats {
+    /**
+     * Number of av_buffer_pool_get() calls served with a buffer from the pool.
+     */
+    uint64_t nb_hits;
+    /**
+     * Number of av_buffer_pool_get() calls for which a new buffer had to be
+     * allocated. Since buffers are only freed with the pool, this is also the
+     * number of buffers owned by the pool.
+     */
+    uint64_t nb_misses;
+    /**
+     * Number of buffers currently handed out to the caller.
+     */
+    int nb_in_use;
+    /**
+     * Largest number of buffers that were handed out at the same time.
+     */
+    int max_in_use;
+} AVBufferPoolStats;
+
+/**
+ * Retrieve usage statistics of the pool, e.g. to tune its size.
+ * This function may be called simultaneously from multiple threads.
+ *
+ * @param stats structure to be filled with the current statistics
+ */
+void av_buffer_pool_get_stats(AVBufferPool *pool, AVBufferPoolStats *stats);
+
 /**
  * @}
  */
@@ -33,6 +33,11 @@
  * The buffer was av_realloc()ed, so it is reallocatable.
  */
 #define BUFFER_FLAG_REALLOCATABLE (1 << 1)
+/**
+ * The AVBuffer structure is part of a larger structure
+ * and should not be freed.
+ */
+#define BUFFER_FLAG_NO_FREE       (1 << 2)
 
 struct AVBuffer {
     uint8_t *data; /**< data described by this buffer */
@@ -71,6 +76,13 @@ typedef struct BufferPoolEntry {
 
     AVBufferPool *pool;
     struct BufferPoolEntry *next;
+
+    /*
+     * An AVBuffer structure to (re)use as AVBuffer for subsequent uses
+     * of this BufferPoolEntry, so that av_buffer_pool_get() only needs
+     * to allocate the AVBufferRef.
+     */
+    AVBuffer buffer;
 } BufferPoolEntry;
 
 struct AVBufferPool {
@@ -93,6 +105,12 @@ struct AVBufferPool {
     AVBufferRef* (*alloc)(int size);
     AVBufferRef* (*alloc2)(void *opaque, int size);
     void         (*pool_free)(void *opaque);
+
+    /* statistics, protected by mutex */
+    uint64_t nb_hits;
+    uint64_t nb_misses;
+    int      nb_in_use;
+    int      max_in_use;
 };
 
 #endif /* AVUTIL_BUFFER_INTERNAL_H */
@@ -48,6 +48,7 @@
 #endif
 
 static atomic_int cpu_flags = ATOMIC_VAR_INIT(-1);
+static atomic_int shared_pool_size = ATOMIC_VAR_INIT(0);
 
 static int get_cpu_flags(void)
 {
@@ -306,6 +307,16 @@ int av_cpu_count(void)
     return nb_cpus;
 }
 
+void av_cpu_set_shared_pool_size(int count)
+{
+    atomic_store_explicit(&shared_pool_size, FFMAX(count, 0), memory_order_relaxed);
+}
+
+int av_cpu_get_shared_pool_size(void)
+{
+    return atomic_load_explicit(&shared_pool_size, memory_order_relaxed);
+}
+
 size_t av_cpu_max_align(void)
 {
     if (ARCH_AARCH64)
@@ -116,6 +116,28 @@ int av_parse_cpu_caps(unsigned *flags, const char *s);
  */
 int av_cpu_count(void);
 
+/**
+ * Set the number of worker threads of the process-wide pool shared by
+ * slice threading contexts.
+ *
+ * When non-zero, the slice threading contexts of libavfilter graphs and
+ * libswscale contexts created after this call borrow workers from a single
+ * pool of at most count threads instead of spawning their own, which bounds
+ * the total number of threads when many of them run concurrently. Codecs
+ * always keep their own threads. Contexts that already exist are not
+ * affected. The pool is started with the first context using it and
+ * stopped when the last one is freed.
+ *
+ * @param count number of worker threads, 0 (the default) to give every
+ *              context its own threads
+ */
+void av_cpu_set_shared_pool_size(int count);
+
+/**
+ * @return the number of worker threads set by av_cpu_set_shared_pool_size()
+ */
+int av_cpu_get_shared_pool_size(void);
+
 /**
  * Get the maximum data alignment that may be required by FFmpeg.
  *
@@ -18,6 +18,7 @@
 
 #include <stdatomic.h>
 #include "slicethread.h"
+#include "cpu.h"
 #include "mem.h"
 #include "thread.h"
 #include "avassert.h"
@@ -32,6 +33,26 @@ typedef struct WorkerContext {
     int             done;
 } WorkerContext;
 
+/**
+ * Process-wide pool of workers, see av_cpu_set_shared_pool_size().
+ *
+ * Contexts with pending jobs are queued and served round-robin, one worker
+ * at a time, so that a context with many jobs cannot starve the others.
+ * The thread calling avpriv_slicethread_execute() always runs jobs itself,
+ * so progress never depends on a free worker.
+ */
+typedef struct SharedPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    pthread_t       *threads;
+    int             nb_threads;
+    int             finished;
+    int             refcount;
+
+    AVSliceThread   *queue_head;
+    AVSliceThread   *queue_tail;
+} SharedPool;
+
 struct AVSliceThread {
     WorkerContext   *workers;
     int             nb_threads;
@@ -48,8 +69,25 @@ struct AVSliceThread {
     void            *priv;
     void            (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads);
     void            (*main_func)(void *priv);
+
+    /* shared pool state, protected by pool->mutex */
+    SharedPool      *pool;
+    AVSliceThread   *next;
+    int             queued;
+    int             nb_helpers;
+    int             max_helpers;
+    int             nb_running;
 };
 
+static pthread_mutex_t shared_pool_lock;
+static SharedPool *shared_pool;
+static AVOnce shared_pool_once = AV_ONCE_INIT;
+
+static void shared_pool_init_lock(void)
+{
+    pthread_mutex_init(&shared_pool_lock, NULL);
+}
+
 static int run_jobs(AVSliceThread *ctx)
 {
     unsigned nb_jobs    = ctx->nb_jobs;
@@ -91,13 +129,179 @@ static void *attribute_align_arg thread_worker(void *v)
     }
 }
 
-int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
+static void run_shared_jobs(AVSliceThread *ctx, int threadnr)
+{
+    unsigned nb_jobs = ctx->nb_jobs;
+    unsigned jobnr;
+
+    while ((jobnr = atomic_fetch_add_explicit(&ctx->current_job, 1, memory_order_acq_rel)) < nb_jobs)
+        ctx->worker_func(ctx->priv, jobnr, threadnr, nb_jobs, ctx->nb_active_threads);
+}
+
+static void pool_enqueue(SharedPool *pool, AVSliceThread *ctx)
+{
+    ctx->next   = NULL;
+    ctx->queued = 1;
+    if (pool->queue_tail)
+        pool->queue_tail->next = ctx;
+    else
+        pool->queue_head = ctx;
+    pool->queue_tail = ctx;
+}
+
+static void pool_dequeue(SharedPool *pool, AVSliceThread *ctx)
+{
+    AVSliceThread **p = &pool->queue_head, *prev = NULL;
+
+    while (*p != ctx) {
+        prev = *p;
+        p    = &prev->next;
+    }
+    *p = ctx->next;
+    if (pool->queue_tail == ctx)
+        pool->queue_tail = prev;
+    ctx->next   = NULL;
+    ctx->queued = 0;
+}
+
+static void *attribute_align_arg shared_worker(void *v)
+{
+    SharedPool *pool = v;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->finished) {
+        AVSliceThread *ctx = pool->queue_head;
+        int threadnr;
+
+        if (!ctx) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            continue;
+        }
+
+        /* take one helper slot and requeue the context at the tail,
+         * so that the next free worker serves another context first */
+        threadnr = ++ctx->nb_helpers;
+        pool_dequeue(pool, ctx);
+        if (ctx->nb_helpers < ctx->max_helpers)
+            pool_enqueue(pool, ctx);
+        ctx->nb_running++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_shared_jobs(ctx, threadnr);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (!--ctx->nb_running)
+            pthread_cond_signal(&ctx->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+static void shared_pool_stop(SharedPool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->finished = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nb_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    av_freep(&pool->threads);
+    av_free(pool);
+}
+
+/* must be called with shared_pool_lock held */
+static SharedPool *shared_pool_ref(int nb_threads)
+{
+    SharedPool *pool = shared_pool;
+    int i;
+
+    if (pool) {
+        pool->refcount++;
+        return pool;
+    }
+
+    pool = av_mallocz(sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->threads = av_calloc(nb_threads, sizeof(*pool->threads));
+    if (!pool->threads) {
+        av_free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, shared_worker, pool))
+            break;
+        pool->nb_threads++;
+    }
+    if (!pool->nb_threads) {
+        shared_pool_stop(pool);
+        return NULL;
+    }
+
+    pool->refcount = 1;
+    shared_pool    = pool;
+    return pool;
+}
+
+static void shared_pool_unref(SharedPool *pool)
+{
+    pthread_mutex_lock(&shared_pool_lock);
+    if (--pool->refcount) {
+        pthread_mutex_unlock(&shared_pool_lock);
+        return;
+    }
+    shared_pool = NULL;
+    pthread_mutex_unlock(&shared_pool_lock);
+
+    shared_pool_stop(pool);
+}
+
+static void execute_shared(AVSliceThread *ctx)
+{
+    SharedPool *pool = ctx->pool;
+
+    ctx->nb_helpers  = 0;
+    ctx->max_helpers = ctx->nb_active_threads - 1;
+
+    if (ctx->max_helpers) {
+        pthread_mutex_lock(&pool->mutex);
+        pool_enqueue(pool, ctx);
+        if (ctx->max_helpers > 1)
+            pthread_cond_broadcast(&pool->cond);
+        else
+            pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    run_shared_jobs(ctx, 0);
+
+    if (ctx->max_helpers) {
+        pthread_mutex_lock(&pool->mutex);
+        if (ctx->queued)
+            pool_dequeue(pool, ctx);
+        while (ctx->nb_running)
+            pthread_cond_wait(&ctx->done_cond, &pool->mutex);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static int slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
                               void (*main_func)(void *priv),
-                              int nb_threads)
+                              int nb_threads, int shared)
 {
     AVSliceThread *ctx;
-    int nb_workers, i;
+    int nb_workers, pool_size, i;
 
     av_assert0(nb_threads >= 0);
     if (!nb_threads) {
@@ -116,6 +320,28 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     if (!ctx)
         return AVERROR(ENOMEM);
 
+    /* Only the callers whose jobs never wait on each other opt in, the
+     * pool does not guarantee that all the jobs run concurrently. */
+    pool_size = shared ? av_cpu_get_shared_pool_size() : 0;
+    if (pool_size && !main_func && nb_workers) {
+        ff_thread_once(&shared_pool_once, shared_pool_init_lock);
+        pthread_mutex_lock(&shared_pool_lock);
+        ctx->pool = shared_pool_ref(pool_size);
+        if (ctx->pool)
+            nb_threads = FFMIN(nb_threads, ctx->pool->nb_threads + 1);
+        pthread_mutex_unlock(&shared_pool_lock);
+        if (ctx->pool) {
+            ctx->priv        = priv;
+            ctx->worker_func = worker_func;
+            ctx->nb_threads  = nb_threads;
+            atomic_init(&ctx->first_job, 0);
+            atomic_init(&ctx->current_job, 0);
+            pthread_mutex_init(&ctx->done_mutex, NULL);
+            pthread_cond_init(&ctx->done_cond, NULL);
+            return nb_threads;
+        }
+    }
+
     if (nb_workers && !(ctx->workers = av_calloc(nb_workers, sizeof(*ctx->workers)))) {
         av_freep(pctx);
         return AVERROR(ENOMEM);
@@ -161,6 +387,21 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return nb_threads;
 }
 
+int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
+                              void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                              void (*main_func)(void *priv),
+                              int nb_threads)
+{
+    return slicethread_create(pctx, priv, worker_func, main_func, nb_threads, 0);
+}
+
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads)
+{
+    return slicethread_create(pctx, priv, worker_func, NULL, nb_threads, 1);
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     int nb_workers, i, is_last = 0;
@@ -168,6 +409,13 @@ void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_mai
     av_assert0(nb_jobs > 0);
     ctx->nb_jobs           = nb_jobs;
     ctx->nb_active_threads = FFMIN(nb_jobs, ctx->nb_threads);
+
+    if (ctx->pool) {
+        atomic_store_explicit(&ctx->current_job, 0, memory_order_relaxed);
+        execute_shared(ctx);
+        return;
+    }
+
     atomic_store_explicit(&ctx->first_job, 0, memory_order_relaxed);
     atomic_store_explicit(&ctx->current_job, ctx->nb_active_threads, memory_order_relaxed);
     nb_workers             = ctx->nb_active_threads;
@@ -205,6 +453,15 @@ void avpriv_slicethread_free(AVSliceThread **pctx)
         return;
 
     ctx = *pctx;
+
+    if (ctx->pool) {
+        shared_pool_unref(ctx->pool);
+        pthread_cond_destroy(&ctx->done_cond);
+        pthread_mutex_destroy(&ctx->done_mutex);
+        av_freep(pctx);
+        return;
+    }
+
     nb_workers = ctx->nb_threads;
     if (!ctx->main_func)
         nb_workers--;
@@ -242,6 +499,14 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
     return AVERROR(EINVAL);
 }
 
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads)
+{
+    *pctx = NULL;
+    return AVERROR(EINVAL);
+}
+
 void avpriv_slicethread_execute(AVSliceThread *ctx, int nb_jobs, int execute_main)
 {
     av_assert0(0);
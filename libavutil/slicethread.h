@@ -35,6 +35,17 @@ int avpriv_slicethread_create(AVSliceThread **pctx, void *priv,
                               void (*main_func)(void *priv),
                               int nb_threads);
 
+/**
+ * Create slice threading context borrowing its workers from the shared pool
+ * set with av_cpu_set_shared_pool_size(), if any.
+ * The pool does not guarantee that all the jobs run concurrently, so this
+ * must only be used when the jobs never wait on each other.
+ * @see avpriv_slicethread_create()
+ */
+int avpriv_slicethread_create_shared(AVSliceThread **pctx, void *priv,
+                                     void (*worker_func)(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads),
+                                     int nb_threads);
+
 /**
  * Execute slice threading.
  * @param ctx slice threading context
@@ -30,6 +30,8 @@ struct AVThreadMessageQueue {
     pthread_cond_t cond_send;
     int err_send;
     int err_recv;
+    int nb_waiting_send;
+    int nb_waiting_recv;
     unsigned elsize;
     void (*free_func)(void *msg);
 #else
@@ -117,38 +119,78 @@ int av_thread_message_queue_nb_elems(AVThreadMessageQueue *mq)
 
 #if HAVE_THREADS
 
+/* Waking up the other side only when it actually waits saves the cost of
+ * the signal while both threads are busy, which is the common case. */
+static void wake_recv(AVThreadMessageQueue *mq, unsigned nb_msgs)
+{
+    if (!mq->nb_waiting_recv)
+        return;
+    if (nb_msgs > 1)
+        pthread_cond_broadcast(&mq->cond_recv);
+    else
+        pthread_cond_signal(&mq->cond_recv);
+}
+
+static void wake_send(AVThreadMessageQueue *mq, unsigned nb_msgs)
+{
+    if (!mq->nb_waiting_send)
+        return;
+    if (nb_msgs > 1)
+        pthread_cond_broadcast(&mq->cond_send);
+    else
+        pthread_cond_signal(&mq->cond_send);
+}
+
 static int av_thread_message_queue_send_locked(AVThreadMessageQueue *mq,
-                                               void *msg,
+                                               void *msgs,
+                                               unsigned nb_msgs,
                                                unsigned flags)
 {
-    while (!mq->err_send && av_fifo_space(mq->fifo) < mq->elsize) {
-        if ((flags & AV_THREAD_MESSAGE_NONBLOCK))
-            return AVERROR(EAGAIN);
-        pthread_cond_wait(&mq->cond_send, &mq->lock);
+    unsigned sent = 0;
+
+    while (sent < nb_msgs) {
+        unsigned n;
+
+        while (!mq->err_send && av_fifo_space(mq->fifo) < mq->elsize) {
+            if ((flags & AV_THREAD_MESSAGE_NONBLOCK))
+                return sent ? sent : AVERROR(EAGAIN);
+            mq->nb_waiting_send++;
+            pthread_cond_wait(&mq->cond_send, &mq->lock);
+            mq->nb_waiting_send--;
+        }
+        if (mq->err_send)
+            return sent ? sent : mq->err_send;
+        n = FFMIN(nb_msgs - sent, av_fifo_space(mq->fifo) / mq->elsize);
+        av_fifo_generic_write(mq->fifo, (uint8_t *)msgs + sent * mq->elsize,
+                              n * mq->elsize, NULL);
+        /* signal as many receivers as messages were sent */
+        wake_recv(mq, n);
+        sent += n;
     }
-    if (mq->err_send)
-        return mq->err_send;
-    av_fifo_generic_write(mq->fifo, msg, mq->elsize, NULL);
-    /* one message is sent, signal one receiver */
-    pthread_cond_signal(&mq->cond_recv);
-    return 0;
+    return sent;
 }
 
 static int av_thread_message_queue_recv_locked(AVThreadMessageQueue *mq,
-                                               void *msg,
+                                               void *msgs,
+                                               unsigned nb_msgs,
                                                unsigned flags)
 {
+    unsigned n;
+
     while (!mq->err_recv && av_fifo_size(mq->fifo) < mq->elsize) {
         if ((flags & AV_THREAD_MESSAGE_NONBLOCK))
             return AVERROR(EAGAIN);
+        mq->nb_waiting_recv++;
         pthread_cond_wait(&mq->cond_recv, &mq->lock);
+        mq->nb_waiting_recv--;
     }
     if (av_fifo_size(mq->fifo) < mq->elsize)
         return mq->err_recv;
-    av_fifo_generic_read(mq->fifo, msg, mq->elsize, NULL);
-    /* one message space appeared, signal one sender */
-    pthread_cond_signal(&mq->cond_send);
-    return 0;
+    n = FFMIN(nb_msgs, av_fifo_size(mq->fifo) / mq->elsize);
+    av_fifo_generic_read(mq->fifo, msgs, n * mq->elsize, NULL);
+    /* signal as many senders as message spaces appeared */
+    wake_send(mq, n);
+    return n;
 }
 
 #endif /* HAVE_THREADS */
@@ -161,9 +203,9 @@ int av_thread_message_queue_send(AVThreadMessageQueue *mq,
     int ret;
 
     pthread_mutex_lock(&mq->lock);
-    ret = av_thread_message_queue_send_locked(mq, msg, flags);
+    ret = av_thread_message_queue_send_locked(mq, msg, 1, flags);
     pthread_mutex_unlock(&mq->lock);
-    return ret;
+    return FFMIN(ret, 0);
 #else
     return AVERROR(ENOSYS);
 #endif /* HAVE_THREADS */
@@ -177,7 +219,45 @@ int av_thread_message_queue_recv(AVThreadMessageQueue *mq,
     int ret;
 
     pthread_mutex_lock(&mq->lock);
-    ret = av_thread_message_queue_recv_locked(mq, msg, flags);
+    ret = av_thread_message_queue_recv_locked(mq, msg, 1, flags);
+    pthread_mutex_unlock(&mq->lock);
+    return FFMIN(ret, 0);
+#else
+    return AVERROR(ENOSYS);
+#endif /* HAVE_THREADS */
+}
+
+int av_thread_message_queue_send_multiple(AVThreadMessageQueue *mq,
+                                          void *msgs,
+                                          unsigned nb_msgs,
+                                          unsigned flags)
+{
+#if HAVE_THREADS
+    int ret;
+
+    if (!nb_msgs || nb_msgs > INT_MAX)
+        return AVERROR(EINVAL);
+    pthread_mutex_lock(&mq->lock);
+    ret = av_thread_message_queue_send_locked(mq, msgs, nb_msgs, flags);
+    pthread_mutex_unlock(&mq->lock);
+    return ret;
+#else
+    return AVERROR(ENOSYS);
+#endif /* HAVE_THREADS */
+}
+
+int av_thread_message_queue_recv_multiple(AVThreadMessageQueue *mq,
+                                          void *msgs,
+                                          unsigned nb_msgs,
+                                          unsigned flags)
+{
+#if HAVE_THREADS
+    int ret;
+
+    if (!nb_msgs || nb_msgs > INT_MAX)
+        return AVERROR(EINVAL);
+    pthread_mutex_lock(&mq->lock);
+    ret = av_thread_message_queue_recv_locked(mq, msgs, nb_msgs, flags);
     pthread_mutex_unlock(&mq->lock);
     return ret;
 #else
@@ -66,6 +66,41 @@ int av_thread_message_queue_recv(AVThreadMessageQueue *mq,
                                  void *msg,
                                  unsigned flags);
 
+/**
+ * Send several messages on the queue at once.
+ *
+ * This is equivalent to sending the messages one by one, but the queue is
+ * locked and the receivers are woken up only once for all the messages that
+ * fit in the queue.
+ *
+ * @param msgs    array of nb_msgs messages
+ * @param nb_msgs number of messages to send, must be > 0
+ * @return  the number of messages sent, which is less than nb_msgs only if
+ *          the sending error code was set or, with AV_THREAD_MESSAGE_NONBLOCK,
+ *          if the queue became full; a negative AVERROR code if no message
+ *          could be sent
+ */
+int av_thread_message_queue_send_multiple(AVThreadMessageQueue *mq,
+                                          void *msgs,
+                                          unsigned nb_msgs,
+                                          unsigned flags);
+
+/**
+ * Receive several messages from the queue at once.
+ *
+ * Wait until at least one message is available (unless
+ * AV_THREAD_MESSAGE_NONBLOCK is set), then return all the available
+ * messages, up to nb_msgs.
+ *
+ * @param msgs    array of nb_msgs messages
+ * @param nb_msgs maximum number of messages to receive, must be > 0
+ * @return  the number of messages received, or a negative AVERROR code
+ */
+int av_thread_message_queue_recv_multiple(AVThreadMessageQueue *mq,
+                                          void *msgs,
+                                          unsigned nb_msgs,
+                                          unsigned flags);
+
 /**
  * Set the sending error code.
  *
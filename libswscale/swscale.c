@@ -242,6 +242,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
      * and faster */
     const int dstW                   = c->dstW;
     const int dstH                   = c->dstH;
+    const int dstEnd                 = c->dst_slice_end ? c->dst_slice_end : dstH;
 
     const enum AVPixelFormat dstFormat = c->dstFormat;
     const int flags                  = c->flags;
@@ -338,7 +339,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
     if (srcSliceY == 0) {
         lumBufIndex  = -1;
         chrBufIndex  = -1;
-        dstY         = 0;
+        dstY         = c->dst_slice_start;
         lastInLumBuf = -1;
         lastInChrBuf = -1;
     }
@@ -370,7 +371,7 @@ static int swscale(SwsContext *c, const uint8_t *src[],
         hout_slice->width = dstW;
     }
 
-    for (; dstY < dstH; dstY++) {
+    for (; dstY < dstEnd; dstY++) {
         const int chrDstY = dstY >> c->chrDstVSubSample;
         int use_mmx_vfilter= c->use_mmx_vfilter;
 
@@ -605,6 +606,37 @@ SwsFunc ff_getSwsFunc(SwsContext *c)
     return swscale;
 }
 
+void ff_sws_slice_worker(void *priv, int jobnr, int threadnr,
+                         int nb_jobs, int nb_threads)
+{
+    SwsContext *parent = priv;
+    SwsContext      *c = parent->slice_ctx[threadnr];
+    const int slice_h  = FFALIGN((parent->dstH + nb_jobs - 1) / nb_jobs,
+                                 1 << parent->chrDstVSubSample);
+    const uint8_t *src[4];
+    uint8_t *dst[4];
+    int srcStride[4];
+    int dstStride[4];
+
+    c->dst_slice_start = jobnr * slice_h;
+    c->dst_slice_end   = FFMIN(c->dst_slice_start + slice_h, parent->dstH);
+    if (c->dst_slice_start >= c->dst_slice_end)
+        return;
+
+    // swscale() modifies the pointers and strides, give each slice a copy
+    memcpy(src,       parent->slice_src,        sizeof(src));
+    memcpy(srcStride, parent->slice_src_stride, sizeof(srcStride));
+    memcpy(dst,       parent->slice_dst,        sizeof(dst));
+    memcpy(dstStride, parent->slice_dst_stride, sizeof(dstStride));
+
+    if (usePal(c->srcFormat)) {
+        memcpy(c->pal_yuv, parent->pal_yuv, sizeof(c->pal_yuv));
+        memcpy(c->pal_rgb, parent->pal_rgb, sizeof(c->pal_rgb));
+    }
+
+    c->swscale(c, src, srcStride, 0, c->srcH, dst, dstStride);
+}
+
 static void reset_ptr(const uint8_t *src[], enum AVPixelFormat format)
 {
     if (!isALPHA(format))
@@ -975,7 +1007,15 @@ int attribute_align_arg sws_scale(struct SwsContext *c,
     /* reset slice direction at end of frame */
     if (srcSliceY_internal + srcSliceH == c->srcH)
         c->sliceDir = 0;
-    ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
+    if (c->slicethread && srcSliceY_internal == 0 && srcSliceH == c->srcH) {
+        memcpy(c->slice_src,        src2,       sizeof(c->slice_src));
+        memcpy(c->slice_src_stride, srcStride2, sizeof(c->slice_src_stride));
+        memcpy(c->slice_dst,        dst2,       sizeof(c->slice_dst));
+        memcpy(c->slice_dst_stride, dstStride2, sizeof(c->slice_dst_stride));
+        avpriv_slicethread_execute(c->slicethread, c->nb_slice_ctx, 0);
+        ret = c->dstH;
+    } else
+        ret = c->swscale(c, src2, srcStride2, srcSliceY_internal, srcSliceH, dst2, dstStride2);
 
     if (c->dstXYZ && !(c->srcXYZ && c->srcW==c->dstW && c->srcH==c->dstH)) {
         int dstY = c->dstY ? c->dstY : srcSliceY + srcSliceH;
@@ -31,6 +31,7 @@
 #include "libavutil/log.h"
 #include "libavutil/pixfmt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/slicethread.h"
 #include "libavutil/ppc/util_altivec.h"
 
 #define STR(s) AV_TOSTRING(s) // AV_STRINGIFY is too long
@@ -321,6 +322,21 @@ typedef struct SwsContext {
     uint8_t *cascaded1_tmp[4];
     int cascaded_mainindex;
 
+    /* The slice_* fields allow splitting a scaler task into horizontal bands
+     * of the destination which are processed in parallel. Every band is
+     * scaled by its own context so that each thread has its own ring buffers.
+     */
+    int nb_threads;               ///< Number of requested threads, 0 for automatic.
+    AVSliceThread *slicethread;
+    struct SwsContext **slice_ctx;
+    int nb_slice_ctx;
+    int dst_slice_start;          ///< First destination line scaled by a slice context.
+    int dst_slice_end;            ///< Last destination line + 1 scaled by a slice context, 0 for dstH.
+    const uint8_t *slice_src[4];
+    int slice_src_stride[4];
+    uint8_t *slice_dst[4];
+    int slice_dst_stride[4];
+
     double gamma_value;
     int gamma_flag;
     int is_internal_gamma;
@@ -858,6 +874,13 @@ void ff_get_unscaled_swscale_aarch64(SwsContext *c);
  */
 SwsFunc ff_getSwsFunc(SwsContext *c);
 
+/**
+ * Slice thread callback scaling one horizontal band of the destination
+ * image set up by sws_scale() in the slice_* fields of the parent context.
+ */
+void ff_sws_slice_worker(void *priv, int jobnr, int threadnr,
+                         int nb_jobs, int nb_threads);
+
 void ff_sws_init_input_funcs(SwsContext *c);
 void ff_sws_init_output_funcs(SwsContext *c,
                               yuv2planar1_fn *yuv2plane1,
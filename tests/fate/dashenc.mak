@@ -0,0 +1,16 @@
+tests/data/dash_timeline.mpd: TAG = GEN
+tests/data/dash_timeline.mpd: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< \
+	-f lavfi -i "aevalsrc=cos(2*PI*t)*sin(2*PI*(440+4*t)*t):d=9" -map 0 -codec:a mp2fixed \
+	-flags +bitexact -fflags +bitexact -f dash -seg_duration 1 -use_timeline 1 -use_template 1 \
+	-window_size 4 -init_seg_name 'dash_timeline_init.$$ext$$' \
+	-media_seg_name 'dash_timeline_$$Number%05d$$.$$ext$$' \
+	$(TARGET_PATH)/tests/data/dash_timeline.mpd 2>/dev/null
+
+FATE_DASHENC-$(call ALLYES, DASH_MUXER MP4_MUXER AEVALSRC_FILTER LAVFI_INDEV MP2FIXED_ENCODER) += fate-dash-timeline
+fate-dash-timeline: tests/data/dash_timeline.mpd
+fate-dash-timeline: CMD = cat $(TARGET_PATH)/tests/data/dash_timeline.mpd
+
+FATE_FFMPEG += $(FATE_DASHENC-yes)
+
+fate-dashenc: $(FATE_DASHENC-yes)
@@ -29,6 +29,27 @@ FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_xml
 fate-ffprobe_xml: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xml: CMD = run $(FFPROBE_COMMAND) -of xml
 
+FFPROBE_STREAMS_FILE=tests/data/ffprobe-streams.ts
+FFPROBE_STREAMS_COMMAND=ffprobe$(PROGSSUF)$(EXESUF) -v 0 -show_streams -bitexact -of compact $(FFPROBE_STREAMS_FILE)
+
+tests/data/ffprobe-streams.ts: TAG = GEN
+tests/data/ffprobe-streams.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=d=1:s=64x48:r=25 -f lavfi -i testsrc2=d=1:s=80x60:r=25 -f lavfi -i sine=d=1:r=44100 \
+        -map 0 -map 1 -map 2 -c:v:0 mpeg2video -c:v:1 mpeg4 -bf 2 -c:a mp2 \
+        -flags +bitexact -fflags +bitexact -y $(TARGET_PATH)/$@ 2>/dev/null
+
+# The first run stores the probe cache entry, the second one uses it.
+FATE_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER TESTSRC2_FILTER SINE_FILTER MPEG2VIDEO_ENCODER MPEG4_ENCODER MP2_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-ffprobe_probe_cache
+fate-ffprobe_probe_cache: $(FFPROBE_STREAMS_FILE)
+fate-ffprobe_probe_cache: CMD = rm -rf tests/data/probe-cache; mkdir tests/data/probe-cache; \
+    run $(FFPROBE_STREAMS_COMMAND) -probe_cache tests/data/probe-cache; \
+    run $(FFPROBE_STREAMS_COMMAND) -probe_cache tests/data/probe-cache
+
+FATE_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER TESTSRC2_FILTER SINE_FILTER MPEG2VIDEO_ENCODER MPEG4_ENCODER MP2_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-ffprobe_probe_threads
+fate-ffprobe_probe_threads: $(FFPROBE_STREAMS_FILE)
+fate-ffprobe_probe_threads: CMD = run $(FFPROBE_STREAMS_COMMAND) -probe_threads 3
+
 FATE_FFPROBE += $(FATE_FFPROBE-yes)
 
 fate-ffprobe: $(FATE_FFPROBE)
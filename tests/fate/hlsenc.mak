@@ -41,6 +41,13 @@ fate-hls-live-endlist: CMD = md5 -i $(SRC) -af hdcd=process_stereo=false -t 20 -
 fate-hls-live-endlist: CMP = oneline
 fate-hls-live-endlist: REF = e189ce781d9c87882f58e3929455167b
 
+FATE_AFILTER-$(call ALLYES, HLS_DEMUXER MPEGTS_MUXER MPEGTS_DEMUXER AEVALSRC_FILTER LAVFI_INDEV MP2FIXED_ENCODER) += fate-hls-prefetch
+fate-hls-prefetch: tests/data/live_endlist.m3u8
+fate-hls-prefetch: SRC = $(TARGET_PATH)/tests/data/live_endlist.m3u8
+fate-hls-prefetch: CMD = md5 -prefetch 2 -prefetch_size 65536 -i $(SRC) -af hdcd=process_stereo=false -t 20 -f s24le
+fate-hls-prefetch: CMP = oneline
+fate-hls-prefetch: REF = e189ce781d9c87882f58e3929455167b
+
 tests/data/hls_segment_size.m3u8: TAG = GEN
 tests/data/hls_segment_size.m3u8: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
 	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< \
@@ -97,3 +104,15 @@ FATE_AFILTER-$(call ALLYES, HLS_DEMUXER MPEGTS_MUXER MPEGTS_DEMUXER AEVALSRC_FIL
 fate-hls-fmp4: tests/data/hls_segment_type_fmp4.m3u8
 fate-hls-fmp4: CMD = framecrc -flags +bitexact -i $(TARGET_PATH)/tests/data/hls_fmp4.m3u8 -vf setpts=N*23
 
+
+tests/data/hls_parts.m3u8: TAG = GEN
+tests/data/hls_parts.m3u8: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< \
+	-f lavfi -i "aevalsrc=cos(2*PI*t)*sin(2*PI*(440+4*t)*t):d=7" -map 0 -codec:a mp2fixed \
+	-hls_segment_type fmp4 -hls_fmp4_init_filename hls_parts_init.mp4 -hls_list_size 0 \
+	-hls_time 2 -hls_part_time 0.5 -hls_segment_filename "$(TARGET_PATH)/tests/data/hls_parts_%d.m4s" \
+	$(TARGET_PATH)/tests/data/hls_parts.m3u8 2>/dev/null
+
+FATE_AFILTER-$(call ALLYES, HLS_MUXER MP4_MUXER AEVALSRC_FILTER LAVFI_INDEV MP2FIXED_ENCODER) += fate-hls-parts
+fate-hls-parts: tests/data/hls_parts.m3u8
+fate-hls-parts: CMD = cat $(TARGET_PATH)/tests/data/hls_parts.m3u8
@@ -32,11 +32,17 @@ FATE_MOV_FFPROBE = fate-mov-neg-firstpts-discard \
 
 FATE_MOV_FASTSTART = fate-mov-faststart-4gb-overflow \
 
+FATE_MOV_FFPROBE_LAVFI-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER MPEG4_ENCODER MP2_ENCODER MP4_MUXER MOV_DEMUXER) += fate-mov-compact-index
+FATE_MOV_FFPROBE_LAVFI-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER MPEG4_ENCODER MP2_ENCODER MP4_MUXER MOV_DEMUXER) += fate-mov-lazy-fragments
+FATE_MOV_FFPROBE_LAVFI-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER MPEG4_ENCODER MP2_ENCODER ISMV_MUXER MOV_DEMUXER) += fate-mov-lazy-fragments-ismv
+FATE_MOV_FFPROBE_LAVFI-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER MPEG4_ENCODER PCM_S16LE_ENCODER MOV_MUXER MOV_DEMUXER) += fate-mov-reserve-moov
+
 FATE_SAMPLES_AVCONV += $(FATE_MOV)
 FATE_SAMPLES_FFPROBE += $(FATE_MOV_FFPROBE)
 FATE_SAMPLES_FASTSTART += $(FATE_MOV_FASTSTART)
+FATE_FFPROBE += $(FATE_MOV_FFPROBE_LAVFI-yes)
 
-fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART)
+fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART) $(FATE_MOV_FFPROBE_LAVFI-yes)
 
 # Make sure we handle edit lists correctly in normal cases.
 fate-mov-1elist-noctts: CMD = framemd5 -i $(TARGET_SAMPLES)/mov/mov-1elist-noctts.mov
@@ -124,3 +130,48 @@ fate-mov-faststart-4gb-overflow: CMP = oneline
 fate-mov-faststart-4gb-overflow: REF = bc875921f151871e787c4b4023269b29
 
 fate-mov-mp4-with-mov-in24-ver: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -show_entries stream=codec_name -select_streams 1 $(TARGET_SAMPLES)/mov/mp4-with-mov-in24-ver.mp4
+
+tests/data/mov-compact-index.mp4: TAG = GEN
+tests/data/mov-compact-index.mp4: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+	-f lavfi -i testsrc=d=4:s=64x48:r=25 -f lavfi -i sine=d=4:r=22050 \
+	-c:v mpeg4 -bf 2 -g 25 -c:a mp2 -flags +bitexact -fflags +bitexact \
+	-y $(TARGET_PATH)/tests/data/mov-compact-index.mp4 2>/dev/null
+
+# Makes sure that the packets read and seeked to with the on-demand sample index match the expanded index.
+fate-mov-compact-index: tests/data/mov-compact-index.mp4
+fate-mov-compact-index: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 -compact_index 1 -read_intervals 0%+\#6,2.5%+\#6 -show_entries packet=stream_index,pts,dts,duration,pos,flags -print_format compact $(TARGET_PATH)/tests/data/mov-compact-index.mp4
+
+tests/data/mov-lazy-fragments.mp4: TAG = GEN
+tests/data/mov-lazy-fragments.mp4: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+	-f lavfi -i testsrc=d=4:s=64x48:r=25 -f lavfi -i sine=d=4:r=22050 \
+	-c:v mpeg4 -bf 2 -g 25 -c:a mp2 -flags +bitexact -fflags +bitexact \
+	-movflags frag_keyframe+empty_moov -y $(TARGET_PATH)/tests/data/mov-lazy-fragments.mp4 2>/dev/null
+
+# Makes sure that reading the fragments on demand from the mfra gives the same packets, also after seeking.
+fate-mov-lazy-fragments: tests/data/mov-lazy-fragments.mp4
+fate-mov-lazy-fragments: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 -lazy_fragments 1 -read_intervals 0%+\#6,2.5%+\#6 -show_entries packet=stream_index,pts,dts,duration,pos,flags -print_format compact $(TARGET_PATH)/tests/data/mov-lazy-fragments.mp4
+
+tests/data/mov-lazy-fragments.ismv: TAG = GEN
+tests/data/mov-lazy-fragments.ismv: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+	-f lavfi -i testsrc=d=4:s=64x48:r=25 -f lavfi -i sine=d=4:r=22050 \
+	-c:v mpeg4 -bf 2 -g 25 -c:a mp2 -flags +bitexact -fflags +bitexact \
+	-f ismv -y $(TARGET_PATH)/tests/data/mov-lazy-fragments.ismv 2>/dev/null
+
+# Makes sure that fragments without tfdt are still all read when lazy_fragments is enabled.
+fate-mov-lazy-fragments-ismv: tests/data/mov-lazy-fragments.ismv
+fate-mov-lazy-fragments-ismv: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 -lazy_fragments 1 -read_intervals 0%+\#6,2.5%+\#6 -show_entries packet=stream_index,pts,dts,duration,pos,flags -print_format compact $(TARGET_PATH)/tests/data/mov-lazy-fragments.ismv
+
+tests/data/mov-reserve-moov-src.mov: TAG = GEN
+tests/data/mov-reserve-moov-src.mov: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+	-f lavfi -i testsrc=d=4:s=64x48:r=25 -f lavfi -i sine=d=4:r=22050 \
+	-c:v mpeg4 -g 25 -c:a pcm_s16le -flags +bitexact -fflags +bitexact \
+	-y $(TARGET_PATH)/tests/data/mov-reserve-moov-src.mov 2>/dev/null
+
+# Makes sure that the reserved moov is written before the mdat in a single pass,
+# any fallback to the faststart second pass would show up as a warning.
+fate-mov-reserve-moov: tests/data/mov-reserve-moov-src.mov
+fate-mov-reserve-moov: CMD = run ffmpeg$(PROGSSUF)$(EXESUF) -nostdin -v warning -i $(TARGET_PATH)/tests/data/mov-reserve-moov-src.mov -c copy -flags +bitexact -fflags +bitexact -movflags +reserve_moov -y $(TARGET_PATH)/tests/data/mov-reserve-moov.mov 2>&1; run ffprobe$(PROGSSUF)$(EXESUF) -v trace $(TARGET_PATH)/tests/data/mov-reserve-moov.mov 2>&1 | grep -o "type:.\{6\} parent:.root. sz: [0-9 ]*"
@@ -20,6 +20,82 @@ fate-mpegts-probe-pmt-merge: SRC = $(TARGET_SAMPLES)/mpegts/pmtchange.ts
 fate-mpegts-probe-pmt-merge: CMD = run $(PROBE_CODEC_NAME_COMMAND) -merge_pmt_versions 1 -i "$(SRC)"
 
 
+#
+# Test muxing more services than fit in a single SDT section
+#
+MPEGTS_SDT_PROGRAMS = $(foreach A,0 1 2 3 4,$(foreach B,0 1 2 3 4 5 6 7 8 9,-program st=0))
+
+tests/data/mpegts-sdt-sections.ts: TAG = GEN
+tests/data/mpegts-sdt-sections.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=d=0.2:s=64x64 -c:v mpeg2video -bitexact $(MPEGTS_SDT_PROGRAMS) \
+        -y $(TARGET_PATH)/tests/data/mpegts-sdt-sections.ts 2>/dev/null
+
+FATE_MPEGTS_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER MPEG2VIDEO_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-mpegts-sdt-sections
+fate-mpegts-sdt-sections: tests/data/mpegts-sdt-sections.ts
+fate-mpegts-sdt-sections: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 \
+    -show_entries program=program_id,pmt_pid:program_tags=service_name,service_provider \
+    -print_format compact $(TARGET_PATH)/tests/data/mpegts-sdt-sections.ts
+
+
+#
+# Test resyncing on garbage before and inside the transport stream
+#
+tests/data/mpegts-resync.ts: TAG = GEN
+tests/data/mpegts-resync.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=d=1:s=64x48:r=25 -f lavfi -i sine=d=1:r=44100 \
+        -c:v mpeg2video -c:a mp2 -flags +bitexact -fflags +bitexact \
+        -y $(TARGET_PATH)/tests/data/mpegts-resync-clean.ts 2>/dev/null
+	$(Q)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i "aevalsrc=mod(n\,256)/128-1:d=0.1:s=8000" -f u8 \
+        -y $(TARGET_PATH)/tests/data/mpegts-resync-junk.raw 2>/dev/null
+	$(Q){ cat tests/data/mpegts-resync-junk.raw; head -c 9500 tests/data/mpegts-resync-clean.ts; \
+	cat tests/data/mpegts-resync-junk.raw; tail -c +9501 tests/data/mpegts-resync-clean.ts; } > $@
+
+FATE_MPEGTS_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER AEVALSRC_FILTER MPEG2VIDEO_ENCODER MP2_ENCODER PCM_U8_ENCODER PCM_U8_MUXER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-mpegts-resync
+fate-mpegts-resync: tests/data/mpegts-resync.ts
+fate-mpegts-resync: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -v 0 \
+    -show_entries packet=stream_index,pts,dts,size,pos,flags \
+    -print_format compact $(TARGET_PATH)/tests/data/mpegts-resync.ts
+
+
+#
+# Test demuxing only some of the programs or elementary streams
+#
+tests/data/mpegts-select.ts: TAG = GEN
+tests/data/mpegts-select.ts: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i testsrc=d=0.5:s=64x48:r=25 -f lavfi -i testsrc2=d=0.5:s=64x48:r=25 -f lavfi -i sine=d=0.5 \
+        -map 0 -map 1 -map 2 -c:v mpeg2video -c:a mp2 -flags +bitexact -fflags +bitexact \
+        -program program_num=1:st=0 -program program_num=2:st=1 -program program_num=3:st=2 \
+        -y $(TARGET_PATH)/tests/data/mpegts-select.ts 2>/dev/null
+
+MPEGTS_SELECT_COMMAND = \
+    ffprobe$(PROGSSUF)$(EXESUF) -v 0 -show_entries program=program_id:stream=index,id,codec_name \
+    -show_entries packet=stream_index,pts,dts,size -print_format compact
+
+FATE_MPEGTS_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER TESTSRC2_FILTER SINE_FILTER MPEG2VIDEO_ENCODER MP2_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-mpegts-select-programs
+fate-mpegts-select-programs: tests/data/mpegts-select.ts
+fate-mpegts-select-programs: CMD = run $(MPEGTS_SELECT_COMMAND) -select_programs 2,3 $(TARGET_PATH)/tests/data/mpegts-select.ts
+
+FATE_MPEGTS_FFPROBE-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER TESTSRC2_FILTER SINE_FILTER MPEG2VIDEO_ENCODER MP2_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER) += fate-mpegts-select-pids
+fate-mpegts-select-pids: tests/data/mpegts-select.ts
+fate-mpegts-select-pids: CMD = run $(MPEGTS_SELECT_COMMAND) -select_pids 256,0x102 $(TARGET_PATH)/tests/data/mpegts-select.ts
+
+
+#
+# Test CBR muxing, where the PCR follows the output position
+#
+FATE_MPEGTS_FFMPEG-$(call ALLYES, LAVFI_INDEV TESTSRC_FILTER SINE_FILTER MPEG2VIDEO_ENCODER MP2_ENCODER MPEGTS_MUXER) += fate-mpegts-cbr
+fate-mpegts-cbr: CMD = md5 -f lavfi -i testsrc=d=2:s=64x48:r=25 -f lavfi -i sine=d=2 \
+    -c:v mpeg2video -c:a mp2 -flags +bitexact -fflags +bitexact -muxrate 2000000 -f mpegts
+fate-mpegts-cbr: CMP = oneline
+fate-mpegts-cbr: REF = e4fc10adf7ee2906d7cd269ad974c077
+
+
 FATE_SAMPLES_FFPROBE += $(FATE_MPEGTS_PROBE-yes)
+FATE_FFPROBE += $(FATE_MPEGTS_FFPROBE-yes)
+FATE_FFMPEG += $(FATE_MPEGTS_FFMPEG-yes)
 
-fate-mpegts: $(FATE_MPEGTS_PROBE-yes)
+fate-mpegts: $(FATE_MPEGTS_PROBE-yes) $(FATE_MPEGTS_FFPROBE-yes) $(FATE_MPEGTS_FFMPEG-yes)